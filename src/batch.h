@@ -0,0 +1,290 @@
+#ifndef BATCH
+#define BATCH
+
+#include <stdio.h>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <utility>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#ifndef UTILS
+#include "utils.h"
+#endif
+
+#ifndef POOL
+#include "pool.h"
+#endif
+
+#ifndef SCENE
+#include "scene.h"
+#endif
+
+#ifndef WORLD
+#include "world.h"
+#endif
+
+/************************************************
+*
+* BATCH GENERATION
+*
+*************************************************/
+
+typedef std::vector<std::pair<std::string, float>> Parameters;
+
+/**
+ * World to generate, parameters are applied over defaults of map
+ */
+struct WorldJob
+{
+    unsigned int seed {0};
+    float scale {1.0};
+    std::string scene {"DefaultScene"};
+    Parameters parameters;
+    std::string out;
+};
+
+struct WorldResult
+{
+    const WorldJob* job {nullptr};
+    bool ok {false};
+    std::string error;
+    std::string degraded;
+    double ms {0};
+    size_t bytes {0};
+};
+
+inline std::string Trim(const std::string& s)
+{
+    auto begin = s.find_first_not_of(" \t\r\n");
+    auto end = s.find_last_not_of(" \t\r\n");
+    return begin == std::string::npos ? std::string() : s.substr(begin, end - begin + 1);
+};
+
+/**
+ * Parse value of named parameter, false with error message if name or value is invalid
+ */
+inline bool ParseParameter(const std::string& name, const std::string& value, Parameters& parameters, std::string& error)
+{
+    char* end = nullptr;
+    auto number = strtof(value.c_str(), &end);
+    if (value.empty() || *end != '\0')
+    {
+        error = "INVALID VALUE " + value;
+        return false;
+    }
+
+    Map probe;
+    if (!probe.SetParameter(name, number))
+    {
+        error = "UNKNOWN PARAMETER " + name;
+        return false;
+    }
+
+    parameters.emplace_back(name, number);
+    return true;
+};
+
+/**
+ * Read parameter file with lines name = value, # starts comment
+ */
+inline bool ReadParameters(const std::string& path, Parameters& parameters, std::string& error)
+{
+    auto* file = fopen(path.c_str(), "r");
+    if (file == nullptr)
+    {
+        error = "CAN NOT OPEN PARAMETER FILE " + path;
+        return false;
+    }
+
+    char line[256];
+    auto number = 0;
+    auto ok = true;
+    while (ok && fgets(line, sizeof(line), file) != nullptr)
+    {
+        number += 1;
+        auto text = Trim(std::string(line).substr(0, std::string(line).find('#')));
+        if (text.empty())
+            continue;
+
+        auto eq = text.find('=');
+        if (eq == std::string::npos)
+        {
+            error = "EXPECTED name = value";
+            ok = false;
+        }
+        else ok = ParseParameter(Trim(text.substr(0, eq)), Trim(text.substr(eq + 1)), parameters, error);
+
+        if (!ok)
+            error = path + ":" + std::to_string(number) + ": " + error;
+    }
+
+    fclose(file);
+    return ok;
+};
+
+/**
+ * Run scene of job on fresh or warm map, false with error message if generation failed
+ */
+inline bool GenerateWorld(Map& map, const WorldJob& job, std::string& error)
+{
+    std::unique_ptr<Scene> scene {CreateScene(job.scene)};
+    if (scene == nullptr)
+    {
+        error = "UNKNOWN SCENE " + job.scene;
+        return false;
+    }
+
+    // WARM MAP OF SAME SIZE KEEPS ITS PIXELS, PARAMETERS START FROM DEFAULTS
+    Map defaults;
+    map.CopyParameters(defaults);
+    if (map.IsInitialized() && map.Scale() == job.scale)
+        map.Reset();
+    else
+    {
+        map.ClearAll();
+        map.Scale(job.scale);
+        map.Init();
+    }
+
+    map.Seed(job.seed);
+    for (auto& parameter: job.parameters)
+        map.SetParameter(parameter.first, parameter.second);
+
+    GenerateAll(map);
+    scene->Run(map);
+    GenerationDone(map);
+
+    if (map.HasError())
+    {
+        error = map.PopError();
+        return false;
+    }
+    return true;
+};
+
+/**
+ * Peak resident set size of process in MB, 0 where it is not available
+ */
+inline double PeakRSS()
+{
+#ifndef _WIN32
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        return usage.ru_maxrss / 1024.0;
+#endif
+    return 0;
+};
+
+/**
+ * Sizes of queues between generation, encoding and writing of batch
+ */
+struct PipelineOptions
+{
+    size_t generated {2};
+    size_t encoded {4};
+};
+
+/**
+ * Generate worlds of jobs, concurrency of them at once, and write each one as soon as it is done.
+ * Generation, encoding and writing run as pipeline so next world is generated while previous one
+ * is encoded and written, full queues hold earlier stages back when I/O falls behind. Every world
+ * is its own task group so stages of all worlds share pool fairly
+ */
+inline void RunBatch(const std::vector<WorldJob>& jobs, unsigned int concurrency, std::function<void(const WorldResult&)> done, PipelineOptions options = PipelineOptions())
+{
+    struct Generated
+    {
+        WorldResult result;
+        std::unique_ptr<Map> map;
+    };
+
+    struct Encoded
+    {
+        WorldResult result;
+        std::vector<unsigned char> world;
+    };
+
+    BoundedQueue<Generated> generated {options.generated};
+    BoundedQueue<Encoded> encoded {options.encoded};
+    BoundedQueue<std::unique_ptr<Map>> warm {jobs.size() + 1};
+    std::atomic<size_t> next {0};
+    std::atomic<unsigned int> generating {0};
+
+    // GENERATION, MAPS RETURNED BY ENCODER ARE REUSED
+    auto generator = [&]()
+    {
+        for (auto i = next++; i < jobs.size(); i = next++)
+        {
+            TaskGroup() = (unsigned int) i + 1;
+            auto start = std::chrono::steady_clock::now();
+
+            Generated item;
+            item.result.job = &jobs[i];
+            if (!warm.TryPop(item.map))
+                item.map.reset(new Map());
+            item.result.ok = GenerateWorld(*item.map, jobs[i], item.result.error);
+            item.result.degraded = item.map->Degradations();
+            item.result.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            generated.Push(std::move(item));
+        }
+        TaskGroup() = 0;
+
+        if (--generating == 0)
+            generated.Close();
+    };
+
+    auto encoder = [&]()
+    {
+        Generated item;
+        while (generated.Pop(item))
+        {
+            Encoded out;
+            if (item.result.ok)
+                out.world = EncodeWorld(*item.map);
+            warm.Push(std::move(item.map));
+
+            out.result = item.result;
+            out.result.bytes = out.world.size();
+            encoded.Push(std::move(out));
+        }
+        encoded.Close();
+    };
+
+    auto writer = [&]()
+    {
+        Encoded item;
+        while (encoded.Pop(item))
+        {
+            if (item.result.ok && !WriteWorld(item.result.job->out, item.world))
+            {
+                item.result.ok = false;
+                item.result.error = "CAN NOT WRITE " + item.result.job->out;
+            }
+            done(item.result);
+        }
+    };
+
+    auto count = std::max(1u, std::min(concurrency, (unsigned int) jobs.size()));
+    generating = count;
+
+    std::vector<std::thread> threads;
+    for (auto r = 0u; r < count; ++r)
+        threads.emplace_back(generator);
+    threads.emplace_back(encoder);
+    writer();
+
+    for (auto& thread: threads)
+        thread.join();
+};
+
+#endif // BATCH
@@ -0,0 +1,148 @@
+#include <memory>
+#include <stdio.h>
+#include <string>
+#include <cstdlib>
+#include <chrono>
+#include <functional>
+
+#include "utils.h"
+#include "pcg.h"
+
+
+/**************************************************
+*
+* CONSTRAINT MICRO BENCHMARK
+*
+**************************************************/
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * Values of pairs of variables which checks cycle through
+ */
+const int PAIRS = 1024;
+
+double Seconds(Clock::time_point since)
+{
+    return std::chrono::duration<double>(Clock::now() - since).count();
+};
+
+void Report(const char* constraint, const char* path, long checks, long passed, double seconds)
+{
+    printf("%-18s %-8s %8.1f M checks/s  (%ld of %ld satisfied)\n", constraint, path, checks / seconds / 1e6, passed, checks);
+};
+
+/**
+ * Check constraint over same pairs of values through named assignment, virtual call of indexed
+ * constraint and static dispatch of indexed constraint
+ */
+void BenchChecks(const char* name, const Constraint<std::string, int>& constraint, const std::vector<std::string>& names, const std::vector<int>& pairs, long checks)
+{
+    std::unordered_map<std::string, int> ids;
+    for (auto id = 0; id < (int) names.size(); ++id) ids[names[id]] = id;
+    auto indexed = constraint.bind(ids, names);
+    auto arity = (int) names.size();
+
+    // NAMED ASSIGNMENT IS CHECKED BY STRING LOOKUPS AS BOUND CONSTRAINTS DO
+    std::unordered_map<std::string, int> assignment;
+    long passed = 0;
+    auto start = Clock::now();
+    for (long i = 0; i < checks; ++i)
+    {
+        auto* values = &pairs[(i % PAIRS) * arity];
+        for (auto v = 0; v < arity; ++v) assignment[names[v]] = values[v];
+        passed += constraint.satisfied(assignment);
+    }
+    Report(name, "named", checks, passed, Seconds(start));
+
+    // VARIABLES HAVE IDS FROM 0, SO VALUES OF EACH PAIR ARE FLAT ASSIGNMENT
+    passed = 0;
+    start = Clock::now();
+    for (long i = 0; i < checks; ++i)
+        passed += indexed->satisfied(&pairs[(i % PAIRS) * arity]);
+    Report(name, "virtual", checks, passed, Seconds(start));
+
+    // DISPATCH HAPPENS ONCE FOR LOOP AS IN SEARCH, WHICH DISPATCHES ONCE FOR EACH NEIGHBOUR
+    passed = 0;
+    start = Clock::now();
+    Dispatch(*indexed, [&](const auto& c){
+        for (long i = 0; i < checks; ++i)
+            passed += c.satisfied(&pairs[(i % PAIRS) * arity]);
+    });
+    Report(name, indexed->kind == IndexedConstraint::GENERIC ? "generic" : "static", checks, passed, Seconds(start));
+};
+
+/**
+ * Search of rectangles which do not overlap with force stop as lambda and as std::function,
+ * search calls force stop for each value it tries
+ */
+template <typename F>
+void BenchSearch(const char* path, int count, int rounds, F force_stop)
+{
+    const int width = 1000, height = 1000, w = 30, h = 20, step = 10;
+    std::vector<int> domain;
+    for (auto y = 0; y + h < height; y += step)
+        for (auto x = 0; x + w < width; x += step) domain.push_back(y * width + x);
+
+    unsigned long long nodes = 0;
+    auto start = Clock::now();
+    for (auto round = 0; round < rounds; ++round)
+    {
+        CSPCore core;
+        std::vector<int> variables;
+        for (auto i = 0; i < count; ++i) variables.push_back(core.add_variable(domain));
+        core.add_constraint(std::unique_ptr<IndexedConstraint>(new IndexedNoOverlapConstraint(variables, std::vector<int>(count, w), std::vector<int>(count, h), width)));
+
+        std::vector<int> values(count, CSP_UNASSIGNED);
+        core.search(values, force_stop);
+        nodes += core.stats.nodes;
+    }
+    auto seconds = Seconds(start);
+    printf("%-18s %-8s %8.1f K nodes/s  (%llu nodes, %.0fms)\n", "search", path, nodes / seconds / 1e3, nodes, seconds * 1e3);
+};
+
+void Usage(const char* program)
+{
+    printf("Usage: %s [--checks N] [--rounds N]\n", program);
+    printf("  --checks N   checks of each constraint on each path (default 20000000)\n");
+    printf("  --rounds N   searches on each path (default 20)\n");
+};
+
+int main(int argc, char** argv)
+{
+    long checks = 20000000;
+    int rounds = 20;
+    for (auto i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--checks" && i + 1 < argc) checks = atol(argv[++i]);
+        else if (arg == "--rounds" && i + 1 < argc) rounds = atoi(argv[++i]);
+        else
+        {
+            Usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // VALUES ARE RANDOM POSITIONS OF 1000 WIDE GRID, SO SOME RECTANGLES OVERLAP
+    Random rng {0};
+    std::vector<int> pairs(2 * PAIRS);
+    for (auto& value: pairs) value = (int) (rng() % 200) * 1000 + (int) (rng() % 200);
+    std::vector<int> singles(pairs.begin(), pairs.begin() + PAIRS);
+
+    DistanceConstraint<std::string, int> distance ("a", "b", 50000);
+    BenchChecks("distance", distance, {"a", "b"}, pairs, checks);
+
+    NonIntersectionConstraint2D<std::string, int> intersection ("a", "b", 30, 20, 30, 20, 1000);
+    BenchChecks("non intersection", intersection, {"a", "b"}, pairs, checks);
+
+    // INSIDE PIXEL ARRAY IS UNARY AND LOOKS UP PIXELS IN HASH SET, IT STAYS GENERIC
+    PixelArray area;
+    PixelsOfRect(0, 0, 150, 150, area);
+    InsidePixelArrayConstraint2D<std::string, int> inside ("a", 30, 20, area, Rect(0, 0, 1000, 200));
+    BenchChecks("inside pixels", inside, {"a"}, singles, checks / 10);
+
+    BenchSearch("lambda", 60, rounds, [](){ return false; });
+    BenchSearch("function", 60, rounds, std::function<bool(void)>([](){ return false; }));
+    return 0;
+};
@@ -0,0 +1,567 @@
+#ifndef CACHE
+#define CACHE
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <type_traits>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <stdio.h>
+
+#ifndef UTILS
+#include "utils.h"
+#endif
+
+/************************************************
+*
+* STAGE RESULT CACHE
+*
+*************************************************/
+
+/**
+ * FNV-1a hash used for building of stage keys
+ */
+class StageHash
+{
+    protected:
+        uint64_t value {14695981039346656037ULL};
+
+    public:
+        StageHash& Bytes(const void* data, size_t size)
+        {
+            auto* bytes = static_cast<const unsigned char*>(data);
+            for (size_t i = 0; i < size; ++i)
+            {
+                value ^= bytes[i];
+                value *= 1099511628211ULL;
+            }
+            return *this;
+        };
+
+        template <typename T>
+        StageHash& Add(T v)
+        {
+            static_assert(std::is_arithmetic<T>::value, "only arithmetic values can be hashed");
+            return Bytes(&v, sizeof(v));
+        };
+
+        StageHash& Add(const std::string& s)
+        {
+            Add(s.size());
+            return Bytes(s.data(), s.size());
+        };
+
+        // ZERO IS RESERVED FOR UNKNOWN KEY
+        uint64_t Value() const { return value == 0 ? 1 : value; };
+};
+
+/**
+ * Key of stage result, it is derived from seed, parameters used by stage and versions of upstream stages
+ * Returns 0 when stage can not be cached
+ */
+inline uint64_t StageKey(Map& map, const std::string& scene, int stage)
+{
+    StageHash hash;
+    hash.Add(scene).Add(stage).Add(map.Seed());
+
+    switch (stage)
+    {
+        case 0:
+            hash.Add(map.Width()).Add(map.Height());
+            return hash.Value();
+        case 1:
+            if (map.StageVersion(0) == 0) return 0;
+            hash.Add(map.StageVersion(0));
+            return hash.Value();
+        case 2:
+            if (map.StageVersion(1) == 0) return 0;
+            hash.Add(map.StageVersion(1));
+            hash.Add(map.HillsFrequency()).Add(map.HolesFrequency());
+            hash.Add(map.IslandsFrequency()).Add(map.CabinsFrequency());
+            return hash.Value();
+        case 3:
+            if (map.StageVersion(2) == 0) return 0;
+            hash.Add(map.StageVersion(2));
+            hash.Add(map.SurfacePartsCount()).Add(map.SurfacePartsFrequency()).Add(map.SurfacePartsOctaves());
+            hash.Add(map.ChasmFrequency()).Add(map.LakeFrequency()).Add(map.TreeFrequency());
+            hash.Add(map.CopperFrequency()).Add(map.CopperSize());
+            hash.Add(map.IronFrequency()).Add(map.IronSize());
+            return hash.Value();
+        case 4:
+            // UNDERGROUND RUNS CONCURRENTLY WITH BIOMES AND ONLY READS HORIZONTAL AREAS
+            // RESTRICTED TO REGION OF INTEREST IT IS ONLY PARTIAL
+            if (map.StageVersion(0) == 0 || map.HasRegionOfInterest()) return 0;
+            hash.Add(map.StageVersion(0));
+            hash.Add(map.CaveFrequency()).Add(map.CaveStrokeSize());
+            hash.Add(map.CavePointsSize()).Add(map.CaveCurvness());
+            hash.Add(map.CopperFrequency()).Add(map.CopperSize());
+            hash.Add(map.IronFrequency()).Add(map.IronSize());
+            hash.Add(map.SilverFrequency()).Add(map.SilverSize());
+            hash.Add(map.GoldFrequency()).Add(map.GoldSize());
+            return hash.Value();
+        default:
+            return 0;
+    }
+};
+
+namespace Snapshot
+{
+    enum Container: int { BIOMES, DEFINED, GENERATED, UNDERGROUND };
+    enum Layer: int { BIOME, DEFINED_STRUCTURE, GENERATED_STRUCTURE };
+
+    struct Structure
+    {
+        int container;
+        unsigned long type;
+        std::vector<Pixel> pixels;
+
+        // SURFACE PART ONLY
+        bool surface_part {false};
+        int sx {0};
+        int ex {0};
+        int before {-1};
+        int next {-1};
+        std::vector<int> ypsilons;
+    };
+
+    /**
+     * Final value of metadata layer written by stage, structure is index into snapshot or -1 for none
+     */
+    struct Delta
+    {
+        int index;
+        int structure;
+    };
+};
+
+/**
+ * Structures created by stage together with metadata layers it wrote
+ */
+class StageSnapshot
+{
+    public:
+        int stage {0};
+        uint64_t version {0};
+        int width {0};
+        int height {0};
+        std::vector<std::vector<Pixel>> areas;
+        std::vector<Snapshot::Structure> structures;
+        std::vector<Snapshot::Delta> deltas[3];
+
+        size_t Bytes() const
+        {
+            size_t bytes = sizeof(StageSnapshot);
+            for (auto& area: areas) bytes += area.size() * sizeof(Pixel);
+            for (auto& s: structures) bytes += sizeof(s) + s.pixels.size() * sizeof(Pixel) + s.ypsilons.size() * sizeof(int);
+            for (auto& layer: deltas) bytes += layer.size() * sizeof(Snapshot::Delta);
+            return bytes;
+        };
+};
+
+/**
+ * In-memory LRU cache of stage results with memory cap
+ */
+class StageCache
+{
+    protected:
+        typedef std::pair<uint64_t, std::shared_ptr<const StageSnapshot>> Entry;
+
+        std::mutex mutex;
+        size_t capacity;
+        size_t bytes {0};
+        std::list<Entry> entries; // MOST RECENTLY USED FIRST
+        std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+
+        std::atomic<uint64_t> versions {0};
+        std::atomic<unsigned long> hits {0};
+        std::atomic<unsigned long> misses {0};
+        std::atomic<unsigned long> evictions {0};
+
+        void Evict(size_t limit)
+        {
+            while (bytes > limit && !entries.empty())
+            {
+                bytes -= entries.back().second->Bytes();
+                index.erase(entries.back().first);
+                entries.pop_back();
+                evictions += 1;
+            }
+        };
+
+    public:
+        StageCache(size_t _capacity): capacity{_capacity} {};
+
+        auto Capacity()
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            return capacity;
+        };
+
+        void Capacity(size_t _capacity)
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            capacity = _capacity;
+            Evict(capacity);
+        };
+
+        auto Bytes()
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            return bytes;
+        };
+
+        auto Hits() const { return hits.load(); };
+        auto Misses() const { return misses.load(); };
+        auto Evictions() const { return evictions.load(); };
+
+        float HitRate() const
+        {
+            auto total = hits.load() + misses.load();
+            return total == 0 ? 0.0 : (float) hits.load() / total;
+        };
+
+        uint64_t NextVersion() { return ++versions; };
+
+        std::shared_ptr<const StageSnapshot> Get(uint64_t key)
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            auto it = index.find(key);
+            if (it == index.end())
+            {
+                misses += 1;
+                return nullptr;
+            }
+            entries.splice(entries.begin(), entries, it->second);
+            hits += 1;
+            return it->second->second;
+        };
+
+        void Put(uint64_t key, std::shared_ptr<const StageSnapshot> snapshot)
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            auto it = index.find(key);
+            if (it != index.end())
+            {
+                bytes -= it->second->second->Bytes();
+                entries.erase(it->second);
+                index.erase(it);
+            }
+
+            auto size = snapshot->Bytes();
+            if (size > capacity)
+                return;
+
+            Evict(capacity - size);
+            entries.emplace_front(key, std::move(snapshot));
+            index[key] = entries.begin();
+            bytes += size;
+        };
+
+        void Clear()
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            entries.clear();
+            index.clear();
+            bytes = 0;
+        };
+};
+
+inline StageCache& SharedStageCache()
+{
+    static StageCache cache {512UL * 1024 * 1024};
+    return cache;
+};
+
+/**
+ * Create snapshot of stage from structures created after begin sizes and from journaled metadata writes
+ */
+inline auto CaptureStage(Map& map, int stage, const size_t begin[4], const MetadataJournal& journal)
+{
+    std::shared_ptr<StageSnapshot> snapshot {new StageSnapshot()};
+    snapshot->stage = stage;
+    snapshot->width = journal.Width();
+    snapshot->height = journal.Height();
+
+    if (stage == 0)
+        for (auto* area: map.HorizontalAreas())
+            snapshot->areas.emplace_back(area->begin(), area->end());
+
+    std::unordered_map<const void*, int> indices;
+    auto capture = [&](int container, PixelArray* arr, unsigned long type)
+    {
+        Snapshot::Structure s;
+        s.container = container;
+        s.type = type;
+        s.pixels.assign(arr->begin(), arr->end());
+        indices[arr] = snapshot->structures.size();
+        snapshot->structures.push_back(std::move(s));
+    };
+
+    // ONLY CONTAINERS OWNED BY STAGE, OTHER STAGES MAY RUN CONCURRENTLY
+    // CHASMS OF STAGE 3 ARE DEFINED STRUCTURES
+    auto owns = [stage](int container)
+    {
+        switch (container)
+        {
+            case Snapshot::BIOMES: return stage == 1;
+            case Snapshot::DEFINED: return stage == 2 || stage == 3;
+            case Snapshot::GENERATED: return stage == 3;
+            case Snapshot::UNDERGROUND: return stage == 4;
+        }
+        return false;
+    };
+
+    auto& biomes = map.Biomes();
+    if (owns(Snapshot::BIOMES))
+        for (auto i = begin[Snapshot::BIOMES]; i < biomes.size(); ++i)
+            capture(Snapshot::BIOMES, biomes[i].get(), biomes[i]->GetType());
+
+    auto& defined = map.DefinedStructures();
+    if (owns(Snapshot::DEFINED))
+        for (auto i = begin[Snapshot::DEFINED]; i < defined.size(); ++i)
+            capture(Snapshot::DEFINED, defined[i].get(), defined[i]->GetType());
+
+    auto& generated = map.GeneratedStructures();
+    if (owns(Snapshot::GENERATED))
+        for (auto i = begin[Snapshot::GENERATED]; i < generated.size(); ++i)
+            capture(Snapshot::GENERATED, generated[i].get(), generated[i]->GetType());
+
+    auto& underground = map.UndergroundStructures();
+    if (owns(Snapshot::UNDERGROUND))
+        for (auto i = begin[Snapshot::UNDERGROUND]; i < underground.size(); ++i)
+            capture(Snapshot::UNDERGROUND, underground[i].get(), underground[i]->GetType());
+
+    // SURFACE PARTS ARE LINKED LIST
+    for (auto i = owns(Snapshot::GENERATED) ? begin[Snapshot::GENERATED] : generated.size(); i < generated.size(); ++i)
+    {
+        auto* part = dynamic_cast<Structures::SurfacePart*>(generated[i].get());
+        if (part == nullptr)
+            continue;
+
+        auto& s = snapshot->structures[indices[part]];
+        s.surface_part = true;
+        s.sx = part->StartX();
+        s.ex = part->EndX();
+        s.ypsilons = part->GetYpsilons();
+        if (part->Before() != nullptr && indices.count(part->Before()) > 0) s.before = indices[part->Before()];
+        if (part->Next() != nullptr && indices.count(part->Next()) > 0) s.next = indices[part->Next()];
+    }
+
+    // METADATA LAYERS
+    auto find = [&](const void* ptr, int& structure)
+    {
+        if (ptr == nullptr)
+        {
+            structure = -1;
+            return true;
+        }
+        auto it = indices.find(ptr);
+        if (it == indices.end())
+            return false; // WRITTEN BY ANOTHER STAGE AFTERWARDS
+        structure = it->second;
+        return true;
+    };
+
+    for (auto i = 0; i < journal.Size(); ++i)
+    {
+        auto layers = journal.Layers(i);
+        if (layers == 0)
+            continue;
+
+        auto meta = map.GetMetadata({i % (journal.Width() + 1), i / (journal.Width() + 1)});
+        int structure;
+        if ((layers & MetadataJournal::BIOME) && find(meta.biome, structure))
+            snapshot->deltas[Snapshot::BIOME].push_back({i, structure});
+        if ((layers & MetadataJournal::DEFINED) && find(meta.defined_structure, structure))
+            snapshot->deltas[Snapshot::DEFINED_STRUCTURE].push_back({i, structure});
+        if ((layers & MetadataJournal::GENERATED) && find(meta.generated_structure, structure))
+            snapshot->deltas[Snapshot::GENERATED_STRUCTURE].push_back({i, structure});
+    }
+
+    return snapshot;
+};
+
+/**
+ * Apply snapshot to map, stage has to be cleared beforehand
+ */
+inline void RestoreStage(Map& map, const StageSnapshot& snapshot)
+{
+    auto areas = map.HorizontalAreas();
+    for (size_t i = 0; i < snapshot.areas.size() && i < areas.size(); ++i)
+    {
+        areas[i]->reserve(snapshot.areas[i].size());
+        for (auto p: snapshot.areas[i])
+            areas[i]->add(p);
+    }
+
+    std::vector<PixelArray*> arrays (snapshot.structures.size(), nullptr);
+    std::vector<Biomes::Biome*> biomes (snapshot.structures.size(), nullptr);
+    std::vector<Structures::DefinedStructure*> defined (snapshot.structures.size(), nullptr);
+    std::vector<Structures::GeneratedStructure*> generated (snapshot.structures.size(), nullptr);
+
+    for (size_t i = 0; i < snapshot.structures.size(); ++i)
+    {
+        auto& s = snapshot.structures[i];
+        switch (s.container)
+        {
+            case Snapshot::BIOMES:
+                biomes[i] = &map.Biome(s.type);
+                arrays[i] = biomes[i];
+                break;
+            case Snapshot::DEFINED:
+                defined[i] = &map.DefinedStructure(s.type);
+                arrays[i] = defined[i];
+                break;
+            case Snapshot::GENERATED:
+                if (s.surface_part)
+                {
+                    auto& part = map.SurfacePart(s.sx, s.ex);
+                    for (auto y: s.ypsilons) part.AddY(y);
+                    generated[i] = &part;
+                }
+                else
+                {
+                    generated[i] = &map.GeneratedStructure(s.type);
+                }
+                arrays[i] = generated[i];
+                break;
+            case Snapshot::UNDERGROUND:
+                generated[i] = &map.UndergroundStructure(s.type);
+                arrays[i] = generated[i];
+                break;
+        }
+
+        // METADATA IS RESTORED FROM LAYER DELTAS
+        arrays[i]->reserve(s.pixels.size());
+        for (auto p: s.pixels) arrays[i]->PixelArray::add(p);
+    }
+
+    for (size_t i = 0; i < snapshot.structures.size(); ++i)
+    {
+        auto& s = snapshot.structures[i];
+        if (!s.surface_part)
+            continue;
+
+        auto* part = static_cast<Structures::SurfacePart*>(generated[i]);
+        if (s.before != -1) part->SetBefore(static_cast<Structures::SurfacePart*>(generated[s.before]));
+        if (s.next != -1) part->SetNext(static_cast<Structures::SurfacePart*>(generated[s.next]));
+    }
+
+    auto decode = [&](int index) { return (Pixel){index % (snapshot.width + 1), index / (snapshot.width + 1)}; };
+
+    for (auto& delta: snapshot.deltas[Snapshot::BIOME])
+    {
+        auto p = decode(delta.index);
+        map.SetBiome(p, delta.structure == -1 ? nullptr : biomes[delta.structure]);
+    }
+
+    for (auto& delta: snapshot.deltas[Snapshot::DEFINED_STRUCTURE])
+    {
+        auto p = decode(delta.index);
+        map.SetDefinedStructure(p, delta.structure == -1 ? nullptr : defined[delta.structure]);
+    }
+
+    for (auto& delta: snapshot.deltas[Snapshot::GENERATED_STRUCTURE])
+    {
+        auto p = decode(delta.index);
+        map.SetGeneratedStructure(p, delta.structure == -1 ? nullptr : generated[delta.structure]);
+    }
+};
+
+/**
+ * Runs stage under metadata journal and stores its result into StageCache,
+ * or restores the result when the same configuration was generated before
+ */
+class StageRecorder
+{
+    protected:
+        Map& map;
+        int stage;
+        uint64_t key;
+        size_t errors;
+        size_t begin[4];
+        std::unique_ptr<MetadataJournal> journal;
+
+    public:
+        StageRecorder(Map& _map, const std::string& scene, int _stage): map{_map}, stage{_stage}
+        {
+            // STAGES ARE NOT KEYED WHEN CACHE IS DISABLED, SO THEY ARE NEITHER RESTORED NOR CAPTURED
+            key = SharedStageCache().Capacity() == 0 ? 0 : StageKey(map, scene, stage);
+            errors = map.ErrorCount();
+            begin[Snapshot::BIOMES] = map.Biomes().size();
+            begin[Snapshot::DEFINED] = map.DefinedStructures().size();
+            begin[Snapshot::GENERATED] = map.GeneratedStructures().size();
+            begin[Snapshot::UNDERGROUND] = map.UndergroundStructures().size();
+            journal.reset(new MetadataJournal(map.Width(), map.Height()));
+        };
+
+        bool Restore()
+        {
+            if (key == 0)
+                return false;
+
+            auto& cache = SharedStageCache();
+            auto snapshot = cache.Get(key);
+            if (snapshot == nullptr)
+                return false;
+
+#ifdef DEBUG
+            auto start = std::chrono::steady_clock::now();
+#endif
+            RestoreStage(map, *snapshot);
+            map.StageVersion(stage, snapshot->version);
+#ifdef DEBUG
+            auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+            printf("StageCache hit stage %d in %.0fms (hit rate %.2f)\n", stage, elapsed.count(), cache.HitRate());
+#endif
+            return true;
+        };
+
+        /**
+         * Wrap stage function so its metadata writes are journaled on any thread
+         */
+        template <typename F>
+        auto Journaled(F f)
+        {
+            auto* _journal = journal.get();
+            return [_journal, f](auto&&... args)
+            {
+                auto* previous = ActiveJournal();
+                ActiveJournal() = _journal;
+                f(std::forward<decltype(args)>(args)...);
+                ActiveJournal() = previous;
+            };
+        };
+
+        /**
+         * Run stage body on current thread and store its result
+         */
+        void Record(std::function<void()> body)
+        {
+            Journaled(body)();
+            Store();
+        };
+
+        void Store()
+        {
+            // DON'T CACHE INCOMPLETE, DEGRADED OR FAILED STAGES
+            if (key == 0 || map.ShouldForceStop() || map.IsDegraded(stage) || map.ErrorCount() != errors)
+                return;
+
+            auto& cache = SharedStageCache();
+            auto snapshot = CaptureStage(map, stage, begin, *journal);
+            snapshot->version = cache.NextVersion();
+            map.StageVersion(stage, snapshot->version);
+            cache.Put(key, std::move(snapshot));
+#ifdef DEBUG
+            printf("StageCache store stage %d (%.1f MB)\n", stage, cache.Bytes() / (1024.0 * 1024.0));
+#endif
+        };
+};
+
+#endif // CACHE
@@ -0,0 +1,112 @@
+#ifndef PCG_CAPI
+#define PCG_CAPI
+
+/************************************************
+*
+* C INTERFACE OF GENERATOR LIBRARY
+*
+*************************************************/
+
+/*
+ * Stable C interface of pcg library, usable from C or through FFI (ctypes, cffi, ...)
+ *
+ *   PCGMap* map = pcg_map_create(0.5f);
+ *   pcg_map_set_seed(map, 42);
+ *   pcg_map_set_parameter(map, "hills_frequency", 0.8f);
+ *   if (pcg_map_run_scene(map, "DefaultScene") == PCG_OK)
+ *   {
+ *       PCGLayer layer;
+ *       pcg_map_layer(map, PCG_LAYER_BIOME, &layer);
+ *       type of pixel (x, y) is layer.data[y * layer.stride + x]
+ *   }
+ *   pcg_map_destroy(map);
+ *
+ * Layers and structures point into map, they stay valid until next run or destroy of map.
+ * Single map must not be used from more threads at once, different maps can
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#if defined(_WIN32)
+#define PCG_EXPORT __declspec(dllexport)
+#else
+#define PCG_EXPORT __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PCG_API_VERSION 1
+
+typedef struct PCGMap PCGMap;
+
+enum PCGStatus
+{
+    PCG_OK = 0,
+    PCG_UNKNOWN_PARAMETER = -1,
+    PCG_UNKNOWN_SCENE = -2,
+    PCG_GENERATION_FAILED = -3,
+    PCG_INVALID_ARGUMENT = -4
+};
+
+/* Per pixel layers, values are biome or structure types, 0 where there is none */
+enum PCGLayerKind
+{
+    PCG_LAYER_BIOME = 0,
+    PCG_LAYER_DEFINED_STRUCTURE = 1,
+    PCG_LAYER_GENERATED_STRUCTURE = 2
+};
+
+/* Lists of structures of map */
+enum PCGStructureKind
+{
+    PCG_STRUCTURES_BIOMES = 0,
+    PCG_STRUCTURES_DEFINED = 1,
+    PCG_STRUCTURES_GENERATED = 2,
+    PCG_STRUCTURES_UNDERGROUND = 3
+};
+
+typedef struct PCGLayer
+{
+    const uint32_t* data;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;        /* pixels between rows */
+} PCGLayer;
+
+typedef struct PCGStructure
+{
+    uint32_t type;
+    uint32_t pixel_count;
+    int32_t x, y, w, h;     /* bounding box */
+} PCGStructure;
+
+PCG_EXPORT int pcg_api_version(void);
+
+/* Map of given size relative to 4200x1200, NULL if scale is not positive */
+PCG_EXPORT PCGMap* pcg_map_create(float scale);
+PCG_EXPORT void pcg_map_destroy(PCGMap* map);
+
+PCG_EXPORT void pcg_map_set_seed(PCGMap* map, uint32_t seed);
+PCG_EXPORT int pcg_map_set_parameter(PCGMap* map, const char* name, float value);
+
+/* Generate world, map is reused between runs */
+PCG_EXPORT int pcg_map_run_scene(PCGMap* map, const char* scene);
+PCG_EXPORT const char* pcg_map_last_error(PCGMap* map);
+/* Comma separated parts of world which ran out of budget, empty if none */
+PCG_EXPORT const char* pcg_map_degradations(PCGMap* map);
+
+PCG_EXPORT int pcg_map_layer(PCGMap* map, int layer, PCGLayer* out);
+
+PCG_EXPORT size_t pcg_map_structure_count(PCGMap* map, int kind);
+PCG_EXPORT int pcg_map_structure(PCGMap* map, int kind, size_t index, PCGStructure* out);
+/* Copy up to capacity pixels as x, y pairs into xy, returns number of pixels of structure */
+PCG_EXPORT size_t pcg_map_structure_pixels(PCGMap* map, int kind, size_t index, int32_t* xy, size_t capacity);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PCG_CAPI */
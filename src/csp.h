@@ -5,75 +5,1939 @@
 #include <vector>
 #include <functional>
 #include <stdexcept>
+#include <memory>
+#include <limits>
+#include <cstdlib>
+#include <cstdint>
+#include <type_traits>
+#include <algorithm>
+#include <deque>
+#include <atomic>
+#include <thread>
+
+#ifndef RANDOM
+#include "random.h"
+#endif
+
+#ifndef POOL
+#include "pool.h"
+#endif
+
+/**
+ * Value of variable which is not assigned yet
+ */
+const int CSP_UNASSIGNED = std::numeric_limits<int>::min();
+
+/**
+ * Set of integers from 0 to size - 1 stored as bits of 64 bit words. Operations over ranges work
+ * on whole words masked at ends, counts are popcounts of words
+ */
+class Bitset
+{
+    protected:
+        int _size {0};
+
+        static uint64_t Mask(int from, int to)
+        {
+            auto high = (to % 64 == 63) ? ~0ULL : ((1ULL << (to % 64 + 1)) - 1);
+            return high & (~0ULL << (from % 64));
+        };
+
+    public:
+        std::vector<uint64_t> words;
+
+        Bitset(int size = 0): _size{size}, words((size + 63) / 64, 0) {};
+
+        int size() const { return _size; };
+        bool test(int i) const { return (words[i / 64] >> (i % 64)) & 1; };
+        void set(int i) { words[i / 64] |= 1ULL << (i % 64); };
+        void reset(int i) { words[i / 64] &= ~(1ULL << (i % 64)); };
+
+        int count() const
+        {
+            auto n = 0;
+            for (auto word: words) n += __builtin_popcountll(word);
+            return n;
+        };
+
+        void clear()
+        {
+            std::fill(words.begin(), words.end(), 0);
+        };
+
+        /**
+         * Largest set bit, -1 if there is none
+         */
+        int last() const
+        {
+            for (auto w = (int) words.size() - 1; w >= 0; --w)
+                if (words[w] != 0) return w * 64 + 63 - __builtin_clzll(words[w]);
+            return -1;
+        };
+
+        Bitset& operator|=(const Bitset& other)
+        {
+            for (size_t w = 0; w < words.size() && w < other.words.size(); ++w)
+                words[w] |= other.words[w];
+            return *this;
+        };
+
+        /**
+         * Number of set bits from from to to including both
+         */
+        int count(int from, int to) const
+        {
+            from = std::max(from, 0);
+            to = std::min(to, _size - 1);
+            if (from > to) return 0;
+
+            auto n = 0;
+            for (auto w = from / 64; w <= to / 64; ++w)
+                n += __builtin_popcountll(words[w] & Mask(w == from / 64 ? from : 0, w == to / 64 ? to : 63));
+            return n;
+        };
+
+        /**
+         * Call f with word index and mask of bits from from to to in that word
+         */
+        template <typename F>
+        void for_words(int from, int to, F f) const
+        {
+            from = std::max(from, 0);
+            to = std::min(to, _size - 1);
+            for (auto w = from / 64; from <= to && w <= to / 64; ++w)
+                f(w, Mask(w == from / 64 ? from : 0, w == to / 64 ? to : 63));
+        };
+
+        template <typename F>
+        void for_each(F f) const
+        {
+            for (size_t w = 0; w < words.size(); ++w)
+                for (auto word = words[w]; word != 0; word &= word - 1)
+                    f((int) w * 64 + __builtin_ctzll(word));
+        };
+};
+
+/**
+ * Live values of variable, bit k stands for value base + k * step
+ */
+class BitDomain
+{
+    public:
+        int base {0};
+        int step {1};
+        Bitset bits;
+        int live {0};
+
+        BitDomain() {};
+
+        /**
+         * Domain of given values, step is greatest common divisor of their distances from smallest
+         */
+        BitDomain(const std::vector<int>& values)
+        {
+            if (values.empty())
+                return;
+
+            base = *std::min_element(values.begin(), values.end());
+            step = 0;
+            for (auto value: values)
+            {
+                auto a = (long) value - base;
+                auto b = (long) step;
+                while (b != 0) { auto t = a % b; a = b; b = t; }
+                step = (int) a;
+            }
+            if (step == 0) step = 1;
+
+            auto top = *std::max_element(values.begin(), values.end());
+            bits = Bitset((int) (((long) top - base) / step + 1));
+            for (auto value: values) bits.set(offset(value));
+            live = bits.count();
+        };
+
+        int value(int offset) const { return base + offset * step; };
+        int offset(int value) const { return (int) (((long) value - base) / step); };
+
+        /**
+         * Offsets of values from from to to including both, false if there is no such offset
+         */
+        bool offsets(long from, long to, int& lo, int& hi) const
+        {
+            auto a = from - base;
+            auto b = to - base;
+            lo = (int) std::max(0L, a <= 0 ? 0L : (a + step - 1) / step);
+            hi = (int) std::min((long) bits.size() - 1, b < 0 ? -1L : b / step);
+            return lo <= hi;
+        };
+
+        bool contains(int value) const
+        {
+            if (value < base || ((long) value - base) % step != 0) return false;
+            auto o = offset(value);
+            return o < bits.size() && bits.test(o);
+        };
+
+        /**
+         * Number of live values from from to to including both
+         */
+        int count(long from, long to) const
+        {
+            int lo, hi;
+            return offsets(from, to, lo, hi) ? bits.count(lo, hi) : 0;
+        };
+};
+
+/**
+ * Values from from to to including both
+ */
+struct ValueRange
+{
+    long from;
+    long to;
+};
+
+/**
+ * Constraint over dense variable ids, values are indexed by id
+ */
+class IndexedConstraint
+{
+    public:
+        /**
+         * Final classes of constraints which search checks by static dispatch, other constraints
+         * are checked by virtual calls
+         */
+        enum Kind { GENERIC, DISTANCE, NON_INTERSECTION, NO_OVERLAP };
+
+        std::vector<int> variables;
+        int id {-1};
+        Kind kind {GENERIC};
+
+        /**
+         * Constraint holds between each pair of its variables on its own, so assignment prunes
+         * all its unassigned variables and not only the last one
+         */
+        bool pairwise {false};
+
+        virtual ~IndexedConstraint() {};
+        virtual bool satisfied(const int* values) const = 0;
+
+        /**
+         * Whether just assigned variable keeps constraint satisfied with other assigned ones
+         */
+        virtual bool consistent(int variable, const int* values) const
+        {
+            return satisfied(values);
+        };
+
+        /**
+         * Search reports assignments, so constraint can keep state of assigned variables and
+         * undo it on backtrack
+         */
+        virtual void reset() {};
+        virtual void assign(int variable, int value) {};
+        virtual void unassign(int variable, int value) {};
+
+        /**
+         * Disjoint ranges of values of other variable which conflict with value of variable,
+         * false if constraint can not describe them by ranges and values have to be checked
+         */
+        virtual bool conflicts(int variable, int value, int other, std::vector<ValueRange>& out) const
+        {
+            return false;
+        };
+
+        /**
+         * Whether value of variable is supported by some live value of other variable, values of
+         * both variables are unassigned and it may assign them temporarily. Checks of constraint
+         * of final class are inlined
+         */
+        template <typename C>
+        static bool Supported(const C& constraint, int variable, int value, int other, const BitDomain& domain, int* values, std::vector<ValueRange>& ranges)
+        {
+            ranges.clear();
+            if (constraint.conflicts(variable, value, other, ranges))
+            {
+                auto conflicting = 0;
+                for (auto& range: ranges) conflicting += domain.count(range.from, range.to);
+                return conflicting < domain.live;
+            }
+
+            auto supported = false;
+            values[variable] = value;
+            for (auto j = 0; j < domain.bits.size() && !supported; ++j)
+            {
+                if (!domain.bits.test(j)) continue;
+                values[other] = domain.value(j);
+                supported = constraint.satisfied(values);
+            }
+            values[variable] = CSP_UNASSIGNED;
+            values[other] = CSP_UNASSIGNED;
+            return supported;
+        };
+
+        /**
+         * Offsets of live values of variable without support in domain of other variable of
+         * binary constraint
+         */
+        virtual void unsupported(int variable, const BitDomain& domain, int other, const BitDomain& other_domain, int* values, std::vector<int>& out) const
+        {
+            std::vector<ValueRange> ranges;
+            domain.bits.for_each([&](int i){
+                if (!Supported(*this, variable, domain.value(i), other, other_domain, values, ranges)) out.push_back(i);
+            });
+        };
+};
+
+class IndexedDistanceConstraint final: public IndexedConstraint
+{
+    protected:
+        int v0, v1;
+        int distance;
+
+    public:
+        IndexedDistanceConstraint(int _v0, int _v1, int _distance): v0{_v0}, v1{_v1}, distance{_distance}
+        {
+            this->variables = {v0, v1};
+            this->kind = DISTANCE;
+        };
+
+        virtual bool satisfied(const int* values) const override
+        {
+            if (values[v0] == CSP_UNASSIGNED || values[v1] == CSP_UNASSIGNED)
+                return true;
+            return abs(values[v0] - values[v1]) >= distance;
+        };
+
+        virtual bool consistent(int variable, const int* values) const override
+        {
+            return satisfied(values);
+        };
+
+        /**
+         * Values closer than distance
+         */
+        virtual bool conflicts(int variable, int value, int other, std::vector<ValueRange>& out) const override
+        {
+            if (distance > 0)
+                out.push_back({(long) value - distance + 1, (long) value + distance - 1});
+            return true;
+        };
+};
+
+/**
+ * Rectangles of two variables do not intersect, value encodes position as y * width + x
+ */
+class IndexedNonIntersectionConstraint final: public IndexedConstraint
+{
+    protected:
+        int v0, v1;
+        int w0, h0, w1, h1;
+        int width;
+
+        /**
+         * Union of two intervals, as one interval when they touch
+         */
+        static int Union(long a0, long a1, long b0, long b1, long* out)
+        {
+            if (a0 > b0) { std::swap(a0, b0); std::swap(a1, b1); }
+            if (b0 <= a1 + 1)
+            {
+                out[0] = a0; out[1] = std::max(a1, b1);
+                return 1;
+            }
+            out[0] = a0; out[1] = a1; out[2] = b0; out[3] = b1;
+            return 2;
+        };
+
+    public:
+        IndexedNonIntersectionConstraint(int _v0, int _v1, int _w0, int _h0, int _w1, int _h1, int _width):
+            v0{_v0}, v1{_v1}, w0{_w0}, h0{_h0}, w1{_w1}, h1{_h1}, width{_width}
+        {
+            this->variables = {v0, v1};
+            this->kind = NON_INTERSECTION;
+        };
+
+        virtual bool satisfied(const int* values) const override
+        {
+            if (values[v0] == CSP_UNASSIGNED || values[v1] == CSP_UNASSIGNED)
+                return true;
+
+            auto _x0 = values[v0] % width;
+            auto _y0 = values[v0] / width;
+            auto _x1 = values[v1] % width;
+            auto _y1 = values[v1] / width;
+
+            if ((_x0 <= _x1) && (_x0 + w0) >= (_x1 + w1) && (_y0 <= _y1) && (_y0 + h0) >= (_y1 + h1))
+                return false;
+            if (((_x0 <= _x1) && (_x1 <= _x0 + w0)) && ((_y0 <= _y1) && (_y1 <= _y0 + h0)))
+                return false;
+            if (((_x0 <= _x1 + w1) && (_x1 + w1 <= _x0 + w0)) && ((_y0 <= _y1) && (_y1 <= _y0 + h0)))
+                return false;
+            if (((_x0 <= _x1) && (_x1 <= _x0 + w0)) && ((_y0 <= _y1 + h1) && (_y1 + h1 <= _y0 + h0)))
+                return false;
+            if (((_x0 <= _x1 + w1) && (_x1 + w1 <= _x0 + w0)) && ((_y0 <= _y1 + h1) && (_y1 + h1 <= _y0 + h0)))
+                return false;
+
+            return true;
+        };
+
+        virtual bool consistent(int variable, const int* values) const override
+        {
+            return satisfied(values);
+        };
+
+        /**
+         * Constraint fails when corner of second rectangle lies inside first one, so conflicting
+         * positions are product of unions of corner intervals along each axis, one range per row
+         */
+        virtual bool conflicts(int variable, int value, int other, std::vector<ValueRange>& out) const override
+        {
+            auto x = value % width;
+            auto y = value / width;
+
+            long xs[4], ys[4];
+            int nx, ny;
+            if (variable == v0)
+            {
+                nx = Union(x, x + w0, x - w1, x + w0 - w1, xs);
+                ny = Union(y, y + h0, y - h1, y + h0 - h1, ys);
+            }
+            else
+            {
+                nx = Union(x - w0, x, x + w1 - w0, x + w1, xs);
+                ny = Union(y - h0, y, y + h1 - h0, y + h1, ys);
+            }
+
+            for (auto j = 0; j < ny; ++j)
+            {
+                for (auto row = std::max(0L, ys[2 * j]); row <= ys[2 * j + 1]; ++row)
+                {
+                    for (auto i = 0; i < nx; ++i)
+                    {
+                        auto from = std::max(0L, xs[2 * i]);
+                        auto to = std::min((long) width - 1, xs[2 * i + 1]);
+                        if (from <= to) out.push_back({row * width + from, row * width + to});
+                    }
+                }
+            }
+            return true;
+        };
+
+        /**
+         * Value is supported when some live rectangle of other lies completely beside it, that
+         * is decided from extremes of live positions. Only values surrounded by other rectangles
+         * count their conflicts
+         */
+        virtual void unsupported(int variable, const BitDomain& domain, int other, const BitDomain& other_domain, int* values, std::vector<int>& out) const override
+        {
+            auto w = variable == v0 ? w0 : w1;
+            auto h = variable == v0 ? h0 : h1;
+            auto other_w = variable == v0 ? w1 : w0;
+            auto other_h = variable == v0 ? h1 : h0;
+
+            if (other_domain.live == 0)
+            {
+                domain.bits.for_each([&](int i){ out.push_back(i); });
+                return;
+            }
+
+            auto min_x = std::numeric_limits<int>::max();
+            auto max_x = std::numeric_limits<int>::min();
+            auto min_y = std::numeric_limits<int>::max();
+            auto max_y = std::numeric_limits<int>::min();
+            other_domain.bits.for_each([&](int j){
+                auto v = other_domain.value(j);
+                min_x = std::min(min_x, v % width);
+                max_x = std::max(max_x, v % width);
+                min_y = std::min(min_y, v / width);
+                max_y = std::max(max_y, v / width);
+            });
+
+            std::vector<ValueRange> ranges;
+            domain.bits.for_each([&](int i){
+                auto x = domain.value(i) % width;
+                auto y = domain.value(i) / width;
+                if (max_x > x + w || min_x + other_w < x || max_y > y + h || min_y + other_h < y)
+                    return;
+                if (!Supported(*this, variable, domain.value(i), other, other_domain, values, ranges)) out.push_back(i);
+            });
+        };
+};
+
+/**
+ * Rectangles in buckets of grid whose cells are larger than any rectangle, so rectangles which
+ * overlap given one have their corner in its cell or in one of eight neighbouring cells.
+ * Rectangles span from x to x + w and from y to y + h including both
+ */
+class SpatialHash
+{
+    protected:
+        struct Item
+        {
+            int id;
+            int x, y, w, h;
+        };
+
+        int cell_w, cell_h;
+        std::unordered_map<long long, std::vector<Item>> cells;
+        size_t count {0};
+
+        static int Cell(int v, int size)
+        {
+            return v >= 0 ? v / size : -((-v - 1) / size) - 1;
+        };
+
+        static long long Key(int cx, int cy)
+        {
+            return ((long long) cy << 32) | (uint32_t) cx;
+        };
+
+    public:
+        SpatialHash(int max_w, int max_h): cell_w{std::max(1, max_w + 1)}, cell_h{std::max(1, max_h + 1)} {};
+
+        size_t size() const { return count; };
+
+        void clear()
+        {
+            cells.clear();
+            count = 0;
+        };
+
+        void insert(int id, int x, int y, int w, int h)
+        {
+            cells[Key(Cell(x, cell_w), Cell(y, cell_h))].push_back({id, x, y, w, h});
+            count += 1;
+        };
+
+        void erase(int id, int x, int y)
+        {
+            auto it = cells.find(Key(Cell(x, cell_w), Cell(y, cell_h)));
+            if (it == cells.end())
+                return;
+
+            auto& items = it->second;
+            for (size_t i = 0; i < items.size(); ++i)
+            {
+                if (items[i].id != id) continue;
+                items[i] = items.back();
+                items.pop_back();
+                count -= 1;
+                return;
+            }
+        };
+
+        /**
+         * Whether rectangle overlaps some rectangle with other id
+         */
+        bool overlaps(int id, int x, int y, int w, int h) const
+        {
+            auto cx = Cell(x, cell_w);
+            auto cy = Cell(y, cell_h);
+            for (auto j = cy - 1; j <= cy + 1; ++j)
+            {
+                for (auto i = cx - 1; i <= cx + 1; ++i)
+                {
+                    auto it = cells.find(Key(i, j));
+                    if (it == cells.end()) continue;
+                    for (auto& item: it->second)
+                    {
+                        if (item.id != id && item.x <= x + w && x <= item.x + item.w && item.y <= y + h && y <= item.y + item.h)
+                            return true;
+                    }
+                }
+            }
+            return false;
+        };
+};
+
+/**
+ * Rectangles of all variables do not overlap, value encodes position as y * width + x.
+ * Rectangles of assigned variables are kept in spatial hash, so check of newly assigned variable
+ * does not depend on number of variables and backtracking just removes its rectangle
+ */
+class IndexedNoOverlapConstraint final: public IndexedConstraint
+{
+    protected:
+        // SIZES ARE INDEXED BY VARIABLE ID
+        std::vector<int> w, h;
+        int width;
+        SpatialHash placed;
+
+        static bool Overlap(int x0, int y0, int w0, int h0, int x1, int y1, int w1, int h1)
+        {
+            return x0 <= x1 + w1 && x1 <= x0 + w0 && y0 <= y1 + h1 && y1 <= y0 + h0;
+        };
+
+    public:
+        IndexedNoOverlapConstraint(const std::vector<int>& _variables, const std::vector<int>& _w, const std::vector<int>& _h, int _width):
+            width{_width},
+            placed{_w.empty() ? 0 : *std::max_element(_w.begin(), _w.end()), _h.empty() ? 0 : *std::max_element(_h.begin(), _h.end())}
+        {
+            this->variables = _variables;
+            this->pairwise = true;
+            this->kind = NO_OVERLAP;
+
+            auto size = _variables.empty() ? 0 : *std::max_element(_variables.begin(), _variables.end()) + 1;
+            w.assign(size, 0);
+            h.assign(size, 0);
+            for (size_t i = 0; i < _variables.size(); ++i)
+            {
+                w[_variables[i]] = _w[i];
+                h[_variables[i]] = _h[i];
+            }
+        };
+
+        /**
+         * Checks all pairs of assigned variables, search checks only assigned variable by consistent
+         */
+        virtual bool satisfied(const int* values) const override
+        {
+            for (size_t i = 0; i < variables.size(); ++i)
+            {
+                auto a = variables[i];
+                if (values[a] == CSP_UNASSIGNED) continue;
+                for (size_t j = i + 1; j < variables.size(); ++j)
+                {
+                    auto b = variables[j];
+                    if (values[b] == CSP_UNASSIGNED) continue;
+                    if (Overlap(values[a] % width, values[a] / width, w[a], h[a], values[b] % width, values[b] / width, w[b], h[b]))
+                        return false;
+                }
+            }
+            return true;
+        };
+
+        virtual bool consistent(int variable, const int* values) const override
+        {
+            auto value = values[variable];
+            return !placed.overlaps(variable, value % width, value / width, w[variable], h[variable]);
+        };
+
+        virtual void reset() override
+        {
+            placed.clear();
+        };
+
+        virtual void assign(int variable, int value) override
+        {
+            placed.insert(variable, value % width, value / width, w[variable], h[variable]);
+        };
+
+        virtual void unassign(int variable, int value) override
+        {
+            placed.erase(variable, value % width, value / width);
+        };
+
+        /**
+         * Positions of other whose rectangle overlaps rectangle of variable, one range per row
+         */
+        virtual bool conflicts(int variable, int value, int other, std::vector<ValueRange>& out) const override
+        {
+            long x = value % width;
+            long y = value / width;
+            auto from = std::max(0L, x - w[other]);
+            auto to = std::min((long) width - 1, x + w[variable]);
+            if (from > to)
+                return true;
+
+            for (auto row = std::max(0L, y - h[other]); row <= y + h[variable]; ++row)
+                out.push_back({row * width + from, row * width + to});
+            return true;
+        };
+};
+
+/**
+ * Call f with constraint cast to its final class when search knows its kind, so checks are
+ * inlined into f instead of virtual calls. F takes constraint by generic reference
+ */
+template <typename T, typename C>
+using ConstraintCast = typename std::conditional<std::is_const<C>::value, const T, T>::type;
+
+template <typename C, typename F>
+inline auto Dispatch(C& constraint, F f) -> decltype(f(constraint))
+{
+    switch (constraint.kind)
+    {
+        case IndexedConstraint::DISTANCE:
+            return f(static_cast<ConstraintCast<IndexedDistanceConstraint, C>&>(constraint));
+        case IndexedConstraint::NON_INTERSECTION:
+            return f(static_cast<ConstraintCast<IndexedNonIntersectionConstraint, C>&>(constraint));
+        case IndexedConstraint::NO_OVERLAP:
+            return f(static_cast<ConstraintCast<IndexedNoOverlapConstraint, C>&>(constraint));
+        default:
+            return f(constraint);
+    }
+};
+
+/**
+ * Force stop of search which never stops it
+ */
+struct NeverStop
+{
+    bool operator()() const { return false; };
+};
+
+/**
+ * Solver over dense variable ids with bitset domains and flat assignment.
+ * Search assigns variable with fewest remaining values first, ties go to variable constrained
+ * with most unassigned ones. Assignment prunes values of neighbours it conflicts with, values
+ * are tried in order of how few neighbour values they prune. When all values of variable fail,
+ * search jumps back to latest variable which caused some of the failures, and remembers
+ * assignment of causing variables as nogood which is not tried again
+ */
+class CSPCore
+{
+    public:
+        enum Result { SOLVED, STOPPED, FAILED };
+
+        /**
+         * Order of values before least constraining ones are moved forward
+         */
+        enum ValueOrder { GIVEN, ASCENDING, SHUFFLED };
+
+        struct Stats
+        {
+            unsigned long long nodes {0};
+            unsigned long long backtracks {0};
+            unsigned long long pruned {0};
+            unsigned long long revisions {0};
+            unsigned long long values {0};
+            unsigned long long pruned_before_search {0};
+            unsigned long long restarts {0};
+
+            // BACKJUMPS OVER AT LEAST ONE VARIABLE, VALUES THEY LEFT UNTRIED AND VALUES REJECTED BY
+            // NOGOODS, EACH OF THOSE VALUES IS NODE WHICH SEARCH SAVED
+            unsigned long long backjumps {0};
+            unsigned long long skipped {0};
+            unsigned long long nogoods {0};
+            unsigned long long nogood_hits {0};
+        };
+
+        /**
+         * Values are ordered only when number of values times live values of their neighbours
+         * is below this limit, ordering of wide domains early in search costs more than it helps
+         */
+        const long LCV_LIMIT = 1 << 16;
+
+        /**
+         * Binary constraints are made arc consistent before search, and after every assignment
+         * when consistency is maintained
+         */
+        bool arc_consistency {false};
+        bool maintain_arc_consistency {false};
+
+        /**
+         * Failures are traced to depths of search which caused them, maintained arc consistency
+         * does not trace them and backtracks chronologically
+         */
+        bool backjumping {true};
+
+        /**
+         * Nogoods with at most NOGOOD_SIZE pairs are kept, at most NOGOODS of them, oldest ones
+         * are replaced. Longer nogoods rarely match again
+         */
+        const int NOGOODS = 1 << 12;
+        const int NOGOOD_SIZE = 4;
+
+        /**
+         * Randomized search breaks ties of variable selection by rng, so restarts of search with
+         * same ordering take different paths
+         */
+        ValueOrder value_order {GIVEN};
+        bool randomized {false};
+        Random rng {0};
+
+        // VALUES OF DOMAINS IN ORDER IN WHICH THEY ARE TRIED
+        std::vector<std::vector<int>> domains;
+        std::vector<std::vector<IndexedConstraint*>> constraints;
+        std::vector<std::unique_ptr<IndexedConstraint>> owned;
+        Stats stats;
+
+    protected:
+        struct Frame
+        {
+            int variable;
+            std::vector<int> order;
+            size_t next;
+            size_t mark;
+            bool shuffled;
+        };
+
+        /**
+         * Word of domain before it was pruned
+         */
+        struct Pruning
+        {
+            int variable;
+            int word;
+            uint64_t bits;
+        };
+
+        struct Arc
+        {
+            const IndexedConstraint* constraint;
+            int variable;
+        };
+
+        // LIVE VALUES OF DOMAINS, PRUNINGS ARE UNDONE FROM TRAIL ON BACKTRACK. DOMAINS ARE
+        // CONVERTED TO BITS ON FIRST SEARCH, SO RESTARTS ONLY COPY THEM
+        std::vector<BitDomain> live;
+        std::vector<BitDomain> initial;
+        std::vector<Pruning> trail;
+        std::vector<ValueRange> ranges;
+
+        // NUMBER OF UNASSIGNED VARIABLES OF EACH CONSTRAINT, INDEXED BY CONSTRAINT ID
+        std::vector<int> unassigned;
+
+        // ASSIGNED VARIABLES OF SEARCH WHICH CAN BE RESUMED AFTER STOP, FREE IS NUMBER OF
+        // VARIABLES WHICH SEARCH ASSIGNS
+        std::vector<Frame> stack;
+        int depth {-1};
+        int free {0};
+
+        // DEPTH OF ASSIGNED VARIABLES, DEPTHS WHICH PRUNED EACH VARIABLE IN ORDER AND DEPTHS WHICH
+        // CAUSED FAILED VALUES OF EACH FRAME, -1 IS DEPTH OF GIVEN ASSIGNMENT. PRUNING BY CONSTRAINT
+        // OVER MORE VARIABLES IS CAUSED BY ALL OF THEM, IT IS STORED AS ~DEPTH AND BLAMES ALL DEPTHS
+        // UP TO DEPTH
+        std::vector<int> level;
+        std::vector<std::vector<int>> pruned_by;
+        std::vector<Bitset> conflict;
+        bool prefix {false};
+
+        // FAILED ASSIGNMENTS AS PAIRS OF VARIABLE AND VALUE, WATCHES LIST NOGOODS OF EACH PAIR.
+        // THEY STAY VALID OVER RESTARTS FROM SAME GIVEN ASSIGNMENT
+        std::vector<std::vector<std::pair<int, int>>> nogoods;
+        std::unordered_map<long long, std::vector<int>> watches;
+        size_t oldest {0};
+        std::vector<int> given;
+
+        // ARCS WAITING FOR REVISION, QUEUED IS INDEXED BY CONSTRAINT ID AND POSITION OF VARIABLE
+        std::deque<Arc> arcs;
+        std::vector<char> queued;
+        std::vector<int> removed;
+
+        /**
+         * Clear bits of mask in word of domain of variable
+         */
+        void prune_word(int variable, int word, uint64_t mask)
+        {
+            auto& domain = live[variable];
+            auto bits = domain.bits.words[word];
+            auto cleared = __builtin_popcountll(bits & mask);
+            if (cleared == 0)
+                return;
+
+            trail.push_back({variable, word, bits});
+            domain.bits.words[word] = bits & ~mask;
+            domain.live -= cleared;
+            stats.pruned += cleared;
+
+            auto cause = prefix ? ~depth : depth;
+            auto& by = pruned_by[variable];
+            if (depth >= 0 && (by.empty() || by.back() != cause)) by.push_back(cause);
+        };
+
+        void prune(int variable, int offset)
+        {
+            prune_word(variable, offset / 64, 1ULL << (offset % 64));
+        };
+
+        /**
+         * Prune all values of domain of variable from from to to including both
+         */
+        void prune_values(int variable, long from, long to)
+        {
+            int lo, hi;
+            if (!live[variable].offsets(from, to, lo, hi))
+                return;
+            live[variable].bits.for_words(lo, hi, [&](int word, uint64_t mask){ prune_word(variable, word, mask); });
+        };
+
+        /**
+         * Undo prunings after mark, which are prunings of current depth and deeper ones
+         */
+        void restore(size_t mark)
+        {
+            while (trail.size() > mark)
+            {
+                auto& pruning = trail.back();
+                auto& domain = live[pruning.variable];
+                auto& word = domain.bits.words[pruning.word];
+                domain.live += __builtin_popcountll(pruning.bits) - __builtin_popcountll(word);
+                word = pruning.bits;
+
+                auto& by = pruned_by[pruning.variable];
+                while (!by.empty() && (by.back() < 0 ? ~by.back() : by.back()) >= depth) by.pop_back();
+                trail.pop_back();
+            }
+        };
+
+        /**
+         * Failure of current value is caused by assignment of variable, or by depths which pruned it
+         */
+        void blame(int variable)
+        {
+            if (depth >= 0 && level[variable] >= 0 && level[variable] < depth)
+                conflict[depth].set(level[variable]);
+        };
+
+        void blame_pruners(int variable)
+        {
+            if (depth < 0)
+                return;
+            for (auto by: pruned_by[variable])
+            {
+                if (by >= 0 && by < depth) conflict[depth].set(by);
+                for (auto d = 0; by < 0 && d <= ~by && d < depth; ++d) conflict[depth].set(d);
+            }
+        };
+
+        /**
+         * Failure which is not traced is caused by all previous depths
+         */
+        void blame_all()
+        {
+            for (auto d = 0; d < depth; ++d)
+                conflict[depth].set(d);
+        };
+
+        static long long Key(int variable, int value)
+        {
+            return ((long long) variable << 32) | (uint32_t) value;
+        };
+
+        /**
+         * Whether value of variable completes some nogood, its other variables are blamed then
+         */
+        bool nogood(int variable, const std::vector<int>& values)
+        {
+            auto it = watches.find(Key(variable, values[variable]));
+            if (it == watches.end())
+                return false;
+
+            for (auto id: it->second)
+            {
+                auto& pairs = nogoods[id];
+                auto all = true;
+                for (auto& pair: pairs)
+                    all = all && values[pair.first] == pair.second;
+                if (!all) continue;
+
+                for (auto& pair: pairs)
+                    if (pair.first != variable) blame(pair.first);
+                stats.nogood_hits += 1;
+                return true;
+            }
+            return false;
+        };
+
+        /**
+         * Remember that assignment of variables at depths of conflict of current frame has no
+         * extension to variable of frame
+         */
+        void record_nogood(const std::vector<int>& values)
+        {
+            auto& depths = conflict[depth];
+            if (depths.count() > NOGOOD_SIZE)
+                return;
+
+            std::vector<std::pair<int, int>> pairs;
+            depths.for_each([&](int d){ pairs.push_back({stack[d].variable, values[stack[d].variable]}); });
+            if (pairs.empty())
+                return;
+
+            // OLDEST NOGOOD IS REPLACED WHEN STORE IS FULL
+            int id = (int) nogoods.size();
+            if (id < NOGOODS)
+                nogoods.emplace_back();
+            else
+            {
+                id = (int) (oldest++ % NOGOODS);
+                for (auto& pair: nogoods[id])
+                {
+                    auto& ids = watches[Key(pair.first, pair.second)];
+                    ids.erase(std::find(ids.begin(), ids.end(), id));
+                }
+            }
+
+            for (auto& pair: pairs) watches[Key(pair.first, pair.second)].push_back(id);
+            nogoods[id] = std::move(pairs);
+            stats.nogoods += 1;
+        };
+
+        /**
+         * Only unassigned variable of constraint other than given one, -1 if there is none or more
+         */
+        int only_unassigned(const IndexedConstraint& constraint, int variable, const std::vector<int>& values) const
+        {
+            auto other = -1;
+            for (auto v: constraint.variables)
+            {
+                if (v == variable || values[v] != CSP_UNASSIGNED) continue;
+                if (other >= 0 && other != v) return -1;
+                other = v;
+            }
+            return other;
+        };
+
+        /**
+         * Call f for unassigned variables of constraint which value of variable restricts, which
+         * are all of them for pairwise constraint, stops when f returns false
+         */
+        template <typename F>
+        bool for_neighbours(const IndexedConstraint& constraint, int variable, const std::vector<int>& values, F f) const
+        {
+            if (!constraint.pairwise)
+            {
+                auto other = only_unassigned(constraint, variable, values);
+                return other < 0 || f(other);
+            }
+
+            for (auto other: constraint.variables)
+                if (other != variable && values[other] == CSP_UNASSIGNED && !f(other)) return false;
+            return true;
+        };
+
+        /**
+         * Assignment is reported to constraints of variable, unassignment undoes it
+         */
+        void assign(int variable, int value, std::vector<int>& values)
+        {
+            values[variable] = value;
+            level[variable] = depth;
+            for (auto* constraint: constraints[variable])
+            {
+                Dispatch(*constraint, [&](auto& c){ c.assign(variable, value); });
+                unassigned[constraint->id] -= 1;
+            }
+        };
+
+        void unassign(int variable, std::vector<int>& values)
+        {
+            if (values[variable] == CSP_UNASSIGNED)
+                return;
+
+            for (auto* constraint: constraints[variable])
+            {
+                Dispatch(*constraint, [&](auto& c){ c.unassign(variable, values[variable]); });
+                unassigned[constraint->id] += 1;
+            }
+            values[variable] = CSP_UNASSIGNED;
+        };
+
+        /**
+         * Prune values of neighbours which conflict with value of variable, false on wipeout
+         */
+        bool forward_check(int variable, std::vector<int>& values)
+        {
+            // VALUE IS REJECTED BY CHEAP CHECKS BEFORE ANY NEIGHBOUR IS PRUNED
+            for (auto* constraint: constraints[variable])
+            {
+                if (Dispatch(*constraint, [&](const auto& c){ return c.consistent(variable, values.data()); }))
+                    continue;
+                for (auto other: constraint->variables)
+                    if (other != variable && values[other] != CSP_UNASSIGNED) blame(other);
+                return false;
+            }
+
+            if (!nogoods.empty() && nogood(variable, values))
+                return false;
+
+            for (auto* constraint: constraints[variable])
+            {
+                prefix = !constraint->pairwise && constraint->variables.size() > 2;
+                auto ok = Dispatch(*constraint, [&](const auto& c){
+                    return for_neighbours(c, variable, values, [&](int other){
+                        ranges.clear();
+                        if (c.conflicts(variable, values[variable], other, ranges))
+                        {
+                            for (auto& range: ranges) prune_values(other, range.from, range.to);
+                        }
+                        else
+                        {
+                            auto& domain = live[other];
+                            domain.bits.for_each([&](int i){
+                                values[other] = domain.value(i);
+                                if (!c.satisfied(values.data())) prune(other, i);
+                            });
+                            values[other] = CSP_UNASSIGNED;
+                        }
+
+                        // WIPEOUT IS CAUSED BY ALL DEPTHS WHICH PRUNED NEIGHBOUR
+                        if (live[other].live > 0) return true;
+                        blame_pruners(other);
+                        return false;
+                    });
+                });
+                prefix = false;
+                if (!ok) return false;
+            }
+            return true;
+        };
+
+        /**
+         * Number of live values of other which conflict with value of variable
+         */
+        template <typename C>
+        int count_conflicts(const C& constraint, int variable, int other, std::vector<int>& values)
+        {
+            ranges.clear();
+            auto& domain = live[other];
+            auto n = 0;
+            if (constraint.conflicts(variable, values[variable], other, ranges))
+            {
+                for (auto& range: ranges) n += domain.count(range.from, range.to);
+                return n;
+            }
+
+            domain.bits.for_each([&](int j){
+                values[other] = domain.value(j);
+                if (!constraint.satisfied(values.data())) n += 1;
+            });
+            values[other] = CSP_UNASSIGNED;
+            return n;
+        };
+
+        void enqueue(const IndexedConstraint* constraint, int variable)
+        {
+            auto key = 2 * constraint->id + (constraint->variables[0] == variable ? 0 : 1);
+            if (queued[key]) return;
+            queued[key] = 1;
+            arcs.push_back({constraint, variable});
+        };
+
+        /**
+         * Queue arcs of unassigned variables towards variable whose domain shrank
+         */
+        void enqueue_neighbours(int variable, const IndexedConstraint* except, const std::vector<int>& values)
+        {
+            for (auto* constraint: constraints[variable])
+            {
+                if (constraint == except || constraint->variables.size() != 2) continue;
+                auto other = constraint->variables[0] == variable ? constraint->variables[1] : constraint->variables[0];
+                if (values[other] == CSP_UNASSIGNED) enqueue(constraint, other);
+            }
+        };
+
+        /**
+         * Revise queued arcs until domains are arc consistent, false on wipeout
+         */
+        bool propagate(std::vector<int>& values)
+        {
+            while (!arcs.empty())
+            {
+                auto arc = arcs.front();
+                arcs.pop_front();
+                auto& variables = arc.constraint->variables;
+                queued[2 * arc.constraint->id + (variables[0] == arc.variable ? 0 : 1)] = 0;
+
+                auto other = variables[0] == arc.variable ? variables[1] : variables[0];
+                if (values[arc.variable] != CSP_UNASSIGNED || values[other] != CSP_UNASSIGNED)
+                    continue;
+
+                removed.clear();
+                arc.constraint->unsupported(arc.variable, live[arc.variable], other, live[other], values.data(), removed);
+                stats.revisions += 1;
+                if (removed.empty())
+                    continue;
+
+                for (auto i: removed) prune(arc.variable, i);
+                if (live[arc.variable].live == 0)
+                {
+                    for (auto& rest: arcs) queued[2 * rest.constraint->id + (rest.constraint->variables[0] == rest.variable ? 0 : 1)] = 0;
+                    arcs.clear();
+                    return false;
+                }
+                enqueue_neighbours(arc.variable, arc.constraint, values);
+            }
+            return true;
+        };
+
+        /**
+         * Unassigned variable with fewest live values, then with most unassigned neighbours
+         */
+        int select(const std::vector<int>& values)
+        {
+            auto best = -1;
+            auto best_degree = -1;
+            auto ties = 1;
+            for (auto v = 0; v < size(); ++v)
+            {
+                if (values[v] != CSP_UNASSIGNED) continue;
+                if (best >= 0 && live[v].live > live[best].live) continue;
+
+                auto degree = 0;
+                for (auto* constraint: constraints[v])
+                {
+                    if (constraint->pairwise) degree += unassigned[constraint->id] - 1;
+                    else if (only_unassigned(*constraint, v, values) >= 0) degree += 1;
+                }
+
+                if (best < 0 || live[v].live < live[best].live || degree > best_degree)
+                {
+                    best = v;
+                    best_degree = degree;
+                    ties = 1;
+                }
+                else if (randomized && degree == best_degree && rng() % ++ties == 0)
+                    best = v;
+            }
+            return best;
+        };
+
+        /**
+         * Offsets of live values of variable, least constraining first when counting is cheap enough.
+         * Constraints describing conflicts by ranges are counted by popcount of ranges. True when
+         * values are to be shuffled, then they are drawn at random as they are tried
+         */
+        bool order(int variable, std::vector<int>& values, std::vector<int>& order)
+        {
+            order.clear();
+            auto& domain = live[variable];
+            if (value_order == ASCENDING)
+                domain.bits.for_each([&](int i){ order.push_back(i); });
+            else
+            {
+                for (auto value: domains[variable])
+                    if (domain.bits.test(domain.offset(value))) order.push_back(domain.offset(value));
+            }
+
+            long cost = 0;
+            for (auto* constraint: constraints[variable])
+                for_neighbours(*constraint, variable, values, [&](int other){ cost += live[other].live; return true; });
+            if (order.size() < 2 || cost * (long) order.size() > LCV_LIMIT)
+                return value_order == SHUFFLED;
+
+            // VALUES ARE SHUFFLED BEFORE ORDERING SO TIES OF LEAST CONSTRAINING ONES ARE RANDOM
+            if (value_order == SHUFFLED)
+                for (auto i = (int) order.size() - 1; i > 0; --i) std::swap(order[i], order[rng() % (i + 1)]);
+
+            std::vector<int> conflicts(domain.bits.size(), 0);
+            for (auto i: order)
+            {
+                values[variable] = domain.value(i);
+                for (auto* constraint: constraints[variable])
+                {
+                    Dispatch(*constraint, [&](const auto& c){
+                        for_neighbours(c, variable, values, [&](int other){
+                            conflicts[i] += count_conflicts(c, variable, other, values);
+                            return true;
+                        });
+                    });
+                }
+            }
+            values[variable] = CSP_UNASSIGNED;
+
+            std::stable_sort(order.begin(), order.end(), [&](int a, int b){ return conflicts[a] < conflicts[b]; });
+            return false;
+        };
+
+    public:
+        int size() const { return (int) domains.size(); };
+
+        int add_variable(std::vector<int> domain)
+        {
+            domains.push_back(std::move(domain));
+            constraints.emplace_back();
+            return size() - 1;
+        };
+
+        void add_constraint(std::unique_ptr<IndexedConstraint> constraint)
+        {
+            for (auto variable: constraint->variables)
+                if (variable < 0 || variable >= size())
+                    throw std::domain_error("variable not in CSP.");
+
+            for (auto variable: constraint->variables)
+                constraints[variable].push_back(constraint.get());
+            constraint->id = (int) owned.size();
+            owned.push_back(std::move(constraint));
+        };
+
+        bool consistent(int variable, const std::vector<int>& values) const
+        {
+            for (auto* constraint: constraints[variable])
+                if (!Dispatch(*constraint, [&](const auto& c){ return c.consistent(variable, values.data()); }))
+                    return false;
+            return true;
+        };
+
+        /**
+         * Element of Luby sequence 1, 1, 2, 1, 1, 2, 4, ... for i from 1, restart after this many
+         * units of work is within logarithmic factor of best fixed restart length
+         */
+        static long Luby(long i)
+        {
+            auto k = 1;
+            while ((1L << k) - 1 < i) k += 1;
+            if (i == (1L << k) - 1) return 1L << (k - 1);
+            return Luby(i - (1L << (k - 1)) + 1);
+        };
+
+        /**
+         * Assign values in place, on stop values hold consistent partial assignment. Force stop
+         * is called for each value tried, so it is template parameter and inlined
+         */
+        template <typename F>
+        Result search(std::vector<int>& values, F force_stop)
+        {
+            auto result = STOPPED;
+            if (!start(values, result))
+                return result;
+            return resume(values, force_stop);
+        };
+
+        /**
+         * Prepare search from given assignment, false when result is known without search
+         */
+        bool start(std::vector<int>& values, Result& result)
+        {
+            result = FAILED;
+            depth = -1;
+            trail.clear();
+            for (auto v = (int) initial.size(); v < size(); ++v)
+                initial.emplace_back(domains[v]);
+
+            level.assign(size(), -1);
+            pruned_by.resize(size());
+            for (auto& by: pruned_by) by.clear();
+
+            // NOGOODS ARE VALID ONLY UNDER ASSIGNMENT THEY WERE FOUND WITH
+            if (values != given)
+            {
+                nogoods.clear();
+                watches.clear();
+                oldest = 0;
+                given = values;
+            }
+
+            live = initial;
+            for (auto v = 0; v < size(); ++v)
+                if (live[v].live == 0 && values[v] == CSP_UNASSIGNED) return false;
+
+            unassigned.resize(owned.size());
+            for (auto& constraint: owned)
+            {
+                constraint->reset();
+                unassigned[constraint->id] = (int) constraint->variables.size();
+            }
+
+            // VALUES CONFLICTING WITH GIVEN ASSIGNMENT ARE PRUNED BEFORE SEARCH, UNARY
+            // CONSTRAINTS ARE CHECKED ONLY FOR VALUES WHICH ARE TRIED
+            free = 0;
+            for (auto v = 0; v < size(); ++v)
+            {
+                if (values[v] == CSP_UNASSIGNED)
+                {
+                    free += 1;
+                    continue;
+                }
+                auto value = values[v];
+                values[v] = CSP_UNASSIGNED;
+                assign(v, value, values);
+                if (!forward_check(v, values)) return false;
+            }
+
+            result = SOLVED;
+            if (free == 0)
+                return false;
+            result = FAILED;
+
+            queued.assign(2 * owned.size(), 0);
+            arcs.clear();
+            for (auto v = 0; v < size(); ++v)
+                stats.values += live[v].live;
+
+            if (arc_consistency)
+            {
+                for (auto& constraint: owned)
+                {
+                    if (constraint->variables.size() != 2) continue;
+                    enqueue(constraint.get(), constraint->variables[0]);
+                    enqueue(constraint.get(), constraint->variables[1]);
+                }
+                auto consistent = propagate(values);
+                stats.pruned_before_search = stats.pruned;
+                if (!consistent) return false;
+            }
+
+            // FRAMES ARE KEPT BETWEEN VISITS SO THEIR ORDERS KEEP ALLOCATED MEMORY
+            if ((int) stack.size() < free)
+                stack.resize(free);
+            if ((int) conflict.size() < free)
+                conflict.resize(free, Bitset(free));
+            for (auto& depths: conflict)
+                if (depths.size() < free) depths = Bitset(free);
+            depth = 0;
+            conflict[0].clear();
+            stack[0].variable = select(values);
+            stack[0].shuffled = order(stack[0].variable, values, stack[0].order);
+            stack[0].next = 0;
+            stack[0].mark = trail.size();
+            result = STOPPED;
+            return true;
+        };
+
+        /**
+         * Continue started or stopped search with same values.
+         * Search keeps stack of assigned variables with values left to try and trail position
+         * of their prunings, backtracking only unassigns top of stack and undoes its prunings
+         */
+        template <typename F>
+        Result resume(std::vector<int>& values, F force_stop)
+        {
+            while (depth >= 0)
+            {
+                auto& frame = stack[depth];
+                unassign(frame.variable, values);
+                restore(frame.mark);
+
+                if (frame.next == frame.order.size())
+                {
+                    stats.backtracks += 1;
+                    if (!backjumping || maintain_arc_consistency)
+                    {
+                        depth -= 1;
+                        continue;
+                    }
+
+                    // VALUES PRUNED BEFORE VARIABLE WAS REACHED FAILED BECAUSE OF DEPTHS WHICH PRUNED THEM
+                    blame_pruners(frame.variable);
+                    record_nogood(values);
+
+                    // SEARCH JUMPS TO LATEST DEPTH WHICH CAUSED SOME FAILURE, WHICH TAKES OVER CAUSES
+                    auto target = conflict[depth].last();
+                    if (target >= 0)
+                    {
+                        conflict[target] |= conflict[depth];
+                        conflict[target].reset(target);
+                    }
+                    if (target < depth - 1)
+                        stats.backjumps += 1;
+                    for (auto d = depth - 1; d > target; --d)
+                    {
+                        stats.skipped += stack[d].order.size() - stack[d].next;
+                        unassign(stack[d].variable, values);
+                    }
+                    depth = target;
+                    if (depth < 0)
+                        restore(stack[0].mark);
+                    continue;
+                }
+
+                if (force_stop()) return STOPPED;
+
+                if (frame.shuffled)
+                    std::swap(frame.order[frame.next], frame.order[frame.next + rng() % (frame.order.size() - frame.next)]);
+                assign(frame.variable, live[frame.variable].value(frame.order[frame.next++]), values);
+                stats.nodes += 1;
+                if (!forward_check(frame.variable, values))
+                    continue;
+
+                // VARIABLES PRUNED BY ASSIGNMENT PROPAGATE TO THEIR NEIGHBOURS
+                if (maintain_arc_consistency)
+                {
+                    for (auto t = frame.mark; t < trail.size(); ++t)
+                        if (t == frame.mark || trail[t].variable != trail[t - 1].variable)
+                            enqueue_neighbours(trail[t].variable, nullptr, values);
+                    if (!propagate(values))
+                    {
+                        blame_all();
+                        continue;
+                    }
+                }
+
+                if (depth + 1 == free)
+                    return SOLVED;
+
+                auto& next = stack[++depth];
+                conflict[depth].clear();
+                next.variable = select(values);
+                next.shuffled = order(next.variable, values, next.order);
+                next.next = 0;
+                next.mark = trail.size();
+            }
+
+            return FAILED;
+        };
+};
+
+template <typename V, typename D>
+class Constraint;
+
+/**
+ * Constraint which has no indexed form, checked on assignment rebuilt from values
+ */
+template <typename V, typename D>
+class BoundConstraint: public IndexedConstraint
+{
+    protected:
+        const Constraint<V, D>& constraint;
+        const std::vector<V>& names;
+
+    public:
+        BoundConstraint(const Constraint<V, D>& _constraint, const std::unordered_map<V, int>& ids, const std::vector<V>& _names):
+            constraint{_constraint}, names{_names}
+        {
+            for (auto& variable: constraint.variables)
+                this->variables.push_back(ids.at(variable));
+        };
+
+        virtual bool satisfied(const int* values) const override
+        {
+            std::unordered_map<V, D> assignment;
+            for (auto id = 0; id < (int) names.size(); ++id)
+                if (values[id] != CSP_UNASSIGNED) assignment[names[id]] = (D) values[id];
+            return constraint.satisfied(assignment);
+        };
+};
 
 template <typename V, typename D>
 class Constraint 
 {
     public:
         std::unordered_set<V> variables;
+        virtual ~Constraint() {};
         virtual bool satisfied(const std::unordered_map<V, D>& assignment) const = 0;
+
+        /**
+         * Indexed form of constraint for variable ids of solver
+         */
+        virtual std::unique_ptr<IndexedConstraint> bind(const std::unordered_map<V, int>& ids, const std::vector<V>& names) const
+        {
+            return std::unique_ptr<IndexedConstraint>(new BoundConstraint<V, D>(*this, ids, names));
+        };
 };
 
+/**
+ * Construction by named variables over integer core, variables get ids in order of given set
+ */
 template <typename V, typename D>
 class CSPSolver {
 
+    protected:
+        // CONSTRAINTS ARE BOUND AGAIN FOR EACH WORKER OF PORTFOLIO, AS THEY MAY KEEP STATE OF SEARCH
+        std::vector<const Constraint<V, D>*> added;
+
+        /**
+         * Assignment of assigned values by names of variables
+         */
+        std::unordered_map<V, D> named(const std::vector<int>& values) const
+        {
+            std::unordered_map<V, D> result;
+            for (auto id = 0; id < (int) names.size(); ++id)
+                if (values[id] != CSP_UNASSIGNED) result[names[id]] = (D) values[id];
+            return result;
+        };
+
     public:
-        std::unordered_set<V> variables;
-        std::unordered_map<V, std::unordered_set<D>> domains;
-        std::unordered_map<V, std::vector<std::reference_wrapper<Constraint<V, D>>>> constraints;
+        std::vector<V> names;
+        std::unordered_map<V, int> ids;
+        CSPCore core;
+
+        /**
+         * Workers of portfolio search, their number does not depend on number of threads so
+         * result of portfolio does not either
+         */
+        const int PORTFOLIO_WORKERS = 4;
+
+        /**
+         * Work of worker counts pruned values and nodes, which cost about as many prunings each,
+         * so rounds of workers which prune a lot and which reject a lot take similar time.
+         * Work of rounds grows by Luby sequence
+         */
+        const long NODE_WORK = 32;
+        const long ROUND_WORK = 1 << 14;
 
         CSPSolver(std::unordered_set<V>& _variables, std::unordered_map<V, std::unordered_set<D>>& _domains)
         {
-            variables = _variables;
-            domains = _domains;
+            static_assert(std::is_integral<D>::value, "values of CSP have to be integral");
+            for (auto& variable: _variables)
+            {
+                ids[variable] = (int) names.size();
+                names.push_back(variable);
+                auto& domain = _domains[variable];
+                core.add_variable(std::vector<int>(domain.begin(), domain.end()));
+            }
         };
 
         void add_constraint(Constraint<V, D>& constraint) 
         {
             for (auto& variable: constraint.variables)
-                if (variables.find(variable) != variables.end())
-                    constraints[variable].push_back(constraint);
-                else
+                if (ids.find(variable) == ids.end())
                     throw std::domain_error("variable not in CSP.");
+            core.add_constraint(constraint.bind(ids, names));
+            added.push_back(&constraint);
         };
 
-        bool consistent(V& variable, std::unordered_map<V, D>& assignment)
-        {
-            for (auto& constraint: constraints[variable])
-                if (!constraint.get().satisfied(assignment))
-                    return false;
-            return true; 
+        template <typename F = NeverStop>
+        std::unordered_map<V, D> backtracking_search(
+                std::unordered_map<V, D> assignment = {}, 
+                F force_stop = NeverStop()
+        ){
+            std::vector<int> values(names.size(), CSP_UNASSIGNED);
+            for (auto& pair: assignment)
+                values[ids.at(pair.first)] = (int) pair.second;
+
+            // STOPPED SEARCH RETURNS PARTIAL ASSIGNMENT
+            if (core.search(values, force_stop) == CSPCore::FAILED)
+                return {};
+            return named(values);
         };
 
-        std::unordered_map<V, D> backtracking_search(
-                std::unordered_map<V, D> assignment, 
-                std::function<bool(void)> force_stop = [](){ return false; }
+        /**
+         * Search by several workers with different orderings at once, first worker is search of
+         * backtracking_search and others order values differently, some of them restart randomized
+         * search after each round.
+         * Workers run in rounds limited by work, lowest worker which solves or disproves problem
+         * in earliest round wins, so result depends on rng and not on timing of threads.
+         * Worker which can not win anymore is cancelled by shared flag. Force stop is polled only
+         * by calling thread, on stop largest partial assignment of workers is returned
+         */
+        template <typename F = NeverStop>
+        std::unordered_map<V, D> portfolio_search(
+                std::unordered_map<V, D> assignment = {},
+                F force_stop = NeverStop(),
+                Random rng = Random {0}
         ){
-           if (assignment.size() == variables.size())
-               return assignment;
+            std::vector<int> initial(names.size(), CSP_UNASSIGNED);
+            for (auto& pair: assignment)
+                initial[ids.at(pair.first)] = (int) pair.second;
+
+            struct Worker
+            {
+                CSPCore core;
+                std::vector<int> values;
+                CSPCore::Result result {CSPCore::STOPPED};
+                bool restarts {false};
+            };
+
+            // WORKERS DIFFER IN ORDER OF VALUES, ALL BUT FIRST BREAK TIES RANDOMLY AND FROM FOURTH ON
+            // THEY RESTART, AS RESTART OF SEARCH WITH VALUES IN FIXED ORDER TAKES SIMILAR PATH
+            const CSPCore::ValueOrder orders[] = {CSPCore::GIVEN, CSPCore::ASCENDING, CSPCore::SHUFFLED};
+            std::vector<Worker> workers(PORTFOLIO_WORKERS);
+            for (auto k = 0; k < PORTFOLIO_WORKERS; ++k)
+            {
+                auto& worker = workers[k].core;
+                for (auto& domain: core.domains) worker.add_variable(domain);
+                for (auto* constraint: added) worker.add_constraint(constraint->bind(ids, names));
+                worker.arc_consistency = core.arc_consistency;
+                worker.maintain_arc_consistency = core.maintain_arc_consistency;
+                worker.value_order = k < 3 ? orders[k] : CSPCore::SHUFFLED;
+                worker.randomized = k > 0;
+                worker.rng = rng.Stream(k);
+                workers[k].restarts = k >= 3;
+            }
+
+            auto caller = std::this_thread::get_id();
+            std::atomic<bool> stopped {false};
+            std::atomic<int> winner {PORTFOLIO_WORKERS};
+            for (long round = 1; winner == PORTFOLIO_WORKERS && !stopped; ++round)
+            {
+                auto limit = ROUND_WORK * CSPCore::Luby(round);
+                SharedThreadPool().ParallelFor(PORTFOLIO_WORKERS, [&](int k)
+                {
+                    auto& worker = workers[k];
+                    auto running = true;
+                    if (round == 1 || worker.restarts)
+                    {
+                        if (round > 1) worker.core.stats.restarts += 1;
+                        worker.values = initial;
+                        running = worker.core.start(worker.values, worker.result);
+                    }
+
+                    auto& stats = worker.core.stats;
+                    auto work = (long) (stats.nodes * NODE_WORK + stats.pruned) + limit;
+                    if (running)
+                    {
+                        worker.result = worker.core.resume(worker.values, [&](){
+                            if (std::this_thread::get_id() == caller && force_stop()) stopped = true;
+                            return stopped || winner < k || (long) (stats.nodes * NODE_WORK + stats.pruned) >= work;
+                        });
+                    }
+                    if (worker.result == CSPCore::STOPPED)
+                        return;
+
+                    auto current = winner.load();
+                    while (k < current && !winner.compare_exchange_weak(current, k));
+                });
+
+                if (winner == PORTFOLIO_WORKERS && force_stop())
+                    stopped = true;
+            }
+
+            for (auto& worker: workers)
+            {
+                core.stats.nodes += worker.core.stats.nodes;
+                core.stats.backtracks += worker.core.stats.backtracks;
+                core.stats.pruned += worker.core.stats.pruned;
+                core.stats.revisions += worker.core.stats.revisions;
+                core.stats.restarts += worker.core.stats.restarts;
+                core.stats.backjumps += worker.core.stats.backjumps;
+                core.stats.skipped += worker.core.stats.skipped;
+                core.stats.nogoods += worker.core.stats.nogoods;
+                core.stats.nogood_hits += worker.core.stats.nogood_hits;
+            }
+
+            if (winner < PORTFOLIO_WORKERS)
+            {
+                auto& worker = workers[winner];
+                if (worker.result == CSPCore::FAILED)
+                    return {};
+                return named(worker.values);
+            }
+
+            // STOPPED PORTFOLIO RETURNS LARGEST PARTIAL ASSIGNMENT
+            auto best = 0;
+            std::vector<int> placed(PORTFOLIO_WORKERS, 0);
+            for (auto k = 0; k < PORTFOLIO_WORKERS; ++k)
+            {
+                for (auto value: workers[k].values) placed[k] += value != CSP_UNASSIGNED;
+                if (placed[k] > placed[best]) best = k;
+            }
+            return named(workers[best].values);
+        };
+};
+
+/**
+ * Placement of items on grid of positions from, from + step, ... below to, where some pairs of
+ * items keep minimum distance. Items are placed one by one at leftmost position their placed
+ * neighbours allow, which is optimal for given order of placement, so random orders sample
+ * arrangements quickly. Distances are rounded up to step because positions differ by steps
+ */
+class SpacingSolver
+{
+    public:
+        enum Result { PLACED, INFEASIBLE, UNKNOWN };
+
+    protected:
+        int from, to, step;
+        int last;
+        std::vector<std::vector<std::pair<int, int>>> neighbours;
 
-            std::vector<V> unassigned;
-            for (auto& variable: variables)
-                if (assignment.find(variable) == assignment.end())
-                    unassigned.push_back(variable);
+        int rounded(int distance) const
+        {
+            return distance <= 0 ? 0 : ((distance + step - 1) / step) * step;
+        };
+
+        int distance(int i, int j) const
+        {
+            for (auto& n: neighbours[i])
+                if (n.first == j) return n.second;
+            return -1;
+        };
+
+        /**
+         * Lower bound of span of items which all keep distances from each other. Consecutive items
+         * of any order form path through them, which is not shorter than minimum spanning tree and
+         * in which every item but two ends has its two shortest distances at least
+         */
+        long clique_span(const std::vector<int>& clique) const
+        {
+            if (clique.size() < 2)
+                return 0;
+
+            // MINIMUM SPANNING TREE
+            std::vector<long> best(clique.size(), std::numeric_limits<long>::max());
+            std::vector<char> in_tree(clique.size(), 0);
+            long tree = 0;
+            best[0] = 0;
+            for (auto next = 0; next >= 0; )
+            {
+                in_tree[next] = 1;
+                tree += best[next];
+                auto added = next;
+                next = -1;
+                for (auto i = 0; i < (int) clique.size(); ++i)
+                {
+                    if (in_tree[i]) continue;
+                    best[i] = std::min(best[i], (long) distance(clique[added], clique[i]));
+                    if (next < 0 || best[i] < best[next]) next = i;
+                }
+            }
+
+            // TWO SHORTEST DISTANCES OF EVERY ITEM, ENDS SAVE THEIR SECOND SHORTEST
+            long twice = 0;
+            long save0 = 0, save1 = 0;
+            for (auto i: clique)
+            {
+                long first = std::numeric_limits<long>::max(), second = std::numeric_limits<long>::max();
+                for (auto j: clique)
+                {
+                    if (i == j) continue;
+                    long d = distance(i, j);
+                    if (d < first) { second = first; first = d; }
+                    else if (d < second) second = d;
+                }
+                if (clique.size() == 2) second = 0;
+                twice += first + second;
+                if (second > save0) { save1 = save0; save0 = second; }
+                else if (second > save1) save1 = second;
+            }
+
+            return std::max(tree, (twice - save0 - save1 + 1) / 2);
+        };
+
+        /**
+         * Place items in random order of increasing leftmost position, items which do not fit
+         * are skipped when skip is set. Returns number of placed items and their placement order
+         */
+        template <typename R>
+        int place(R& rng, bool strict, bool skip, std::vector<int>& positions, std::vector<int>& order) const
+        {
+            auto n = size();
+            std::vector<long> lowest(n, from);
+            std::vector<char> done(n, 0);
+            positions.assign(n, CSP_UNASSIGNED);
+            order.clear();
+
+            for (auto k = 0; k < n; ++k)
+            {
+                // NEXT ITEM IS RANDOM ONE OF THOSE WHICH CAN BE PLACED LEFTMOST, WITHOUT STRICT
+                // ORDER ALSO THOSE WITHIN ONE STEP OF THEM
+                long min = std::numeric_limits<long>::max();
+                for (auto i = 0; i < n; ++i)
+                    if (!done[i]) min = std::min(min, lowest[i]);
+
+                auto limit = strict ? min : min + step;
+                auto candidates = 0;
+                for (auto i = 0; i < n; ++i)
+                    if (!done[i] && lowest[i] <= limit) candidates += 1;
+
+                auto pick = (int) (rng() % candidates);
+                auto item = -1;
+                for (auto i = 0; i < n && item < 0; ++i)
+                    if (!done[i] && lowest[i] <= limit && pick-- == 0) item = i;
+
+                done[item] = 1;
+                if (lowest[item] > last)
+                {
+                    if (!skip) return (int) order.size();
+                    continue;
+                }
+
+                positions[item] = (int) lowest[item];
+                order.push_back(item);
+                for (auto& neighbour: neighbours[item])
+                    if (!done[neighbour.first])
+                        lowest[neighbour.first] = std::max(lowest[neighbour.first], (long) positions[item] + neighbour.second);
+            }
+            return (int) order.size();
+        };
+
+        /**
+         * Shift placed items right by random amounts which do not decrease along placement order,
+         * so every kept distance only grows and no item passes last position
+         */
+        template <typename R>
+        void spread(R& rng, std::vector<int>& positions, const std::vector<int>& order) const
+        {
+            std::vector<int> bound(order.size());
+            auto slack = std::numeric_limits<int>::max();
+            for (auto k = (int) order.size() - 1; k >= 0; --k)
+            {
+                slack = std::min(slack, last - positions[order[k]]);
+                bound[k] = slack;
+            }
+
+            auto shift = 0;
+            for (size_t k = 0; k < order.size(); ++k)
+            {
+                auto steps = bound[k] / step;
+                shift = std::max(shift, (int) (rng() % (steps + 1)) * step);
+                positions[order[k]] += shift;
+            }
+        };
+
+    public:
+        SpacingSolver(int _from, int _to, int _step): from{_from}, to{_to}, step{std::max(1, _step)}
+        {
+            last = to > from ? from + ((to - from - 1) / step) * step : from - 1;
+        };
+
+        int size() const { return (int) neighbours.size(); };
 
-           
-            auto variable = unassigned[0];
-            for (auto& value: domains[variable]) 
+        int add_item()
+        {
+            neighbours.emplace_back();
+            return size() - 1;
+        };
+
+        void add_distance(int i, int j, int distance)
+        {
+            auto d = rounded(distance);
+            for (auto& n: neighbours[i])
             {
-                if (force_stop()) return assignment;
+                if (n.first != j) continue;
+                n.second = std::max(n.second, d);
+                for (auto& m: neighbours[j]) if (m.first == i) m.second = n.second;
+                return;
+            }
+            neighbours[i].push_back({j, d});
+            neighbours[j].push_back({i, d});
+        };
+
+        /**
+         * Whether items provably can not be placed, checks clique grown greedily from each item
+         */
+        bool infeasible() const
+        {
+            if (size() > 0 && last < from)
+                return true;
 
-                auto local_assignment = assignment;
-                local_assignment[variable] = value;
-                if (consistent(variable, local_assignment))
+            std::vector<int> by_degree(size());
+            for (auto i = 0; i < size(); ++i) by_degree[i] = i;
+            std::stable_sort(by_degree.begin(), by_degree.end(), [&](int a, int b){ return neighbours[a].size() > neighbours[b].size(); });
+
+            for (auto start = 0; start < size(); ++start)
+            {
+                std::vector<int> clique {start};
+                for (auto i: by_degree)
                 {
-                    auto result = backtracking_search(local_assignment, std::ref(force_stop));
-                    if (result.size() != 0)
-                        return result;
+                    if (i == start) continue;
+                    auto all = true;
+                    for (auto j: clique) all = all && distance(i, j) >= 0;
+                    if (all) clique.push_back(i);
                 }
+                if (clique_span(clique) > last - from)
+                    return true;
+            }
+            return false;
+        };
+
+        /**
+         * Random arrangement of all items found in given number of tries, positions are indexed by item
+         */
+        template <typename R>
+        Result sample(R& rng, int tries, std::vector<int>& positions) const
+        {
+            if (infeasible())
+                return INFEASIBLE;
+
+            std::vector<int> order;
+            for (auto t = 0; t < tries; ++t)
+            {
+                if (place(rng, t == 0, false, positions, order) < size())
+                    continue;
+                spread(rng, positions, order);
+                return PLACED;
             }
-            
-            return {};
+
+            positions.assign(size(), CSP_UNASSIGNED);
+            return UNKNOWN;
+        };
+
+        /**
+         * Random arrangement of as many items as fit, positions of other items are unassigned
+         */
+        template <typename R>
+        int sample_most(R& rng, std::vector<int>& positions) const
+        {
+            std::vector<int> order;
+            auto placed = place(rng, true, true, positions, order);
+            spread(rng, positions, order);
+            return placed;
         };
 };
 
@@ -3,6 +3,7 @@
 
 #include <functional>
 #include <string>
+#include <cmath>
 #ifndef RAYLIB_H
 #include "raylib.h"
 #endif
@@ -107,6 +108,7 @@ class SliderBar: public Renderable
         std::string text_left;
         std::string text_right;
         std::function<void (float)> on_change;
+        float step; // 0 FOR CONTINUOUS VALUES
 
         // internal logic
         float value;
@@ -116,22 +118,28 @@ class SliderBar: public Renderable
                 float _value,
                 std::string _text_left = "0", 
                 std::string _text_right = "1", 
-                std::function<void (float)> _on_change = [](float){}
+                std::function<void (float)> _on_change = [](float){},
+                float _step = 0
         ):  x{_x}, y{_y}, w{_w}, h{_h}, 
             text_left{_text_left}, 
             text_right{_text_right}, 
             on_change{_on_change}, 
+            step{_step},
             value{_value}
         {};
 
         auto GetValue() { return value; };
         void SetValue(float v) { value = v; } ;
+        auto GetStep() { return step; };
+        void SetStep(float s) { step = s; };
 
         void SetOnChangeListener(std::function<void (float)> f) { on_change = f;} ;
 
         virtual void Render(float ax, float ay) override
         {
             auto v = GuiSliderBar({ax + x, ay + y, w, h}, text_left.c_str(), text_right.c_str(), value, 0, 1);  
+            // QUANTIZED VALUES CAN BE REVISITED EXACTLY
+            if (step > 0) v = std::round(v / step) * step;
             if (v != value)
             {
                 value = v;
@@ -188,9 +196,10 @@ class Layout
         };
 
         virtual SliderBar& CreateSliderBar(float sx, float sy, float w, float h, float value, 
-                std::function<void (float)> on_change = [](float){}
+                std::function<void (float)> on_change = [](float){},
+                float step = 0
         ){
-            std::unique_ptr<Renderable> slider_bar {new SliderBar(sx, sy, w, h, value, "0", "1", on_change)};
+            std::unique_ptr<Renderable> slider_bar {new SliderBar(sx, sy, w, h, value, "0", "1", on_change, step)};
             renderables.push_back(std::move(slider_bar));
             return *dynamic_cast<SliderBar*>(renderables.back().get());
         };
@@ -0,0 +1,229 @@
+#include <memory>
+#include <stdio.h>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+#include "utils.h"
+#include "pcg.h"
+#include "scene.h"
+#include "world.h"
+#include "batch.h"
+#include "server.h"
+
+
+/**************************************************
+*
+* HEADLESS GENERATOR
+*
+**************************************************/
+
+void Usage(const char* program)
+{
+    printf("Usage: %s [--seed N] [--scale S] [--params FILE] [--scene NAME] [--out FILE]\n", program);
+    printf("       %s --count N [--jobs J] [--out-dir DIR] [--cache-mb N] [--seed N] [--scale S] [--params FILE] [--scene NAME]\n", program);
+    printf("       %s --manifest FILE [--jobs J] [--out-dir DIR] [--cache-mb N]\n", program);
+    printf("       %s --serve PORT [--jobs J] [--queue N] [--out-dir DIR] [--cache-mb N]\n", program);
+    printf("  --seed N         seed of generated world, first seed of batch (default 0)\n");
+    printf("  --scale S        map size relative to 4200x1200 (default 1.0)\n");
+    printf("  --params FILE    parameter file with lines name = value, # starts comment\n");
+    printf("  --scene NAME     scene pipeline to run (default DefaultScene)\n");
+    printf("  --out FILE       output world file (default world.pcgw)\n");
+    printf("  --count N        generate N worlds with consecutive seeds\n");
+    printf("  --manifest FILE  generate world for each line: seed [scene=NAME] [scale=S] [params=FILE] [name=value]...\n");
+    printf("  --jobs J         worlds generated at once in batch (default hardware threads)\n");
+    printf("  --out-dir DIR    directory of batch worlds, named world_<seed>.pcgw (default .)\n");
+    printf("  --serve PORT     serve /generate and /stats on 127.0.0.1:PORT, --jobs workers\n");
+    printf("  --queue N        requests waiting in server queue before it rejects new ones (default 64)\n");
+    printf("  --cache-mb N     memory of stage cache, 0 disables it (default 0 for batch, 512 otherwise)\n");
+};
+
+/**
+ * Read batch manifest, every line is one world with settings over defaults of base job
+ */
+bool ReadManifest(const std::string& path, const WorldJob& base, std::vector<WorldJob>& jobs, std::string& error)
+{
+    auto* file = fopen(path.c_str(), "r");
+    if (file == nullptr)
+    {
+        error = "CAN NOT OPEN MANIFEST " + path;
+        return false;
+    }
+
+    char line[1024];
+    auto number = 0;
+    auto ok = true;
+    while (ok && fgets(line, sizeof(line), file) != nullptr)
+    {
+        number += 1;
+        auto text = Trim(std::string(line).substr(0, std::string(line).find('#')));
+        if (text.empty())
+            continue;
+
+        auto job = base;
+        char* end = nullptr;
+        job.seed = strtoul(text.c_str(), &end, 10);
+        if (end == text.c_str())
+        {
+            error = "EXPECTED SEED";
+            ok = false;
+        }
+
+        // SETTINGS ARE SEPARATED BY WHITESPACE
+        std::string rest {end};
+        size_t position = 0;
+        while (ok && (position = rest.find_first_not_of(" \t\r\n", position)) != std::string::npos)
+        {
+            auto stop = rest.find_first_of(" \t\r\n", position);
+            auto token = rest.substr(position, stop == std::string::npos ? std::string::npos : stop - position);
+            position = stop == std::string::npos ? rest.size() : stop;
+
+            auto eq = token.find('=');
+            auto name = token.substr(0, eq);
+            auto value = eq == std::string::npos ? std::string() : token.substr(eq + 1);
+            if (name == "scene") job.scene = value;
+            else if (name == "scale") job.scale = strtof(value.c_str(), nullptr);
+            else if (name == "params") ok = ReadParameters(value, job.parameters, error);
+            else ok = ParseParameter(name, value, job.parameters, error);
+        }
+
+        if (!ok)
+            error = path + ":" + std::to_string(number) + ": " + error;
+        else
+            jobs.push_back(job);
+    }
+
+    fclose(file);
+    return ok;
+};
+
+int main(int argc, char** argv)
+{
+    WorldJob base;
+    base.out = "world.pcgw";
+    std::string params;
+    std::string manifest;
+    std::string out_dir = ".";
+    auto count = 0;
+    auto port = 0;
+    auto queue = 64;
+    auto cache_mb = -1;
+    auto concurrency = std::max(1u, std::thread::hardware_concurrency());
+
+    for (auto i = 1; i < argc; ++i)
+    {
+        auto has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--seed") == 0 && has_value) base.seed = strtoul(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--scale") == 0 && has_value) base.scale = strtof(argv[++i], nullptr);
+        else if (strcmp(argv[i], "--params") == 0 && has_value) params = argv[++i];
+        else if (strcmp(argv[i], "--scene") == 0 && has_value) base.scene = argv[++i];
+        else if (strcmp(argv[i], "--out") == 0 && has_value) base.out = argv[++i];
+        else if (strcmp(argv[i], "--count") == 0 && has_value) count = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--manifest") == 0 && has_value) manifest = argv[++i];
+        else if (strcmp(argv[i], "--jobs") == 0 && has_value) concurrency = std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--out-dir") == 0 && has_value) out_dir = argv[++i];
+        else if (strcmp(argv[i], "--serve") == 0 && has_value) port = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--queue") == 0 && has_value) queue = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--cache-mb") == 0 && has_value) cache_mb = std::max(0, atoi(argv[++i]));
+        else
+        {
+            Usage(argv[0]);
+            return 2;
+        }
+    }
+
+    std::string error;
+    if (!params.empty() && !ReadParameters(params, base.parameters, error))
+    {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 2;
+    }
+
+    if (cache_mb >= 0)
+        SharedStageCache().Capacity((size_t) cache_mb * 1024 * 1024);
+
+    if (port > 0)
+    {
+        GenerationServer server {port, concurrency, (size_t) std::max(1, queue), out_dir};
+        if (!server.Serve())
+        {
+            fprintf(stderr, "CAN NOT LISTEN ON 127.0.0.1:%d\n", port);
+            return 1;
+        }
+        return 0;
+    }
+
+    // SINGLE WORLD, BATCH OF CONSECUTIVE SEEDS OR WORLDS OF MANIFEST
+    std::vector<WorldJob> jobs;
+    auto batch = count > 0 || !manifest.empty();
+    if (!manifest.empty())
+    {
+        if (!ReadManifest(manifest, base, jobs, error))
+        {
+            fprintf(stderr, "%s\n", error.c_str());
+            return 2;
+        }
+    }
+    else
+    {
+        for (auto i = 0; i < std::max(1, count); ++i)
+        {
+            jobs.push_back(base);
+            jobs.back().seed = base.seed + i;
+        }
+    }
+
+    for (auto& job: jobs)
+    {
+        if (job.scale <= 0)
+        {
+            fprintf(stderr, "SCALE HAS TO BE POSITIVE\n");
+            return 2;
+        }
+
+        std::unique_ptr<Scene> scene {CreateScene(job.scene)};
+        if (scene == nullptr)
+        {
+            fprintf(stderr, "UNKNOWN SCENE %s\n", job.scene.c_str());
+            return 2;
+        }
+
+        if (batch)
+            job.out = out_dir + "/world_" + std::to_string(job.seed) + ".pcgw";
+    }
+
+    // STAGE KEYS CONTAIN SEED, SO WORLDS OF BATCH NEVER HIT CACHE OF EACH OTHER
+    if (batch && cache_mb < 0)
+        SharedStageCache().Capacity(0);
+
+    auto failed = 0;
+    auto start = std::chrono::steady_clock::now();
+    RunBatch(jobs, batch ? concurrency : 1, [&](const WorldResult& result)
+    {
+        auto& job = *result.job;
+        if (!result.ok)
+        {
+            failed += 1;
+            fprintf(stderr, "%s seed %u FAILED: %s\n", job.scene.c_str(), job.seed, result.error.c_str());
+            return;
+        }
+
+        if (!result.degraded.empty())
+            fprintf(stderr, "%s seed %u DEGRADED: %s\n", job.scene.c_str(), job.seed, result.degraded.c_str());
+        printf("%s seed %u scale %.2f generated in %.0fms, written %zu bytes to %s\n",
+            job.scene.c_str(), job.seed, job.scale, result.ms, result.bytes, job.out.c_str());
+        fflush(stdout);
+    });
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (batch)
+    {
+        printf("BATCH %zu worlds (%d failed) in %.1fs, %.2f worlds/s, %u at once, peak RSS %.0f MB\n",
+            jobs.size(), failed, elapsed, (jobs.size() - failed) / elapsed, std::min(concurrency, (unsigned int) jobs.size()), PeakRSS());
+    }
+
+    return failed > 0 ? 1 : 0;
+};
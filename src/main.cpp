@@ -22,6 +22,7 @@
 #include "gui.h"
 #include "pcg.h"
 #include "scene.h"
+#include "speculation.h"
 
 
 using namespace std::chrono_literals;
@@ -37,29 +38,88 @@ std::atomic_bool GenerationScheduled { false };
 std::atomic_bool ScheduleThreadRunning { false };
 std::atomic_bool SceneDrawReady{ false };
 
+// COARSE PREVIEW IS GENERATED AND PUBLISHED BEFORE FULL RESOLUTION MAP
+const float PREVIEW_SCALE = 0.25;
+std::atomic_bool PreviewEnabled { true };
+Map preview;
+std::atomic<Map*> SceneDrawMap { nullptr };
+
+// LAST TOUCHED SLIDER IS USED FOR SPECULATION OF NEXT VALUES
+const float SLIDER_STEP = 0.02;
+Speculator speculator;
+std::mutex LastSliderMutex;
+Speculator::Apply LastSliderApply;
+float LastSliderValue = 0;
+float LastSliderPrevious = 0;
+
+// WHILE ZOOMED IN UNDERGROUND IS REGENERATED ONLY AROUND VISIBLE RECT, FULL RUN FOLLOWS WHEN INTERACTION STOPS
+const int VIEWPORT_MARGIN = 64;
+const auto VIEWPORT_IDLE = 1s;
+std::mutex ViewportMutex;
+Rect Viewport {0, 0, 0, 0};
+bool ViewportZoomed = false;
+std::chrono::steady_clock::time_point LastInteraction;
+std::atomic_bool FullRunDeferred { false };
+
+/**
+ * Run scene on coarse preview map with parameters and dirty stages of map
+ */
+void _PreviewGen(Map& map)
+{
+    if (!preview.IsInitialized())
+    {
+        preview.Scale(PREVIEW_SCALE);
+        preview.Init();
+    }
+
+    preview.CopyParameters(map);
+    for (auto stage = 0; stage < 5; ++stage)
+        preview.GenerateStage(stage, preview.GenerateStage(stage) || map.GenerateStage(stage));
+
+    scene->Run(preview);
+    if (!preview.ShouldForceStop() && !map.ShouldForceStop())
+    {
+        GenerationDone(preview);
+        SceneDrawMap = &preview;
+        SceneDrawReady = true;
+    }
+};
+
 void _PCGGen(Map& map)
 {
     if (scene != nullptr)
     {
+        if (PreviewEnabled)
+            _PreviewGen(map);
+
         scene->Run(map);
+        SceneDrawMap = &map;
         SceneDrawReady = true;
     }
     map.SetGenerationMessage("");
     map.SetGenerating(false);
     if (!map.ShouldForceStop())
+    {
         GenerationDone(map);
+
+        const std::lock_guard<std::mutex> lock(LastSliderMutex);
+        if (scene != nullptr && LastSliderApply)
+            speculator.Speculate(map, scene->Name(), LastSliderApply, LastSliderValue, LastSliderPrevious, SLIDER_STEP);
+    }
 };
 
 void PCGGen(Map& map)
 {
     map.SetGenerating(true); 
     map.SetForceStop(false);
+    preview.SetForceStop(false);
     auto thread = std::thread(_PCGGen, std::ref(map));
     thread.detach();
 };
 
 void ScheduleGeneration(Map& map)
 {
+    speculator.Preempt();
     GenerationScheduled = true;
     if (!ScheduleThreadRunning)
     {
@@ -70,9 +130,12 @@ void ScheduleGeneration(Map& map)
                 if (!map.IsInitialized())
                     map.Init();
                 if (map.IsGenerating())
+                {
                     map.SetForceStop(true);
+                    preview.SetForceStop(true);
+                }
                 GenerationScheduled = false;
-                std::this_thread::sleep_for(0.25s);
+                std::this_thread::sleep_for(0.01s);
             }
             // HERE WE ARE SURE THAT LAST GENERATION EXITED
             PCGGen(map);
@@ -88,6 +151,49 @@ void ScheduleGeneration(Map& map)
 *
 **************************************************/
 
+/**
+ * Restrict dirty underground to visible rect while zoomed in, full run is deferred
+ */
+void ApplyViewport(Map& map)
+{
+    const std::lock_guard<std::mutex> lock(ViewportMutex);
+    LastInteraction = std::chrono::steady_clock::now();
+    if (!map.GenerateStage(4))
+        return;
+
+    if (ViewportZoomed)
+    {
+        map.RegionOfInterest(Viewport);
+        FullRunDeferred = true;
+    }
+    else
+    {
+        map.ClearRegionOfInterest();
+        FullRunDeferred = false;
+    }
+};
+
+/**
+ * Slider callback applying value to map, scheduling generation and remembering slider for speculation
+ */
+std::function<void (float)> OnSliderChange(Map& map, Speculator::Apply apply)
+{
+    auto previous = std::make_shared<float>(-1);
+    return [&map, apply, previous](float fq)
+    {
+        apply(map, fq);
+        {
+            const std::lock_guard<std::mutex> lock(LastSliderMutex);
+            LastSliderApply = apply;
+            LastSliderValue = fq;
+            LastSliderPrevious = *previous;
+        }
+        *previous = fq;
+        ApplyViewport(map);
+        ScheduleGeneration(map);
+    };
+};
+
 std::string random_string()
 {
      std::string str("0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz");
@@ -111,6 +217,8 @@ int main(void)
     GuiLoadStyle("style.rgs");
 
     RenderTexture canvas = LoadRenderTexture(map_width, map_height);
+    RenderTexture preview_canvas = LoadRenderTexture(map_width * PREVIEW_SCALE, map_height * PREVIEW_SCALE);
+    RenderTexture* shown_canvas = &canvas;
     Camera2D camera {{0, 0}, {0, 0}, 0, 1};
    
     // RAYGUI RELATED
@@ -127,47 +235,41 @@ int main(void)
     StructuresControl.CreateLabel(0, 120 + 20, 92, 24, "LAKES");
     StructuresControl.CreateLabel(0, 144 + 24, 92, 24, "TREES");
     StructuresControl.CreateSliderBar(92 + 8, 24 + 4, 92, 24, map.HillsFrequency(), 
-    [&](float fq)
-    { 
+    OnSliderChange(map, [](Map& map, float fq)
+    {
         map.HillsFrequency(fq);
         GenerateSurface(map);
-        ScheduleGeneration(map);
-    }); 
+    }), SLIDER_STEP);
     StructuresControl.CreateSliderBar(92 + 8, 48 + 8, 92, 24, map.HolesFrequency(),
-    [&](float fq)
+    OnSliderChange(map, [](Map& map, float fq)
     {
         map.HolesFrequency(fq);
         GenerateSurface(map);
-        ScheduleGeneration(map);
-    }); 
+    }), SLIDER_STEP);
     StructuresControl.CreateSliderBar(92 + 8, 72 + 12, 92, 24, map.IslandsFrequency(), 
-    [&](float fq)
+    OnSliderChange(map, [](Map& map, float fq)
     {
         map.IslandsFrequency(fq);
         GenerateSurface(map);
-        ScheduleGeneration(map);
-    }); 
+    }), SLIDER_STEP);
     StructuresControl.CreateSliderBar(92 + 8, 96 + 16, 92, 24, map.ChasmFrequency(), 
-    [&](float fq)
+    OnSliderChange(map, [](Map& map, float fq)
     {
         map.ChasmFrequency(fq);
         GenerateSurface(map);
-        ScheduleGeneration(map);
-    }); 
+    }), SLIDER_STEP);
     StructuresControl.CreateSliderBar(92 + 8, 120 + 20, 92, 24, map.LakeFrequency(), 
-    [&](float fq)
+    OnSliderChange(map, [](Map& map, float fq)
     {
         map.LakeFrequency(fq);
         GenerateSurface(map);
-        ScheduleGeneration(map);
-    }); 
+    }), SLIDER_STEP);
     StructuresControl.CreateSliderBar(92 + 8, 144 + 24, 92, 24, map.TreeFrequency(), 
-    [&](float fq)
+    OnSliderChange(map, [](Map& map, float fq)
     {
         map.TreeFrequency(fq);
         GenerateSurface(map);
-        ScheduleGeneration(map);
-    }); 
+    }), SLIDER_STEP);
     StructuresControl.Hide();
 
     HeaderLayout SurfaceControl(200 + 8, 0, 200, 400, "Surface Settings");
@@ -175,26 +277,23 @@ int main(void)
     SurfaceControl.CreateLabel(0, 24 + 4, 92, 24, "FREQUENCY");
     SurfaceControl.CreateLabel(0, 48 + 8, 92, 24, "OCTAVES");
     SurfaceControl.CreateSliderBar(92 + 8, 0, 92, 24, map.SurfacePartsCount(),
-    [&](float fq)
+    OnSliderChange(map, [](Map& map, float fq)
     {
         map.SurfacePartsCount(fq);
         GenerateSurface(map);
-        ScheduleGeneration(map);
-    }); 
+    }), SLIDER_STEP);
     SurfaceControl.CreateSliderBar(92 + 8, 24 + 4, 92, 24, map.SurfacePartsFrequency(),
-    [&](float fq)
+    OnSliderChange(map, [](Map& map, float fq)
     {
         map.SurfacePartsFrequency(fq);
         GenerateSurface(map);
-        ScheduleGeneration(map);
-    }); 
+    }), SLIDER_STEP);
     SurfaceControl.CreateSliderBar(92 + 8, 48 + 8, 92, 24, map.SurfacePartsOctaves(),
-    [&](float fq)
+    OnSliderChange(map, [](Map& map, float fq)
     {
         map.SurfacePartsOctaves(fq);
         GenerateSurface(map);
-        ScheduleGeneration(map);
-    }); 
+    }), SLIDER_STEP);
     SurfaceControl.Hide();
 
     HeaderLayout CaveControl(400 + 16, 0, 200, 400, "Cave Settings");
@@ -203,33 +302,29 @@ int main(void)
     CaveControl.CreateLabel(0, 48 + 8, 92, 24, "POINTS");
     CaveControl.CreateLabel(0, 72 + 12, 92, 24, "CURVNESS");
     CaveControl.CreateSliderBar(92 + 8, 0, 92, 24, map.CaveFrequency(),
-    [&](float fq)
+    OnSliderChange(map, [](Map& map, float fq)
     {
         map.CaveFrequency(fq);
         GenerateUnderground(map);
-        ScheduleGeneration(map);
-    }); 
+    }), SLIDER_STEP);
     CaveControl.CreateSliderBar(92 + 8, 24 + 4, 92, 24, map.CaveStrokeSize(),
-    [&](float fq)
+    OnSliderChange(map, [](Map& map, float fq)
     {
         map.CaveStrokeSize(fq);
         GenerateUnderground(map);
-        ScheduleGeneration(map);
-    }); 
+    }), SLIDER_STEP);
     CaveControl.CreateSliderBar(92 + 8, 48 + 8, 92, 24, map.CavePointsSize(),
-    [&](float fq)
+    OnSliderChange(map, [](Map& map, float fq)
     {
         map.CavePointsSize(fq);
         GenerateUnderground(map);
-        ScheduleGeneration(map);
-    }); 
+    }), SLIDER_STEP);
     CaveControl.CreateSliderBar(92 + 8, 72 + 12, 92, 24, map.CaveCurvness(),
-    [&](float fq)
+    OnSliderChange(map, [](Map& map, float fq)
     {
         map.CaveCurvness(fq);
         GenerateUnderground(map);
-        ScheduleGeneration(map);
-    }); 
+    }), SLIDER_STEP);
     CaveControl.Hide();
 
     HeaderLayout MaterialControl(600 + 24, 0, 350, 400, "Material Control");
@@ -241,72 +336,64 @@ int main(void)
     MaterialControl.CreateLabel(0, 96 + 20, 92, 24, "GOLD");
 
     MaterialControl.CreateSliderBar(92 + 8, 24 + 4, 92, 24, map.CopperFrequency(),
-    [&](float fq)
+    OnSliderChange(map, [](Map& map, float fq)
     {
         map.CopperFrequency(fq);
         GenerateSurface(map);
         GenerateUnderground(map);
-        ScheduleGeneration(map);
-    }); 
+    }), SLIDER_STEP);
 
     MaterialControl.CreateSliderBar(92 + 8, 48 + 8, 92, 24, map.IronFrequency(),
-    [&](float fq)
+    OnSliderChange(map, [](Map& map, float fq)
     {
         map.IronFrequency(fq);
         GenerateSurface(map);
         GenerateUnderground(map);
-        ScheduleGeneration(map);
-    }); 
+    }), SLIDER_STEP);
 
     MaterialControl.CreateSliderBar(92 + 8, 72 + 12, 92, 24, map.SilverFrequency(),
-    [&](float fq)
+    OnSliderChange(map, [](Map& map, float fq)
     {
         map.SilverFrequency(fq);
         GenerateUnderground(map);
-        ScheduleGeneration(map);
-    }); 
+    }), SLIDER_STEP);
 
     MaterialControl.CreateSliderBar(92 + 8, 96 + 16, 92, 24, map.GoldFrequency(),
-    [&](float fq)
+    OnSliderChange(map, [](Map& map, float fq)
     {
         map.GoldFrequency(fq);
         GenerateUnderground(map);
-        ScheduleGeneration(map);
-    }); 
+    }), SLIDER_STEP);
 
     MaterialControl.CreateSliderBar(184 + 32, 24 + 4, 92, 24, map.CopperSize(),
-    [&](float fq)
+    OnSliderChange(map, [](Map& map, float fq)
     {
         map.CopperSize(fq);
         GenerateSurface(map);
         GenerateUnderground(map);
-        ScheduleGeneration(map);
-    }); 
+    }), SLIDER_STEP);
 
     MaterialControl.CreateSliderBar(184 + 32, 48 + 8, 92, 24, map.IronSize(),
-    [&](float fq)
+    OnSliderChange(map, [](Map& map, float fq)
     {
         map.IronSize(fq);
         GenerateSurface(map);
         GenerateUnderground(map);
-        ScheduleGeneration(map);
-    }); 
+    }), SLIDER_STEP);
 
     MaterialControl.CreateSliderBar(184 + 32, 72 + 12, 92, 24, map.SilverSize(),
-    [&](float fq)
+    OnSliderChange(map, [](Map& map, float fq)
     {
         map.SilverSize(fq);
         GenerateUnderground(map);
-        ScheduleGeneration(map);
-    }); 
+    }), SLIDER_STEP);
 
     MaterialControl.CreateSliderBar(184 + 32, 96 + 16, 92, 24, map.GoldSize(),
-    [&](float fq)
+    OnSliderChange(map, [](Map& map, float fq)
     {
         map.GoldSize(fq);
         GenerateUnderground(map);
-        ScheduleGeneration(map);
-    }); 
+    }), SLIDER_STEP);
 
 
     MaterialControl.Hide();
@@ -499,10 +586,12 @@ int main(void)
     {
         if (SceneDrawReady)
         {
-            BeginTextureMode(canvas);
-                if (scene != nullptr) scene->Render(map);
-            EndTextureMode();
             SceneDrawReady = false;
+            auto* draw_map = SceneDrawMap.load();
+            shown_canvas = draw_map == &preview ? &preview_canvas : &canvas;
+            BeginTextureMode(*shown_canvas);
+                if (scene != nullptr && draw_map != nullptr) scene->Render(*draw_map);
+            EndTextureMode();
         }
 
         if (IsKeyPressed(KEY_I))
@@ -558,6 +647,34 @@ int main(void)
             camera.offset = {drag_x + mx - drag_x, drag_y + my - drag_y}; 
         }
 
+        // VISIBLE PART OF MAP WITH MARGIN
+        {
+            auto view_x = camera.target.x - camera.offset.x / camera.zoom;
+            auto view_y = camera.target.y - camera.offset.y / camera.zoom;
+            auto view_w = width / camera.zoom;
+            auto view_h = height / camera.zoom;
+
+            const std::lock_guard<std::mutex> lock(ViewportMutex);
+            if (dragging || GetMouseWheelMove() != 0.0)
+                LastInteraction = std::chrono::steady_clock::now();
+            ViewportZoomed = view_w * view_h < 0.5 * map_width * map_height;
+            Viewport = {(int)view_x - VIEWPORT_MARGIN, (int)view_y - VIEWPORT_MARGIN,
+                        (int)view_w + 2 * VIEWPORT_MARGIN, (int)view_h + 2 * VIEWPORT_MARGIN};
+        }
+
+        // FULL UNDERGROUND RUN AFTER VIEWPORT RUN WHEN INTERACTION STOPPED
+        if (FullRunDeferred && !map.IsGenerating() && !ScheduleThreadRunning)
+        {
+            const std::lock_guard<std::mutex> lock(ViewportMutex);
+            if (std::chrono::steady_clock::now() - LastInteraction > VIEWPORT_IDLE)
+            {
+                FullRunDeferred = false;
+                map.ClearRegionOfInterest();
+                GenerateUnderground(map);
+                ScheduleGeneration(map);
+            }
+        }
+
         // DRAW LOGIC
         BeginDrawing();
             ClearBackground((Color){60, 56, 54, 255});
@@ -566,7 +683,10 @@ int main(void)
 
             BeginScissorMode(0, 0, width, height);
                 BeginMode2D(camera);
-                    DrawTextureRec(canvas.texture, (Rectangle) { 0, 0, map_width, -map_height}, {0, 0}, WHITE);        
+                    // COARSE PREVIEW IS STRETCHED OVER FULL MAP
+                    DrawTexturePro(shown_canvas->texture, 
+                            (Rectangle) { 0, 0, (float)shown_canvas->texture.width, (float)-shown_canvas->texture.height}, 
+                            (Rectangle) { 0, 0, map_width, map_height}, {0, 0}, 0, WHITE);        
                 EndMode2D();
             EndScissorMode();
 
@@ -686,7 +806,12 @@ int main(void)
             }
             else
             {
-                DrawText("DONE...", 8, height + 4, 8, WHITE);
+                if (map.IsDegraded())
+                {
+                    auto status = "DONE (DEGRADED: " + map.Degradations() + ")...";
+                    DrawText(status.c_str(), 8, height + 4, 8, YELLOW);
+                }
+                else DrawText("DONE...", 8, height + 4, 8, WHITE);
 
                 if (map.HasError()) 
                 { 
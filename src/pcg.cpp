@@ -0,0 +1,186 @@
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "utils.h"
+#include "pcg.h"
+#include "scene.h"
+#include "batch.h"
+#include "capi.h"
+
+
+/**************************************************
+*
+* C INTERFACE IMPLEMENTATION
+*
+**************************************************/
+
+struct PCGMap
+{
+    Map map;
+    WorldJob job;
+    std::string error;
+    std::string degradations;
+};
+
+/**
+ * Structure of given kind and index, nullptr if there is no such structure
+ */
+static PixelArray* Structure(PCGMap* handle, int kind, size_t index, uint32_t& type)
+{
+    auto& map = handle->map;
+    switch (kind)
+    {
+        case PCG_STRUCTURES_BIOMES:
+            if (index >= map.Biomes().size()) return nullptr;
+            type = map.Biomes()[index]->GetType();
+            return map.Biomes()[index].get();
+        case PCG_STRUCTURES_DEFINED:
+            if (index >= map.DefinedStructures().size()) return nullptr;
+            type = map.DefinedStructures()[index]->GetType();
+            return map.DefinedStructures()[index].get();
+        case PCG_STRUCTURES_GENERATED:
+            if (index >= map.GeneratedStructures().size()) return nullptr;
+            type = map.GeneratedStructures()[index]->GetType();
+            return map.GeneratedStructures()[index].get();
+        case PCG_STRUCTURES_UNDERGROUND:
+            if (index >= map.UndergroundStructures().size()) return nullptr;
+            type = map.UndergroundStructures()[index]->GetType();
+            return map.UndergroundStructures()[index].get();
+    }
+    return nullptr;
+};
+
+extern "C"
+{
+
+PCG_EXPORT int pcg_api_version(void)
+{
+    return PCG_API_VERSION;
+}
+
+PCG_EXPORT PCGMap* pcg_map_create(float scale)
+{
+    if (!(scale > 0))
+        return nullptr;
+
+    auto* handle = new PCGMap();
+    handle->job.scale = scale;
+    return handle;
+}
+
+PCG_EXPORT void pcg_map_destroy(PCGMap* map)
+{
+    delete map;
+}
+
+PCG_EXPORT void pcg_map_set_seed(PCGMap* map, uint32_t seed)
+{
+    map->job.seed = seed;
+}
+
+PCG_EXPORT int pcg_map_set_parameter(PCGMap* map, const char* name, float value)
+{
+    if (name == nullptr)
+        return PCG_INVALID_ARGUMENT;
+
+    // PARAMETERS ARE APPLIED OVER DEFAULTS ON EACH RUN
+    Map probe;
+    if (!probe.SetParameter(name, value))
+    {
+        map->error = std::string("UNKNOWN PARAMETER ") + name;
+        return PCG_UNKNOWN_PARAMETER;
+    }
+    map->job.parameters.emplace_back(name, value);
+    return PCG_OK;
+}
+
+PCG_EXPORT int pcg_map_run_scene(PCGMap* map, const char* scene)
+{
+    if (scene == nullptr)
+        return PCG_INVALID_ARGUMENT;
+
+    std::unique_ptr<Scene> instance {CreateScene(scene)};
+    if (instance == nullptr)
+    {
+        map->error = std::string("UNKNOWN SCENE ") + scene;
+        return PCG_UNKNOWN_SCENE;
+    }
+
+    map->job.scene = scene;
+    map->error.clear();
+    auto ok = GenerateWorld(map->map, map->job, map->error);
+    map->degradations = map->map.Degradations();
+    return ok ? PCG_OK : PCG_GENERATION_FAILED;
+}
+
+PCG_EXPORT const char* pcg_map_last_error(PCGMap* map)
+{
+    return map->error.c_str();
+}
+
+PCG_EXPORT const char* pcg_map_degradations(PCGMap* map)
+{
+    return map->degradations.c_str();
+}
+
+PCG_EXPORT int pcg_map_layer(PCGMap* map, int layer, PCGLayer* out)
+{
+    if (out == nullptr || layer < 0 || layer >= Layers::COUNT || !map->map.IsInitialized())
+        return PCG_INVALID_ARGUMENT;
+
+    out->data = map->map.Layer(layer);
+    out->width = map->map.Width() + 1;
+    out->height = map->map.Height() + 1;
+    out->stride = map->map.LayerStride();
+    return PCG_OK;
+}
+
+PCG_EXPORT size_t pcg_map_structure_count(PCGMap* map, int kind)
+{
+    switch (kind)
+    {
+        case PCG_STRUCTURES_BIOMES: return map->map.Biomes().size();
+        case PCG_STRUCTURES_DEFINED: return map->map.DefinedStructures().size();
+        case PCG_STRUCTURES_GENERATED: return map->map.GeneratedStructures().size();
+        case PCG_STRUCTURES_UNDERGROUND: return map->map.UndergroundStructures().size();
+    }
+    return 0;
+}
+
+PCG_EXPORT int pcg_map_structure(PCGMap* map, int kind, size_t index, PCGStructure* out)
+{
+    uint32_t type = 0;
+    auto* structure = Structure(map, kind, index, type);
+    if (structure == nullptr || out == nullptr)
+        return PCG_INVALID_ARGUMENT;
+
+    auto bbox = structure->bbox();
+    out->type = type;
+    out->pixel_count = structure->size();
+    out->x = bbox.x;
+    out->y = bbox.y;
+    out->w = bbox.w;
+    out->h = bbox.h;
+    return PCG_OK;
+}
+
+PCG_EXPORT size_t pcg_map_structure_pixels(PCGMap* map, int kind, size_t index, int32_t* xy, size_t capacity)
+{
+    uint32_t type = 0;
+    auto* structure = Structure(map, kind, index, type);
+    if (structure == nullptr)
+        return 0;
+
+    size_t n = 0;
+    for (auto& pixel: *structure)
+    {
+        if (xy == nullptr || n >= capacity) break;
+        xy[2 * n] = pixel.x;
+        xy[2 * n + 1] = pixel.y;
+        n += 1;
+    }
+    return structure->size();
+}
+
+}
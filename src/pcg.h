@@ -14,6 +14,8 @@
 #include <string>
 #include <vector>
 #include <tuple>
+#include <cmath>
+#include <atomic>
 
 #include "csp.h"
 #include "spline.h"
@@ -23,7 +25,66 @@
 #include "utils.h"
 #endif
 
+#ifndef RANDOM
+#include "random.h"
+#endif
+
+#ifndef POOL
+#include "pool.h"
+#endif
+
+#ifdef _WIN32
 #define EXPORT __declspec(dllexport)
+#else
+#define EXPORT __attribute__((visibility("default")))
+#endif
+
+/**
+ * Random stream of every stage function, never reorder
+ */
+namespace Streams
+{
+    enum Stream: uint64_t
+    {
+        DEFINE_HILLS_HOLES_ISLANDS = 1,
+        DEFINE_SURFACE,
+        GENERATE_OCEAN_LEFT,
+        GENERATE_OCEAN_RIGHT,
+        GENERATE_HILLS,
+        GENERATE_HOLES,
+        GENERATE_ISLANDS,
+        GENERATE_CLIFFS_TRANSITIONS,
+        GENERATE_CHASMS,
+        GENERATE_LAKES,
+        GENERATE_JUNGLE_SWAMP,
+        GENERATE_TREES,
+        GENERATE_CAVES,
+        GENERATE_SURFACE_MATERIALS,
+        GENERATE_SURFACE_ORES,
+        GENERATE_UNDERGROUD_MATERIALS,
+        GENERATE_UNDERGROUND_ORES,
+        GENERATE_CAVERN_MATERIALS,
+        GENERATE_CAVERN_ORES,
+        GENERATE_CAVE_LAKES,
+        DEFINE_CABINS,
+    };
+};
+
+/**
+ * Length in pixels at map scale, full resolution maps have scale 1
+ */
+inline int Scaled(double length, double scale)
+{
+    return std::max(1, (int) std::round(length * scale));
+};
+
+/**
+ * Count of structures spread over area at map scale
+ */
+inline int ScaledCount(double count, double scale)
+{
+    return std::max(1, (int) std::round(count * scale * scale));
+};
 
 inline float cerp(float v0, float v1, float t)
 {
@@ -139,6 +200,11 @@ class DistanceConstraint: public Constraint<V, D>
 
             return (abs(value0 - value1) >= distance);
         };
+
+        virtual std::unique_ptr<IndexedConstraint> bind(const std::unordered_map<V, int>& ids, const std::vector<V>& names) const override
+        {
+            return std::unique_ptr<IndexedConstraint>(new IndexedDistanceConstraint(ids.at(v0), ids.at(v1), distance));
+        };
 };
 
 /**
@@ -189,6 +255,61 @@ class NonIntersectionConstraint2D: public Constraint<V, D>
             
             return true;
         };
+
+        virtual std::unique_ptr<IndexedConstraint> bind(const std::unordered_map<V, int>& ids, const std::vector<V>& names) const override
+        {
+            return std::unique_ptr<IndexedConstraint>(new IndexedNonIntersectionConstraint(ids.at(v0), ids.at(v1), w0, h0, w1, h1, width));
+        };
+};
+
+/**
+ * Constraint that ensures that none of objects of same size overlap each other, single constraint
+ * replaces non intersection constraints between all pairs of objects
+ */
+template <typename V, typename D>
+class NoOverlapConstraint2D: public Constraint<V, D>
+{
+    protected:
+        D w, h;
+        D width;
+
+    public:
+        NoOverlapConstraint2D(const std::unordered_set<V>& _variables, D _w, D _h, D _width):
+            w{_w}, h{_h}, width{_width}
+        {
+           this->variables = _variables;
+        };
+
+        virtual bool satisfied(const std::unordered_map<V, D>& assignment) const override
+        {
+            std::vector<D> placed;
+            for (auto& variable: this->variables)
+            {
+                auto it = assignment.find(variable);
+                if (it != assignment.end()) placed.push_back(it->second);
+            }
+
+            for (size_t i = 0; i < placed.size(); ++i)
+            {
+                for (size_t j = i + 1; j < placed.size(); ++j)
+                {
+                    auto dx = abs((int) (placed[i] % width) - (int) (placed[j] % width));
+                    auto dy = abs((int) (placed[i] / width) - (int) (placed[j] / width));
+                    if (dx <= w && dy <= h)
+                        return false;
+                }
+            }
+            return true;
+        };
+
+        virtual std::unique_ptr<IndexedConstraint> bind(const std::unordered_map<V, int>& ids, const std::vector<V>& names) const override
+        {
+            std::vector<int> variables;
+            for (auto& variable: this->variables) variables.push_back(ids.at(variable));
+            std::vector<int> ws(variables.size(), w);
+            std::vector<int> hs(variables.size(), h);
+            return std::unique_ptr<IndexedConstraint>(new IndexedNoOverlapConstraint(variables, ws, hs, width));
+        };
 };
 
 /**
@@ -234,18 +355,56 @@ class InsidePixelArrayConstraint2D: public Constraint<V, D>
            
             return true;
         };
+
+        virtual std::unique_ptr<IndexedConstraint> bind(const std::unordered_map<V, int>& ids, const std::vector<V>& names) const override;
+};
+
+/**
+ * Indexed form of InsidePixelArrayConstraint2D
+ */
+class IndexedInsidePixelArrayConstraint2D: public IndexedConstraint
+{
+    protected:
+        int v0;
+        int w, h;
+        const PixelArray& arr;
+        Rect rect;
+
+    public:
+        IndexedInsidePixelArrayConstraint2D(int _v0, int _w, int _h, const PixelArray& _arr, Rect _rect):
+            v0{_v0}, w{_w}, h{_h}, arr{_arr}, rect{_rect}
+        {
+            this->variables = {v0, };
+        };
+
+        virtual bool satisfied(const int* values) const override
+        {
+            if (values[v0] == CSP_UNASSIGNED)
+                return true;
+
+            auto _x = rect.x + values[v0] % rect.w;
+            auto _y = rect.y + values[v0] / rect.w;
+            return arr.contains((Pixel){_x, _y}) && arr.contains((Pixel){_x + w, _y}) &&
+                arr.contains((Pixel){_x, _y + h}) && arr.contains((Pixel){_x + w, _y + h});
+        };
+};
+
+template <typename V, typename D>
+std::unique_ptr<IndexedConstraint> InsidePixelArrayConstraint2D<V, D>::bind(const std::unordered_map<V, int>& ids, const std::vector<V>& names) const
+{
+    return std::unique_ptr<IndexedConstraint>(new IndexedInsidePixelArrayConstraint2D(ids.at(v0), w, h, arr, rect));
 };
 
 
 /**
  * Create hill inside rect and fill array with pixels
  */
-inline void CreateHill(const Rect& rect, PixelArray& arr, double sy, double ey)
+inline void CreateHill(const Rect& rect, PixelArray& arr, Random& rng, double sy, double ey, double scale = 1.0)
 {
     double sx = rect.x;
-    double cx = rect.x + (int)(rect.w / 4) + (rand() % (int)(rect.w / 4));
+    double cx = rect.x + (int)(rect.w / 4) + (rng() % (int)(rect.w / 4));
     double ex = rect.x + rect.w;
-    double cy = std::min(sy, ey) - 20 - (rand() % 30);
+    double cy = std::min(sy, ey) - Scaled(20, scale) - (rng() % Scaled(30, scale));
 
     std::vector<double> X = {sx, cx, ex};
     std::vector<double> Y = {sy, cy, ey};
@@ -268,12 +427,12 @@ inline void CreateHill(const Rect& rect, PixelArray& arr, double sy, double ey)
 /**
  * Create hole inside rect and fill array with pixels
  */
-inline void CreateHole(const Rect& rect, PixelArray& arr, double sy, double ey)
+inline void CreateHole(const Rect& rect, PixelArray& arr, Random& rng, double sy, double ey, double scale = 1.0)
 {
     double sx = rect.x;
-    double cx = rect.x + (int)(rect.w / 4) + (rand() % (int)(rect.w / 4));
+    double cx = rect.x + (int)(rect.w / 4) + (rng() % (int)(rect.w / 4));
     double ex = rect.x + rect.w;
-    double cy = std::max(sy, ey) + 8 + (rand() % 30);
+    double cy = std::max(sy, ey) + Scaled(8, scale) + (rng() % Scaled(30, scale));
 
     std::vector<double> X = {sx, cx, ex};
     std::vector<double> Y = {sy, cy, ey};
@@ -296,19 +455,19 @@ inline void CreateHole(const Rect& rect, PixelArray& arr, double sy, double ey)
 /**
  * Create surface cliff on right or left side of surface part identified by pixels s and e
  */
-inline void CreateCliff(const Rect& rect, PixelArray& arr, Pixel s, Pixel e)
+inline void CreateCliff(const Rect& rect, PixelArray& arr, Random& rng, Pixel s, Pixel e)
 {
     std::vector<double> X;
     std::vector<double> Y;
     if (s.y < e.y) // RIGHT
     {
         X = {(double)s.x, (double)rect.x + rect.w * 0.75, (double)rect.x + rect.w, (double)s.x};
-        Y = {(double)s.y, (double)rect.y, (double) rect.y + rand() % (int)(rect.w * 0.3), (double)e.y};
+        Y = {(double)s.y, (double)rect.y, (double) rect.y + rng() % (int)(rect.w * 0.3), (double)e.y};
     }
     else // LEFT
     {
         X = {(double)e.x, (double)rect.x + rect.w * 0.25, (double)rect.x, (double)e.x};
-        Y = {(double)e.y, (double)rect.y, (double) rect.y + rand() % (int)(rect.w * 0.3), (double)s.y};
+        Y = {(double)e.y, (double)rect.y, (double) rect.y + rng() % (int)(rect.w * 0.3), (double)s.y};
     }
 
     std::vector<double> T { 0.0 };
@@ -340,15 +499,15 @@ inline void CreateCliff(const Rect& rect, PixelArray& arr, Pixel s, Pixel e)
 /*
  * Create surface transition from one surface part to another
  */
-inline void CreateTransition(const Rect& rect, PixelArray& arr, Pixel p)
+inline void CreateTransition(const Rect& rect, PixelArray& arr, Random& rng, Pixel p)
 {
-    std::vector<double> X {(double)rect.x, (double)rect.x + (double)rect.w / 4 + (rand() % (int)(rect.w / 2)), (double)rect.x + rect.w};
+    std::vector<double> X {(double)rect.x, (double)rect.x + (double)rect.w / 4 + (rng() % std::max(1, rect.w / 2)), (double)rect.x + rect.w};
     std::vector<double> Y;
 
     double h = abs(rect.y - p.y);
 
     int y_offset = 0 ;
-    if (h > 2) y_offset = rand() % (int)(h / 2);
+    if (h > 2) y_offset = rng() % (int)(h / 2);
 
     if (rect.x == p.x) // LEFT
         Y = {(double)p.y, (double)rect.y + (h / 4) + y_offset, (double)rect.y}; 
@@ -370,7 +529,7 @@ inline void CreateTransition(const Rect& rect, PixelArray& arr, Pixel p)
 /*
  * Create island terrain
  */
-inline void CreateIsland(const Rect& rect, PixelArray& arr, int type)
+inline void CreateIsland(const Rect& rect, PixelArray& arr, Random& rng, int type, double scale = 1.0)
 {
     std::vector<double> X; 
     std::vector<double> Y;
@@ -380,8 +539,10 @@ inline void CreateIsland(const Rect& rect, PixelArray& arr, int type)
     auto quater_y = rect.y + rect.h / 3;
     auto full_y = rect.y + rect.h;
 
-    X = {(double)half_x, (double)rect.x + rect.w, (double)half_x + ((rand() % 11) - 5), (double)rect.x, (double)half_x};
-    Y = {(double)full_y, (double)quater_y + ((rand() % 5) - 3), (double) quater_y + ((rand() % 5) - 3), (double)quater_y + ((rand() % 5) - 3), (double)full_y};
+    auto dx = [=, &rng](){ return (double)((rng() % Scaled(11, scale)) - Scaled(5, scale)); };
+    auto dy = [=, &rng](){ return (double)((rng() % Scaled(5, scale)) - Scaled(3, scale)); };
+    X = {(double)half_x, (double)rect.x + rect.w, (double)half_x + dx(), (double)rect.x, (double)half_x};
+    Y = {(double)full_y, (double)quater_y + dy(), (double) quater_y + dy(), (double)quater_y + dy(), (double)full_y};
 
     std::vector<double> T { 0.0 };
     for(auto i=1; i < (int)X.size(); i++)
@@ -560,7 +721,8 @@ namespace Chasm
             std::unordered_set<Pixel, PixelHash, PixelEqual>& walls,
             std::unordered_set<Pixel, PixelHash, PixelEqual>& acids,
             std::unordered_set<Pixel, PixelHash, PixelEqual>& points,
-            std::unordered_map<Pixel, std::unordered_set<Pixel, PixelHash, PixelEqual>, PixelHash, PixelEqual>& visited_points
+            std::unordered_map<Pixel, std::unordered_set<Pixel, PixelHash, PixelEqual>, PixelHash, PixelEqual>& visited_points,
+            Random& rng
     ){
         std::vector<Pixel> acid_insert;
         std::vector<Pixel> acid_removal;
@@ -608,7 +770,7 @@ namespace Chasm
                 if (p_v.y > 0) for (auto i = 0; i < p_v.y; ++i) dirs.push_back(Chasm::Direction::TOP);
                 if (p_v.y < 0) for (auto i = 0; i < -p_v.y; ++i) dirs.push_back(Chasm::Direction::BOTTOM);
 
-                auto direction = dirs[rand() % dirs.size()];
+                auto direction = dirs[rng() % dirs.size()];
                 Pixel nb_p {0, 0};
 
                 // CHOOSE VALID DIRECTION
@@ -667,10 +829,10 @@ namespace Chasm
     };
 };
 
-inline void CreateChasm(const Rect& rect, PixelArray& arr, Map& map)
+inline void CreateChasm(const Rect& rect, PixelArray& arr, Random& rng, Map& map)
 {
     auto smooth_steps = 5;
-    auto points_count = 4 + rand() % 4;
+    auto points_count = 4 + rng() % 4;
 
     std::unordered_map<Pixel, std::unordered_set<Pixel, PixelHash, PixelEqual>, PixelHash, PixelEqual> visited_points;
     std::unordered_set<Pixel, PixelHash, PixelEqual> walls;
@@ -690,8 +852,8 @@ inline void CreateChasm(const Rect& rect, PixelArray& arr, Map& map)
 
     for (auto _ = 0; _ < points_count; ++_)
         points.insert({
-            rect.x + (rand() % (rect.w - 1)), 
-            rect.y + rect.h / 2 + (rand() % (int)((rect.h / 2) - 1))
+            rect.x + (rng() % (rect.w - 1)), 
+            rect.y + rect.h / 2 + (rng() % (int)((rect.h / 2) - 1))
         });
 
     // SPAWN ACID FROM TOP
@@ -709,7 +871,7 @@ inline void CreateChasm(const Rect& rect, PixelArray& arr, Map& map)
     spawn_acid();
     while (acids.size() > 0)
     {
-        Chasm::Step(rect, walls, acids, points, visited_points);
+        Chasm::Step(rect, walls, acids, points, visited_points, rng);
     }
 
     // PREPARE FOR SMOOTHSTEP 
@@ -854,7 +1016,7 @@ namespace Liquid
  * Create water
  * It will create water count lines at lowest point available inside rect with start from s
  */
-inline auto CreateLiquid(const Rect& rect, PixelArray& arr, Pixel s, int count, Map& map, unsigned long WALL_MASK, bool wall_is_empty)
+inline auto CreateLiquid(const Rect& rect, PixelArray& arr, Random& rng, Pixel s, int count, Map& map, unsigned long WALL_MASK, bool wall_is_empty)
 {
 
     auto encode_coords = [=](int x, int y) 
@@ -907,7 +1069,8 @@ namespace SplineAgent
             std::unordered_set<Pixel, PixelHash, PixelEqual>& points,
             Pixel sp,
             std::function<int(float, float)> stroke,
-            float curvness
+            float curvness,
+            Random& rng
     ){
         if (points.size() < 3)
             return {};
@@ -968,7 +1131,7 @@ namespace SplineAgent
                 if (p_v.x < 0) for (auto i = 0; i < -p_v.x; ++i) dirs.push_back(Chasm::Direction::RIGHT);
                 if (p_v.y > 0) for (auto i = 0; i < p_v.y; ++i) dirs.push_back(Chasm::Direction::TOP);
                 if (p_v.y < 0) for (auto i = 0; i < -p_v.y; ++i) dirs.push_back(Chasm::Direction::BOTTOM);
-                auto direction = dirs[rand() % dirs.size()];
+                auto direction = dirs[rng() % dirs.size()];
 
                 // CHOOSE VALID DIRECTION
                 switch (direction)
@@ -1011,25 +1174,25 @@ namespace SplineAgent
 };
 
 
-inline auto CreateCave(const Rect& rect, PixelArray& arr, Pixel sp, float points_size, float stroke_size, float curvness)
+inline auto CreateCave(const Rect& rect, PixelArray& arr, Random& rng, Pixel sp, float points_size, float stroke_size, float curvness, double scale = 1.0)
 {
     // MINIMAL CAVE SIZE
-    if (rect.w < 50 || rect.h < 50)
+    if (rect.w < Scaled(50, scale) || rect.h < Scaled(50, scale))
         return;
 
-    auto points_count = 4 + rand() % (2 + (int)(8 * points_size));
+    auto points_count = 4 + rng() % (2 + (int)(8 * points_size));
     std::unordered_set<Pixel, PixelHash, PixelEqual> points;
 
     // SPAWN POINTS 
     while (points_count > 0)
     {
-        auto x = rect.x + 10 + rand() % (rect.w - 20);
-        auto y = rect.y + 10 + rand() % (rect.h - 20);
+        auto x = rect.x + Scaled(10, scale) + rng() % (rect.w - Scaled(20, scale));
+        auto y = rect.y + Scaled(10, scale) + rng() % (rect.h - Scaled(20, scale));
         auto check = true;
         for (auto p: points)
         {
             auto d = sqrt(pow(p.x - x, 2) + pow(p.y - y, 2));
-            if (d < 5)
+            if (d < 5 * scale)
             {
                 check = false; 
                 break;
@@ -1043,7 +1206,7 @@ inline auto CreateCave(const Rect& rect, PixelArray& arr, Pixel sp, float points
     }
 
     // HOW MANY TIMES TO RUN 
-    auto cave = SplineAgent::Paint(rect, points, sp, [=](float, float){ return  2 + rand() % (2 + (int)(20 * stroke_size));}, curvness );
+    auto cave = SplineAgent::Paint(rect, points, sp, [=, &rng](float, float){ return Scaled(2, scale) + rng() % Scaled(2 + (int)(20 * stroke_size), scale);}, curvness, rng);
 
     // PREPARE FOR SMOOTHSTEP 
     std::vector<int> grid;
@@ -1072,10 +1235,10 @@ inline auto CreateCave(const Rect& rect, PixelArray& arr, Pixel sp, float points
     }
 };
 
-inline auto CreateMaterial(const Rect& rect, PixelArray& arr, float stroke_size, float curvness, Map& map, unsigned long A_STRUCTURES, bool can_be_empty)
+inline auto CreateMaterial(const Rect& rect, PixelArray& arr, Random& rng, float stroke_size, float curvness, double scale = 1.0)
 {
     // MINIMAL MATERIAL SIZE
-    if (rect.w < 20 || rect.h < 20)
+    if (rect.w < Scaled(20, scale) || rect.h < Scaled(20, scale))
         return;
 
     auto points_count = 3;
@@ -1084,8 +1247,8 @@ inline auto CreateMaterial(const Rect& rect, PixelArray& arr, float stroke_size,
     // SPAWN POINTS 
     while (points_count > 0)
     {
-        auto x = rect.x + 6 + rand() % (rect.w - 12);
-        auto y = rect.y + 6 + rand() % (rect.h - 12);
+        auto x = rect.x + Scaled(6, scale) + rng() % (rect.w - Scaled(12, scale));
+        auto y = rect.y + Scaled(6, scale) + rng() % (rect.h - Scaled(12, scale));
         auto check = true;
         for (auto p: points)
         {
@@ -1117,22 +1280,15 @@ inline auto CreateMaterial(const Rect& rect, PixelArray& arr, float stroke_size,
                 sp = p;
         }
     }
-    auto stroke = (3 + rand() % 4) * stroke_size;
-    auto material = SplineAgent::Paint(rect, points, sp, [=](float t, float t_size){ return 1 + stroke * ((t_size - t - 1) / t_size); }, curvness);
+    auto stroke = (3 + rng() % 4) * stroke_size * scale;
+    auto material = SplineAgent::Paint(rect, points, sp, [=](float t, float t_size){ return 1 + stroke * ((t_size - t - 1) / t_size); }, curvness, rng);
 
     // PUSH RESULTS
     for (auto p: material) 
-    {
-        auto meta = map.GetMetadata(p);
-        if ((can_be_empty && meta.generated_structure == nullptr) || 
-            (meta.generated_structure != nullptr && meta.generated_structure->GetType() & A_STRUCTURES))
-        {
-            arr.add(p);
-        }
-    }
+        arr.add(p);
 };
 
-inline void CreateOre(const Rect& rect, PixelArray& arr, int min_size, int max_size, Map& map, unsigned long A_STRUCTURES, bool can_be_empty)
+inline void CreateOre(const Rect& rect, PixelArray& arr, Random& rng, int min_size, int max_size)
 {
     // PREPARE GRID
     std::vector<int> grid;
@@ -1144,7 +1300,7 @@ inline void CreateOre(const Rect& rect, PixelArray& arr, int min_size, int max_s
     {
         for (auto x = rect.x + 1; x <= rect.x + rect.w - 1; ++x)
             for (auto y = rect.y + 1; y <= rect.y + rect.h - 1; ++y)
-                if ((rand() % 100) > 20) 
+                if ((rng() % 100) > 20) 
                     grid[(y - rect.y) * rect.w + (x - rect.x)] = 1;
                 else
                     grid[(y - rect.y) * rect.w + (x - rect.x)] = 0;
@@ -1166,18 +1322,28 @@ inline void CreateOre(const Rect& rect, PixelArray& arr, int min_size, int max_s
             auto x = _x - rect.x;
             auto y = _y - rect.y;
             if (grid.at(y * rect.w + x) == 1)
-            {
-                auto meta = map.GetMetadata({_x, _y});
-                if ((can_be_empty && meta.generated_structure == nullptr) || 
-                    (meta.generated_structure != nullptr && meta.generated_structure->GetType() & A_STRUCTURES))
-                {
-                    arr.add({_x, _y});
-                }
-            }
+                arr.add({_x, _y});
         }
     }
 };
 
+/**
+ * Add pixels of shape accepted by current map, shapes are accepted at commit
+ * so later shapes overwrite earlier ones
+ */
+inline void AddAccepted(const PixelArray& shape, PixelArray& arr, Map& map, unsigned long A_STRUCTURES, bool can_be_empty)
+{
+    auto* area = ActiveWriteArea();
+    for (auto p: shape)
+    {
+        // PIXELS OUTSIDE OF DECLARED AREA ARE ACCEPTED LATER ON FLUSH
+        if (area != nullptr && !area->Contains(p))
+            area->Defer(arr, p, A_STRUCTURES, can_be_empty);
+        else if (Accepts(map.GetMetadata(p), A_STRUCTURES, can_be_empty))
+            arr.add(p);
+    }
+};
+
 inline auto DomainInsidePixelArray(const Rect& rect, const PixelArray& arr, int step = 1)
 {
     std::unordered_set<int> domain;
@@ -1226,6 +1392,98 @@ inline void UpdateSurfaceParts(PixelArray& arr, Map& map)
     }
 };
 
+/**
+ * Candidates are drawn for whole map first so their positions do not depend on region of interest.
+ * Shapes of candidates overlapping it are built in parallel into scratch arrays, each from own
+ * stream, and committed to map in candidate order
+ */
+template <typename D, typename B, typename C>
+inline void PlaceInRegion(Map& map, Random& rng, int count, D draw, B build, C commit)
+{
+    auto roi = map.RegionOfInterest();
+    std::vector<Rect> candidates;
+    candidates.reserve(count);
+    for (auto i = 0; i < count; ++i)
+        candidates.push_back(draw());
+
+    std::vector<int> selected;
+    for (auto i = 0; i < count; ++i)
+    {
+        if (RectsOverlap(candidates[i], roi))
+            selected.push_back(i);
+    }
+
+    auto tasks = rng.Split();
+    std::vector<PixelArray> shapes(selected.size());
+    SharedThreadPool().ParallelFor(selected.size(), [&](int n)
+    {
+        if (map.ShouldForceStop())
+            return;
+
+        auto i = selected[n];
+        auto task = tasks.Stream(i);
+        build(candidates[i], shapes[n], task);
+    });
+
+    if (map.ShouldForceStop())
+        return;
+
+    for (auto n = 0; n < (int)selected.size(); ++n)
+        commit(candidates[selected[n]], shapes[n]);
+};
+
+/**
+ * Placement of count candidates accepted by current map. Candidates are drawn in batches, shapes
+ * of accepted ones are built in parallel and committed in draw order with acceptance checked
+ * again, so result is the same as placing candidates one by one
+ */
+template <typename D, typename A, typename B, typename C>
+inline void PlaceBatched(Map& map, Random& rng, int count, D draw, A accept, B build, C commit)
+{
+    const int BATCH_SIZE = 64;
+    auto draws = rng.Split();
+    auto tasks = rng.Split();
+    auto index = 0;
+
+    while (!map.ShouldForceStop() && count > 0)
+    {
+        auto size = std::min(BATCH_SIZE, count);
+        std::vector<Rect> candidates;
+        std::vector<char> built;
+        for (auto n = 0; n < size; ++n)
+        {
+            candidates.push_back(draw(draws));
+            built.push_back(accept(candidates.back()));
+        }
+
+        std::vector<PixelArray> shapes(size);
+        SharedThreadPool().ParallelFor(size, [&](int n)
+        {
+            if (!built[n] || map.ShouldForceStop())
+                return;
+
+            auto task = tasks.Stream(index + n);
+            build(candidates[n], shapes[n], task);
+        });
+
+        for (auto n = 0; n < size && count > 0 && !map.ShouldForceStop(); ++n)
+        {
+            if (!accept(candidates[n]))
+                continue;
+
+            // ACCEPTED ONLY AFTER EARLIER COMMITS OF THIS BATCH
+            if (!built[n])
+            {
+                auto task = tasks.Stream(index + n);
+                build(candidates[n], shapes[n], task);
+            }
+            commit(candidates[n], shapes[n]);
+            count -= 1;
+        }
+        index += size;
+    }
+};
+
 
 extern "C"
 {
@@ -1260,10 +1518,11 @@ EXPORT inline void DefineBiomes(Map& map)
 
     auto width = map.Width();
     auto height = map.Height();
-    auto ocean_width = 250;
-    auto ocean_desert_width = 100; 
-    auto tundra_width = 500;
-    auto jungle_width = 500;
+    auto scale = map.Scale();
+    auto ocean_width = Scaled(250, scale);
+    auto ocean_desert_width = Scaled(100, scale); 
+    auto tundra_width = Scaled(500, scale);
+    auto jungle_width = Scaled(500, scale);
     auto& Surface = map.Surface();
     auto surface_rect = Surface.bbox();
     auto& Cavern = map.Cavern();
@@ -1286,7 +1545,7 @@ EXPORT inline void DefineBiomes(Map& map)
     std::unordered_set<std::string> variables {"jungle", "tundra"};
     
     // DEFINITION OF DOMAIN
-    auto domain = Domain(ocean_width + ocean_desert_width + 50, width - (2 * ocean_width + 2 * ocean_desert_width) - 50, 50);
+    auto domain = Domain(ocean_width + ocean_desert_width + Scaled(50, scale), width - (2 * ocean_width + 2 * ocean_desert_width) - Scaled(50, scale), Scaled(50, scale));
     
     // DEFINITION OF DOMAIN FOR EACH VARIABLE
     std::unordered_map<std::string, std::unordered_set<int>> domains;
@@ -1303,6 +1562,7 @@ EXPORT inline void DefineBiomes(Map& map)
     // DEFINITION OF SOLVER
     CSPSolver<std::string, int> solver {variables, domains};
     for (auto& c: constraints) { solver.add_constraint(c); }
+    solver.core.arc_consistency = true;
 
     // SEARCH FOR RESULT
     auto result = solver.backtracking_search({}, [&](){ return map.ShouldForceStop(); });
@@ -1356,28 +1616,66 @@ EXPORT inline void DefineBiomes(Map& map)
     }
 };
 
+/**
+ * Minimum distances between hills, holes and islands, drawn from rng always in same order
+ */
+inline void HillsHolesIslandsDistances(
+    const std::unordered_set<std::string>& hills, const std::unordered_set<std::string>& holes, const std::unordered_set<std::string>& islands,
+    double scale, Random& rng, const std::function<void(const std::string&, const std::string&, int)>& add)
+{
+    int hill_width = Scaled(80, scale);
+    int hole_width = Scaled(80, scale);
+    int island_width = Scaled(120, scale);
+
+    ForEach<std::string>(holes, hills, [&](std::string v0, std::string v1){
+        int min_d = Scaled(20, scale) + rng() % Scaled(80, scale);
+        add(v0, v1, min_d + std::max(hill_width, hole_width));
+    });
+
+    Between<std::string>(holes, [&](std::string v0, std::string v1){
+        int min_d = Scaled(20, scale) + rng() % Scaled(80, scale);
+        add(v0, v1, min_d + hole_width);
+    });
+
+    Between<std::string>(hills, [&](std::string v0, std::string v1){
+        int min_d = Scaled(20, scale) + rng() % Scaled(80, scale);
+        add(v0, v1, min_d + hill_width);
+    });
+
+    ForEach<std::string>(hills, islands, [&](std::string v0, std::string v1){
+        int min_d = Scaled(20, scale) + rng() % Scaled(80, scale);
+        add(v0, v1, min_d + std::max(hill_width, island_width));
+    });
+
+    Between<std::string>(islands, [&](std::string v0, std::string v1){
+        int min_d = Scaled(20, scale) + rng() % Scaled(80, scale);
+        add(v0, v1, min_d + island_width);
+    });
+};
+
 /*
  * Define minibiomes hill, hole, island
  */ 
 EXPORT inline void DefineHillsHolesIslands(Map& map)
 {
     printf("DefineHillsHolesIslands\n");
+    Random rng {map.Seed(), Streams::DEFINE_HILLS_HOLES_ISLANDS};
 
     int width = map.Width();
+    auto scale = map.Scale();
     
     int hill_count = map.HillsFrequency() * 12;
     int hole_count = map.HolesFrequency() * 10;
     int floating_island_count = map.IslandsFrequency() * 8;
 
-    int ocean_width = 250;
-    int ocean_desert_width = 100;
-    int hill_width = 80;
-    int hole_width = 80;
-    int island_width = 120;
+    int ocean_width = Scaled(250, scale);
+    int ocean_desert_width = Scaled(100, scale);
+    int hill_width = Scaled(80, scale);
+    int hole_width = Scaled(80, scale);
+    int island_width = Scaled(120, scale);
 
     Rect Surface = map.Surface().bbox(); 
 
-    // CSP RELATED
     // DEFINITION OF VARIABLES
     auto hills = CreateVariables("hill", 0, hill_count);
     auto holes = CreateVariables("hole", 0, hole_count);
@@ -1385,87 +1683,185 @@ EXPORT inline void DefineHillsHolesIslands(Map& map)
     auto variables = JoinVariables(hills, JoinVariables(holes, islands));
     
     // DEFINITION OF DOMAIN
-    auto domain = Domain(ocean_width + ocean_desert_width + 50, width - (2 * ocean_width + 2 * ocean_desert_width) - 50, 50);
-    
-    // DEFINITION OF DOMAIN FOR EACH VARIABLE
-    std::unordered_map<std::string, std::unordered_set<int>> domains;
-    for (auto& var: variables) { domains[var] = domain; }
+    auto domain_from = ocean_width + ocean_desert_width + Scaled(50, scale);
+    auto domain_to = width - (2 * ocean_width + 2 * ocean_desert_width) - Scaled(50, scale);
+    auto domain_step = Scaled(50, scale);
+    auto domain = Domain(domain_from, domain_to, domain_step);
+
+    // INDEPENDENTLY SEEDED ATTEMPTS, LOWEST SUCCESSFUL ATTEMPT WINS SO RESULT DEPENDS ONLY ON SEED
+    const int ATTEMPTS = 8;
+    const long ATTEMPT_NODES = 10000;
+    const int SPACING_TRIES = 64;
+    std::unordered_map<std::string, int> result;
+
+    // SPACING SOLVER SAMPLES ARRANGEMENT OF EACH ATTEMPT IN TURN
+    std::vector<std::string> items (variables.begin(), variables.end());
+    std::unordered_map<std::string, int> item_ids;
+    for (auto& item: items) { item_ids[item] = (int) item_ids.size(); }
+
+    auto spacing_of = [&](Random& rng)
+    {
+        SpacingSolver spacing {domain_from, domain_to, domain_step};
+        for (size_t i = 0; i < items.size(); ++i) { spacing.add_item(); }
+        HillsHolesIslandsDistances(hills, holes, islands, scale, rng, [&](const std::string& v0, const std::string& v1, int distance){
+            spacing.add_distance(item_ids[v0], item_ids[v1], distance);
+        });
+        return spacing;
+    };
 
-    // DEFINITION OF CONSTRAINTS
-    std::vector<DistanceConstraint<std::string, int>> constraints;
+    auto placed = false;
+    auto disproved = 0;
+    for (auto attempt = 0; attempt < ATTEMPTS && !placed; ++attempt)
+    {
+        Random rng {map.Seed(), Streams::DEFINE_HILLS_HOLES_ISLANDS, (uint64_t)attempt + 1};
+        auto spacing = spacing_of(rng);
 
-    ForEach<std::string>(holes, hills, [&](std::string v0, std::string v1){
-        int min_d = 20 + rand() % 80;
-        DistanceConstraint<std::string, int> c{v0, v1, min_d + std::max(hill_width, hole_width)};
-        constraints.push_back(std::move(c));
-    });
+        std::vector<int> positions;
+        auto status = spacing.sample(rng, SPACING_TRIES, positions);
+        if (status == SpacingSolver::INFEASIBLE) disproved += 1;
+        if (status != SpacingSolver::PLACED) continue;
 
-    Between<std::string>(holes, [&](std::string v0, std::string v1){
-        int min_d = 20 + rand() % 80;
-        DistanceConstraint<std::string, int> c{v0, v1, min_d + hole_width};
-        constraints.push_back(std::move(c));
-    });
+        for (size_t i = 0; i < items.size(); ++i) { result[items[i]] = positions[i]; }
+#ifdef DEBUG
+        printf("DefineHillsHolesIslands attempt %d of %d placed\n", attempt + 1, ATTEMPTS);
+#endif
+        placed = true;
+    }
 
-    Between<std::string>(hills, [&](std::string v0, std::string v1){
-        int min_d = 20 + rand() % 80;
-        DistanceConstraint<std::string, int> c{v0, v1, min_d + hill_width};
-        constraints.push_back(std::move(c));
-    });
+    // NO ATTEMPT CAN PLACE ALL, ONLY STAGE OUT OF BUDGET USES LARGEST ARRANGEMENT OF ITEMS WHICH FIT
+    if (!placed && disproved == ATTEMPTS)
+    {
+        if (!BudgetExpired())
+        {
+            map.Error("COULD NOT FIND SOLUTION TO HILL, HOLE, ISLAND PLACEMENT");
+            return;
+        }
 
-    ForEach<std::string>(hills, islands, [&](std::string v0, std::string v1){
-        int min_d = 20 + rand() % 80;
-        DistanceConstraint<std::string, int> c{v0, v1, min_d + std::max(hill_width, island_width)};
-        constraints.push_back(std::move(c));
-    });
+        for (auto attempt = 0; attempt < ATTEMPTS; ++attempt)
+        {
+            Random rng {map.Seed(), Streams::DEFINE_HILLS_HOLES_ISLANDS, (uint64_t)attempt + 1};
+            auto spacing = spacing_of(rng);
 
-    Between<std::string>(islands, [&](std::string v0, std::string v1){
-        int min_d = 20 + rand() % 80;
-        DistanceConstraint<std::string, int> c{v0, v1, min_d + island_width};
-        constraints.push_back(std::move(c));
-    });
-    
-    // CREATION OF SOLVER
-    CSPSolver<std::string, int> solver {variables, domains};
+            std::vector<int> positions;
+            if (spacing.sample_most(rng, positions) <= (int) result.size()) continue;
 
-    // REGISTRATION OF CONSTRAINTS
-    for (auto& constraint: constraints) { solver.add_constraint(constraint); }
-    
-    // SEARCH FOR RESULT
-    auto result = solver.backtracking_search({}, [&](){ return map.ShouldForceStop(); });
-    if (map.ShouldForceStop())
-        return;
+            result.clear();
+            for (size_t i = 0; i < items.size(); ++i)
+                if (positions[i] != CSP_UNASSIGNED) result[items[i]] = positions[i];
+        }
 
-    if (result.size() < variables.size())
-    {
-        map.Error("COULD NOT FIND SOLUTION TO HILL, HOLE, ISLAND PLACEMENT");
-        return;
+#ifdef DEBUG
+        printf("DefineHillsHolesIslands is infeasible, placed %zu of %zu\n", result.size(), variables.size());
+#endif
+        map.Degrade(2, "HILLS, HOLES, ISLANDS");
     }
-    else
+
+    // SPACING SOLVER COULD NOT DECIDE, ATTEMPTS ARE SEARCHED BY CSP IN PARALLEL WITH NODE BUDGET
+    else if (!placed)
     {
-        // REUSLT HANDLING
-        for (auto& var: holes)
-        {
-            auto x = result[var];
-            auto& hole = map.DefinedStructure(Structures::HOLE);
-            Rect rect ((int) x - hole_width / 2, Surface.y, hole_width, Surface.h);
-            PixelsOfRect(rect.x, rect.y, rect.w, rect.h, hole);
-        }
-        
-        for (auto& var: hills)
+        std::vector<std::unordered_map<std::string, int>> results(ATTEMPTS);
+        std::atomic<int> winner {ATTEMPTS};
+
+        // ATTEMPTS RUN ON POOL THREADS, BUDGET OF THIS STAGE IS PASSED EXPLICITLY
+        auto* budget = ActiveBudget();
+
+        SharedThreadPool().ParallelFor(ATTEMPTS, [&](int attempt)
         {
-            auto x = result[var];
-            auto& hill = map.DefinedStructure(Structures::HILL);
-            Rect rect ((int) x - hill_width / 2, Surface.y, hill_width, Surface.h);
-            PixelsOfRect(rect.x, rect.y, rect.w, rect.h, hill);
-        }
+            Random rng {map.Seed(), Streams::DEFINE_HILLS_HOLES_ISLANDS, (uint64_t)attempt + 1};
+
+            // DEFINITION OF DOMAIN FOR EACH VARIABLE
+            std::unordered_map<std::string, std::unordered_set<int>> domains;
+            for (auto& var: variables) { domains[var] = domain; }
+
+            // DEFINITION OF CONSTRAINTS
+            std::vector<DistanceConstraint<std::string, int>> constraints;
+            HillsHolesIslandsDistances(hills, holes, islands, scale, rng, [&](const std::string& v0, const std::string& v1, int distance){
+                constraints.emplace_back(v0, v1, distance);
+            });
+            
+            // CREATION OF SOLVER
+            CSPSolver<std::string, int> solver {variables, domains};
+
+            // REGISTRATION OF CONSTRAINTS
+            for (auto& constraint: constraints) { solver.add_constraint(constraint); }
+
+            // DISTANCES ARE CHECKED FROM EXTREMES OF DOMAINS, SO CONSISTENCY BEFORE SEARCH IS CHEAP
+            solver.core.arc_consistency = true;
+            
+            // SEARCH FOR RESULT, ATTEMPTS WHICH CAN NOT WIN ANYMORE ARE CANCELLED
+            long nodes = 0;
+            auto result = solver.backtracking_search({}, [&](){ 
+                return map.ShouldForceStop() || (budget != nullptr && budget->Expired()) || winner < attempt || ++nodes > ATTEMPT_NODES; 
+            });
+            results[attempt] = std::move(result);
+#ifdef DEBUG
+            printf("DefineHillsHolesIslands attempt %d pruned %llu of %llu values before search, %llu during\n", attempt + 1,
+                solver.core.stats.pruned_before_search, solver.core.stats.values, solver.core.stats.pruned - solver.core.stats.pruned_before_search);
+#endif
+            if (results[attempt].size() < variables.size())
+                return;
 
-        for (auto& var: islands)
+            auto current = winner.load();
+            while (attempt < current && !winner.compare_exchange_weak(current, attempt));
+        });
+
+        if (map.ShouldForceStop())
+            return;
+
+#ifdef DEBUG
+        if (winner < ATTEMPTS)
+            printf("DefineHillsHolesIslands attempt %d of %d won\n", winner.load() + 1, ATTEMPTS);
+#endif
+
+        // NO ATTEMPT FINISHED, LARGEST PARTIAL ASSIGNMENT IS STILL CONSISTENT BUT IT IS USED ONLY WHEN
+        // BUDGET RAN OUT, ATTEMPTS STOPPED BY THEIR NODE LIMIT FAIL AS BEFORE
+        auto best = (int) winner.load();
+        if (best == ATTEMPTS)
         {
-            auto x = result[var];
-            auto& island = map.DefinedStructure(Structures::FLOATING_ISLAND);
-            Rect rect ((int) x - island_width / 2, Surface.y - rand() % 40, island_width, 50);
-            PixelsOfRect(rect.x, rect.y, rect.w, rect.h, island);
+            if (!BudgetExpired())
+            {
+                map.Error("COULD NOT FIND SOLUTION TO HILL, HOLE, ISLAND PLACEMENT");
+                return;
+            }
+
+            best = 0;
+            for (auto attempt = 1; attempt < ATTEMPTS; ++attempt)
+                if (results[attempt].size() > results[best].size()) best = attempt;
+
+#ifdef DEBUG
+            printf("DefineHillsHolesIslands out of budget, placed %zu of %zu\n", results[best].size(), variables.size());
+#endif
+            map.Degrade(2, "HILLS, HOLES, ISLANDS");
         }
+        result = std::move(results[best]);
+    }
+
+    // REUSLT HANDLING
+    for (auto& var: holes)
+    {
+        if (result.count(var) == 0) continue;
+        auto x = result[var];
+        auto& hole = map.DefinedStructure(Structures::HOLE);
+        Rect rect ((int) x - hole_width / 2, Surface.y, hole_width, Surface.h);
+        PixelsOfRect(rect.x, rect.y, rect.w, rect.h, hole);
+    }
+    
+    for (auto& var: hills)
+    {
+        if (result.count(var) == 0) continue;
+        auto x = result[var];
+        auto& hill = map.DefinedStructure(Structures::HILL);
+        Rect rect ((int) x - hill_width / 2, Surface.y, hill_width, Surface.h);
+        PixelsOfRect(rect.x, rect.y, rect.w, rect.h, hill);
+    }
+
+    for (auto& var: islands)
+    {
+        if (result.count(var) == 0) continue;
+        auto x = result[var];
+        auto& island = map.DefinedStructure(Structures::FLOATING_ISLAND);
+        Rect rect ((int) x - island_width / 2, Surface.y - rng() % Scaled(40, scale), island_width, Scaled(50, scale));
+        PixelsOfRect(rect.x, rect.y, rect.w, rect.h, island);
     }
 };
 
@@ -1476,9 +1872,10 @@ EXPORT inline void DefineCabins(Map& map)
 {
     printf("DefineCabins\n");
 
+    auto scale = map.Scale();
     int cabin_count = map.CabinsFrequency() * 60;
-    int cabin_width = 80;
-    int cabin_height = 40;
+    int cabin_width = Scaled(80, scale);
+    int cabin_height = Scaled(40, scale);
 
     auto& Underground = map.Underground();
     auto& Cavern = map.Cavern(); 
@@ -1493,18 +1890,15 @@ EXPORT inline void DefineCabins(Map& map)
     auto variables = CreateVariables("cabin", 0, cabin_count); 
 
     // DEFINITION OF UNION DOMAIN
-    auto domain = DomainInsidePixelArray(tundra_rect, tundra, 20);
+    auto domain = DomainInsidePixelArray(tundra_rect, tundra, Scaled(20, scale));
     
     // DEFINITION OF DOMAIN FOR EACH VARIABLE
     std::unordered_map<std::string, std::unordered_set<int>> domains;
     for (auto var: variables) { domains[var] = domain; } 
 
     // DEFINITION OF CONSTRAINTS
-    std::vector<NonIntersectionConstraint2D<std::string, int>> non_intersect_constraints;
-    Between<std::string>(variables, [&](std::string v0, std::string v1){
-        NonIntersectionConstraint2D<std::string, int> c (v0, v1, cabin_width, cabin_height, cabin_width, cabin_height, tundra_rect.w);
-        non_intersect_constraints.push_back(std::move(c));
-    });
+    // CABINS ARE KEPT APART BY ONE CONSTRAINT OVER ALL OF THEM INSTEAD OF CONSTRAINT FOR EACH PAIR
+    NoOverlapConstraint2D<std::string, int> no_overlap_constraint (variables, cabin_width, cabin_height, tundra_rect.w);
 
     std::vector<InsidePixelArrayConstraint2D<std::string, int>> inside_pixelarray_constraints;
     for (auto& var: variables) 
@@ -1517,30 +1911,41 @@ EXPORT inline void DefineCabins(Map& map)
     CSPSolver<std::string, int> solver {variables, domains};
 
     // REGISTRATION OF CONSTRAINTS
-    for (auto& c: non_intersect_constraints) { solver.add_constraint(c); }
+    solver.add_constraint(no_overlap_constraint);
     for (auto& c: inside_pixelarray_constraints) { solver.add_constraint(c); }
 
-    // SEARCH FOR RESULT
-    auto result = solver.backtracking_search({}, [&](){ return map.ShouldForceStop(); });
+    // SEARCH FOR RESULT, WORKERS WITH DIFFERENT ORDERINGS ARE TRIED AT ONCE FOR DENSE PLACEMENTS
+    Random rng {map.Seed(), Streams::DEFINE_CABINS};
+    auto result = solver.portfolio_search({}, [&](){ return map.ShouldForceStop() || BudgetExpired(); }, rng);
+#ifdef DEBUG
+    printf("DefineCabins searched %llu nodes, %llu backtracks, %llu restarts\n", solver.core.stats.nodes, solver.core.stats.backtracks, solver.core.stats.restarts);
+    printf("DefineCabins backjumped %llu times over %llu values, %llu nogoods rejected %llu values\n", solver.core.stats.backjumps, solver.core.stats.skipped, solver.core.stats.nogoods, solver.core.stats.nogood_hits);
+#endif
     if (map.ShouldForceStop())
         return;
 
-    if (result.size() < variables.size())
+    // OUT OF BUDGET, PARTIAL ASSIGNMENT GIVES FEWER CABINS
+    if (result.size() < variables.size() && BudgetExpired())
+    {
+        printf("DefineCabins out of budget, placed %zu of %zu\n", result.size(), variables.size());
+        map.Degrade(2, "CABINS");
+    }
+    else if (result.size() < variables.size())
     {
         map.Error("COULD NOT FIND SOLUTION FOR CABIN PLACEMENT.");
         return;
     }
-    else 
+
+    // RESULT HANDLING
+    for (auto& var: variables) 
     {
-        for (auto& var: variables) 
-        {
-            auto v = result[var];
-            auto x = (int) tundra_rect.x + (v % tundra_rect.w); 
-            auto y = (int) tundra_rect.y + (v / tundra_rect.w);
+        if (result.count(var) == 0) continue;
+        auto v = result[var];
+        auto x = (int) tundra_rect.x + (v % tundra_rect.w); 
+        auto y = (int) tundra_rect.y + (v / tundra_rect.w);
 
-            auto& cabin = map.DefinedStructure(Structures::CABIN); 
-            PixelsOfRect(x, y, cabin_width, cabin_height, cabin);
-        }
+        auto& cabin = map.DefinedStructure(Structures::CABIN); 
+        PixelsOfRect(x, y, cabin_width, cabin_height, cabin);
     }
 };
 
@@ -1551,8 +1956,9 @@ EXPORT inline void DefineCastles(Map& map)
 {
     printf("DefineCastles\n");
 
-    auto castle_width = 250;
-    auto castle_height = 150;
+    auto scale = map.Scale();
+    auto castle_width = Scaled(250, scale);
+    auto castle_height = Scaled(150, scale);
 
     auto& Underground = map.Underground();
     auto& Cavern = map.Cavern(); 
@@ -1570,9 +1976,9 @@ EXPORT inline void DefineCastles(Map& map)
     auto variables = CreateVariables({"forest_castle", "jungle_castle", "tundra_castle"});
 
     // DEFINITION OF UNION DOMAIN
-    auto forest_domain = DomainInsidePixelArray(forest_rect, forest, 10);
-    auto jungle_domain = DomainInsidePixelArray(jungle_rect, jungle, 10);
-    auto tundra_domain = DomainInsidePixelArray(tundra_rect, tundra, 10);
+    auto forest_domain = DomainInsidePixelArray(forest_rect, forest, Scaled(10, scale));
+    auto jungle_domain = DomainInsidePixelArray(jungle_rect, jungle, Scaled(10, scale));
+    auto tundra_domain = DomainInsidePixelArray(tundra_rect, tundra, Scaled(10, scale));
 
     std::unordered_map<std::string, std::unordered_set<int>> domains;
     domains["forest_castle"] = forest_domain;
@@ -1593,30 +1999,47 @@ EXPORT inline void DefineCastles(Map& map)
     solver.add_constraint(c2);
         
     // SEARCH FOR SOLUTION
-    auto result = solver.backtracking_search({}, [&](){ return map.ShouldForceStop(); });
+    auto result = solver.backtracking_search({}, [&](){ return map.ShouldForceStop() || BudgetExpired(); });
+#ifdef DEBUG
+    printf("DefineCastles searched %llu nodes, %llu backtracks\n", solver.core.stats.nodes, solver.core.stats.backtracks);
+    printf("DefineCastles backjumped %llu times over %llu values, %llu nogoods rejected %llu values\n", solver.core.stats.backjumps, solver.core.stats.skipped, solver.core.stats.nogoods, solver.core.stats.nogood_hits);
+#endif
     if (map.ShouldForceStop())
         return;
 
-    if (result.size() < variables.size())
+    // OUT OF BUDGET, PARTIAL ASSIGNMENT GIVES FEWER CASTLES
+    if (result.size() < variables.size() && BudgetExpired())
+    {
+        printf("DefineCastles out of budget, placed %zu of %zu\n", result.size(), variables.size());
+        map.Degrade(2, "CASTLES");
+    }
+    else if (result.size() < variables.size())
     {
         map.Error("COULD NOT FIND SOLUTION FOR CASTLE PLACEMENT.");
         return;
     }
-    else 
+
+    // RESULT HANDLING
+    if (result.count("forest_castle") > 0)
     {
-        // RESULT HANDLING
         auto forest_v = result["forest_castle"];
         auto f_x = forest_rect.x + (forest_v % forest_rect.w);
         auto f_y = forest_rect.y + (forest_v / forest_rect.w);
         auto& forest_castle = map.DefinedStructure(Structures::CASTLE);
         PixelsOfRect(f_x, f_y, castle_width, castle_height, forest_castle);
+    }
 
+    if (result.count("tundra_castle") > 0)
+    {
         auto tundra_v = result["tundra_castle"];
         auto t_x = tundra_rect.x + (tundra_v % tundra_rect.w);
         auto t_y = tundra_rect.y + (tundra_v / tundra_rect.w);
         auto& tundra_castle = map.DefinedStructure(Structures::CASTLE);
         PixelsOfRect(t_x, t_y, castle_width, castle_height, tundra_castle);
+    }
 
+    if (result.count("jungle_castle") > 0)
+    {
         auto jungle_v = result["jungle_castle"];
         auto j_x = jungle_rect.x + (jungle_v % jungle_rect.w);
         auto j_y = jungle_rect.y + (jungle_v / jungle_rect.w);
@@ -1628,17 +2051,19 @@ EXPORT inline void DefineCastles(Map& map)
 EXPORT inline void DefineSurface(Map& map)
 {
     printf("DefineSurface\n");
+    Random rng {map.Seed(), Streams::DEFINE_SURFACE};
 
     auto& Surface = map.Surface();
     auto surface_rect = Surface.bbox();
     auto width = map.Width();
+    auto scale = map.Scale();
 
     // TODO GUI CONTROLS
-    auto left_ocean_width = 250;
-    auto right_ocean_widht = 250;
+    auto left_ocean_width = Scaled(250, scale);
+    auto right_ocean_widht = Scaled(250, scale);
     int surface_parts = 4 + (int)(30 * map.SurfacePartsCount());
     int octaves = 1 + (int)(5 * map.SurfacePartsOctaves());
-    int fq = 60 + (int)(200 * map.SurfacePartsFrequency());
+    int fq = Scaled(60 + (int)(200 * map.SurfacePartsFrequency()), scale);
 
     auto surface_x = left_ocean_width;
     //auto surface_y = surface_rect.y + surface_rect.h;
@@ -1657,8 +2082,8 @@ EXPORT inline void DefineSurface(Map& map)
         tmp_parts = surface_parts - i;
         tmp_avg_part_width = tmp_surface_width / tmp_parts;
 
-        auto w = (int) tmp_avg_part_width / 2 + (rand() % (int)(tmp_avg_part_width / 2));
-        auto h = (int) surface_height / 4 + (rand() % (int)(surface_height / 4));
+        auto w = (int) tmp_avg_part_width / 2 + (rng() % (int)(tmp_avg_part_width / 2));
+        auto h = (int) surface_height / 4 + (rng() % (int)(surface_height / 4));
 
         parts.emplace_back(std::make_pair(w, h)); 
 
@@ -1669,7 +2094,7 @@ EXPORT inline void DefineSurface(Map& map)
     if ( tmp_surface_width > 0)
     {
         auto w = tmp_surface_width; 
-        auto h = (int) surface_height / 4 + (rand() % (int)(surface_height / 3));
+        auto h = (int) surface_height / 4 + (rng() % (int)(surface_height / 3));
         parts.emplace_back(std::make_pair(w, h)); 
     }
 
@@ -1680,15 +2105,15 @@ EXPORT inline void DefineSurface(Map& map)
     tmp_surface_width = surface_width;
     auto ypsilons = std::vector<float>();
 
-    auto nh = (float) rand() / RAND_MAX;
+    auto nh = rng.Uniform();
     for (auto i = 0; i < fq; ++i)
     {
         tmp_parts = fq - i;
         tmp_avg_part_width = tmp_surface_width / tmp_parts;
 
-        auto w = (int) tmp_avg_part_width / 2 + (rand() % (int)(tmp_avg_part_width / 2));
+        auto w = (int) tmp_avg_part_width / 2 + (rng() % (int)(tmp_avg_part_width / 2));
         auto h = nh;
-        nh = (float) rand() / RAND_MAX;
+        nh = rng.Uniform();
 
         for (auto x = 0; x < w; ++x) { ypsilons.emplace_back(cerp(h, nh, (float) x / w)); }
 
@@ -1699,7 +2124,7 @@ EXPORT inline void DefineSurface(Map& map)
     {
         auto w = tmp_surface_width; 
         auto h = nh;
-        nh = (float) rand() / RAND_MAX;
+        nh = rng.Uniform();
         for (auto x = 0; x < w; ++x) { ypsilons.emplace_back(cerp(h, nh, (float) x / w)); }
     }
 
@@ -1735,8 +2160,8 @@ EXPORT inline void DefineSurface(Map& map)
 
             //                                                                                        NOISE WIDTH   CENTER CORECTION 
             //                                                                                                  N   C
-            for (auto _y = surface_rect.y + surface_rect.h; _y > surface_rect.y + surface_rect.h - h - (noise * 8 - 4); --_y) { surface_part.add((Pixel){x, _y}); }
-            surface_part.AddY(surface_rect.y + surface_rect.h - h - (noise * 8 - 4));
+            for (auto _y = surface_rect.y + surface_rect.h; _y > surface_rect.y + surface_rect.h - h - (noise * 8 - 4) * scale; --_y) { surface_part.add((Pixel){x, _y}); }
+            surface_part.AddY(surface_rect.y + surface_rect.h - h - (noise * 8 - 4) * scale);
         }
         tmp_x += w;
         
@@ -1748,6 +2173,7 @@ EXPORT inline void DefineSurface(Map& map)
 EXPORT inline void GenerateOceanLeft(Map& map)
 {
     printf("GenerateOceanLeft\n");
+    Random rng {map.Seed(), Streams::GENERATE_OCEAN_LEFT};
 
     auto* Ocean = map.GetBiome(Biomes::OCEAN_LEFT);
     auto ocean_rect = Ocean->bbox();
@@ -1759,7 +2185,8 @@ EXPORT inline void GenerateOceanLeft(Map& map)
     auto ocean_end_y = part->GetY(part->StartX());
     part = map.GetSurfacePart(ocean_desert_rect.x + ocean_desert_rect.w);
     auto desert_end_y = part->GetY(ocean_desert_rect.x + ocean_desert_rect.w); 
-    auto ocean_sand_thickness = 25;
+    auto scale = map.Scale();
+    auto ocean_sand_thickness = Scaled(25, scale);
 
     auto m_ocean = (float)(ocean_start_y - ocean_end_y) / ocean_rect.w;
     auto m_desert = (float)(ocean_start_y - desert_end_y) / (ocean_rect.w + ocean_desert_rect.w);
@@ -1775,7 +2202,7 @@ EXPORT inline void GenerateOceanLeft(Map& map)
     for (auto x = ocean_rect.x; x <= ocean_rect.x + ocean_rect.w; ++x)
     {
         auto y0 = (int)(ocean_start_y - (x * m_ocean));
-        auto y1 = (int)(ocean_start_y - (x * m_desert) + ocean_sand_thickness + rand() % 5);
+        auto y1 = (int)(ocean_start_y - (x * m_desert) + ocean_sand_thickness + rng() % Scaled(5, scale));
         for (auto y = y0; y <= y1; ++y)
         {
             ocean_sand.add({x, y});
@@ -1788,7 +2215,7 @@ EXPORT inline void GenerateOceanLeft(Map& map)
         part = map.GetSurfacePart(x);
         auto thickness_ratio = (float)1 - ((float)(x - ocean_desert_rect.x) / ocean_desert_rect.w);
         auto y0 = part->GetY(x); 
-        auto y1 = (int)(ocean_start_y - (x * m_desert) + ((ocean_sand_thickness + rand() % 5) * thickness_ratio)); 
+        auto y1 = (int)(ocean_start_y - (x * m_desert) + ((ocean_sand_thickness + rng() % Scaled(5, scale)) * thickness_ratio)); 
         for (auto y = y0; y <= y1; ++y)
         {
             ocean_sand.add({x, y});
@@ -1810,6 +2237,7 @@ EXPORT inline void GenerateOceanLeft(Map& map)
 EXPORT inline void GenerateOceanRight(Map& map)
 {
     printf("GenerateOceanRight\n");
+    Random rng {map.Seed(), Streams::GENERATE_OCEAN_RIGHT};
 
     auto* Ocean = map.GetBiome(Biomes::OCEAN_RIGHT);
     auto ocean_rect = Ocean->bbox();
@@ -1821,7 +2249,8 @@ EXPORT inline void GenerateOceanRight(Map& map)
     auto ocean_end_y = ocean_rect.y + ocean_rect.h;
     part = map.GetSurfacePart(ocean_desert_rect.x);
     auto desert_start_y = part->GetY(ocean_desert_rect.x); 
-    auto ocean_sand_thickness = 25;
+    auto scale = map.Scale();
+    auto ocean_sand_thickness = Scaled(25, scale);
 
     auto m_ocean = (float)(ocean_start_y - ocean_end_y) / ocean_rect.w;
     auto m_desert = (float)(desert_start_y - ocean_end_y) / (ocean_rect.w + ocean_desert_rect.w);
@@ -1837,7 +2266,7 @@ EXPORT inline void GenerateOceanRight(Map& map)
     for (auto x = ocean_rect.x; x <= ocean_rect.x + ocean_rect.w; ++x)
     {
         auto y0 = (int)(ocean_start_y - ((x - ocean_rect.x) * m_ocean));
-        auto y1 = (int)(desert_start_y - ((x - ocean_desert_rect.x) * m_desert) + ocean_sand_thickness + rand() % 5);
+        auto y1 = (int)(desert_start_y - ((x - ocean_desert_rect.x) * m_desert) + ocean_sand_thickness + rng() % Scaled(5, scale));
         for (auto y = y0; y <= y1; ++y)
         {
             ocean_sand.add({x, y});
@@ -1850,7 +2279,7 @@ EXPORT inline void GenerateOceanRight(Map& map)
         part = map.GetSurfacePart(x);
         auto thickness_ratio = (float)(x - ocean_desert_rect.x) / ocean_desert_rect.w;
         auto y0 = part->GetY(x); 
-        auto y1 = (int)(desert_start_y - ((x - ocean_desert_rect.x) * m_desert)) + ((ocean_sand_thickness + rand() % 5) * thickness_ratio); 
+        auto y1 = (int)(desert_start_y - ((x - ocean_desert_rect.x) * m_desert)) + ((ocean_sand_thickness + rng() % Scaled(5, scale)) * thickness_ratio); 
         for (auto y = y0; y <= y1; ++y)
         {
             ocean_sand.add({x, y});
@@ -1872,6 +2301,7 @@ EXPORT inline void GenerateOceanRight(Map& map)
 EXPORT inline void GenerateHills(Map& map)
 {
     printf("GenerateHills\n");
+    Random rng {map.Seed(), Streams::GENERATE_HILLS};
 
     auto hills = map.GetDefinedStructures(Structures::HILL);
     for (auto* ref: hills)
@@ -1889,7 +2319,7 @@ EXPORT inline void GenerateHills(Map& map)
         auto ey = e_part->GetY(ex);
 
         auto& s_hill = map.GeneratedStructure(Structures::HILL);
-        CreateHill(hill_rect, s_hill, sy, ey);
+        CreateHill(hill_rect, s_hill, rng, sy, ey, map.Scale());
 
         UpdateSurfaceParts(s_hill, map);
     }
@@ -1899,6 +2329,7 @@ EXPORT inline void GenerateHills(Map& map)
 EXPORT inline void GenerateHoles(Map& map)
 {
     printf("GenerateHoles\n");
+    Random rng {map.Seed(), Streams::GENERATE_HOLES};
 
     auto holes = map.GetDefinedStructures(Structures::HOLE);
     for (auto* ref: holes)
@@ -1917,13 +2348,11 @@ EXPORT inline void GenerateHoles(Map& map)
 
         for (auto p: hole)
         {
-            auto meta = map.GetMetadata(p);
-            meta.generated_structure = nullptr;
-            map.SetMetadata(p, meta);
+            map.SetGeneratedStructure(p, nullptr);
         }
 
         auto& s_hole = map.GeneratedStructure(Structures::HOLE);
-        CreateHole(hole_rect, s_hole, sy, ey);
+        CreateHole(hole_rect, s_hole, rng, sy, ey, map.Scale());
 
         UpdateSurfaceParts(s_hole, map);
     }
@@ -1932,21 +2361,24 @@ EXPORT inline void GenerateHoles(Map& map)
 EXPORT inline void GenerateIslands(Map& map)
 {
     printf("GenerateIslands\n");
+    Random rng {map.Seed(), Streams::GENERATE_ISLANDS};
 
     auto islands = map.GetDefinedStructures(Structures::FLOATING_ISLAND);
     for (auto* island: islands)
     {
         auto island_rect = island->bbox();
         auto& s_island = map.GeneratedStructure(Structures::FLOATING_ISLAND);
-        CreateIsland(island_rect, s_island, rand() % 2);
+        CreateIsland(island_rect, s_island, rng, rng() % 2, map.Scale());
     }
 };
 
 EXPORT inline void GenerateCliffsTransitions(Map& map)
 {
     printf("GenerateCliffsTransitions\n");
+    Random rng {map.Seed(), Streams::GENERATE_CLIFFS_TRANSITIONS};
 
     auto A_BIOMES = Biomes::FOREST | Biomes::JUNGLE;
+    auto scale = map.Scale();
     auto surface_rect = map.Surface().bbox();
     auto* s_one = map.GetSurfaceBegin();
     auto* s_two = s_one->Next(); 
@@ -1960,11 +2392,11 @@ EXPORT inline void GenerateCliffsTransitions(Map& map)
 
         auto y_diff = abs(p0.y - p1.y);
 
-        if ((y_diff >= 20) && (y_diff <= 30) && (meta0.biome->GetType() & A_BIOMES) && (meta1.biome->GetType() & A_BIOMES)) // CLIFF
+        if ((y_diff >= Scaled(20, scale)) && (y_diff <= Scaled(30, scale)) && (meta0.biome->GetType() & A_BIOMES) && (meta1.biome->GetType() & A_BIOMES)) // CLIFF
         {
             Rect rect;
             rect.h = abs(p0.y - p1.y);
-            rect.w = rect.h + rand() % 20;
+            rect.w = rect.h + rng() % Scaled(20, scale);
             if (p0.y < p1.y) // RIGHT
             {
                 rect.x = p0.x;
@@ -1977,12 +2409,12 @@ EXPORT inline void GenerateCliffsTransitions(Map& map)
             }
 
             auto& cliff = map.GeneratedStructure(Structures::CLIFF);
-            CreateCliff(rect, cliff, p0, p1);
+            CreateCliff(rect, cliff, rng, p0, p1);
         }
         else // TRANSITION
         { 
             Rect rect;
-            rect.w = 4 + y_diff + (rand() % (y_diff + 1));
+            rect.w = Scaled(4, scale) + y_diff + (rng() % (y_diff + 1));
             rect.h = surface_rect.y + surface_rect.h - std::min(p0.y, p1.y); 
 
             Pixel p {0, 0};
@@ -2004,7 +2436,7 @@ EXPORT inline void GenerateCliffsTransitions(Map& map)
             }
 
             auto& transition = map.GeneratedStructure(Structures::TRANSITION);
-            CreateTransition(rect, transition, p); 
+            CreateTransition(rect, transition, rng, p); 
 
             UpdateSurfaceParts(transition, map);
         } 
@@ -2017,6 +2449,7 @@ EXPORT inline void GenerateCliffsTransitions(Map& map)
 EXPORT inline void GenerateChasms(Map& map)
 {
     printf("GenerateChasms\n");
+    Random rng {map.Seed(), Streams::GENERATE_CHASMS};
 
     auto width = map.Width();
     auto Surface = map.Surface();
@@ -2033,14 +2466,15 @@ EXPORT inline void GenerateChasms(Map& map)
     auto ocean_desert_right_rect = ocean_desert_right->bbox();
 
     auto surface_rect = Surface.bbox();
+    auto scale = map.Scale();
     auto chasms_count = 2 + (int)(map.ChasmFrequency() * 15);
-    auto chasm_width = 70;
+    auto chasm_width = Scaled(70, scale);
 
     for (auto c = 0; c < chasms_count; ++c)
     {
-        auto w = chasm_width + (rand() % 41) - 20;
+        auto w = chasm_width + (rng() % Scaled(41, scale)) - Scaled(20, scale);
         auto a_w = width - ocean_left_rect.w - ocean_right_rect.w - ocean_desert_left_rect.w - ocean_desert_right_rect.w - w; 
-        auto x = ocean_left_rect.w + ocean_desert_left_rect.w + (rand() % a_w);
+        auto x = ocean_left_rect.w + ocean_desert_left_rect.w + (rng() % a_w);
 
         Rect chasm_rect = {x, surface_rect.y + surface_rect.h / 3, w, surface_rect.h / 2}; 
 
@@ -2048,15 +2482,13 @@ EXPORT inline void GenerateChasms(Map& map)
         PixelsOfRect(chasm_rect, chasm);
 
         auto& s_chasm = map.GeneratedStructure(Structures::CHASM);
-        CreateChasm(chasm_rect, s_chasm, map);
+        CreateChasm(chasm_rect, s_chasm, rng, map);
 
         for (auto p: chasm)
         {
             if (!s_chasm.contains(p))
             {
-                auto meta = map.GetMetadata(p);
-                meta.generated_structure = nullptr;
-                map.SetMetadata(p, meta);
+                map.SetGeneratedStructure(p, nullptr);
             }
         }
     }
@@ -2065,6 +2497,7 @@ EXPORT inline void GenerateChasms(Map& map)
 EXPORT inline void GenerateLakes(Map& map)
 {
     printf("GenerateLakes\n");
+    Random rng {map.Seed(), Streams::GENERATE_LAKES};
 
     auto& Surface = map.Surface();
     auto surface_rect = Surface.bbox();
@@ -2086,10 +2519,10 @@ EXPORT inline void GenerateLakes(Map& map)
         auto hole_rect = hole->bbox();
         Rect rect {hole_rect.x, surface_rect.y, hole_rect.w, surface_rect.h};
         Pixel s {rect.x + rect.w / 2, rect.y};
-        auto h = 5 + rand() % 21;
+        auto h = Scaled(5, map.Scale()) + rng() % Scaled(21, map.Scale());
 
         auto& water = map.GeneratedStructure(Structures::WATER);
-        CreateLiquid(rect, water, s, h, map, WALL_MASK, false); 
+        CreateLiquid(rect, water, rng, s, h, map, WALL_MASK, false); 
 
         --count;
     }
@@ -2098,6 +2531,7 @@ EXPORT inline void GenerateLakes(Map& map)
 EXPORT inline void GenerateJungleSwamp(Map& map)
 {
     printf("GenerateJungleSwamp\n");
+    Random rng {map.Seed(), Streams::GENERATE_JUNGLE_SWAMP};
 
     auto& Surface = map.Surface();
     auto surface_rect = Surface.bbox();
@@ -2129,13 +2563,13 @@ EXPORT inline void GenerateJungleSwamp(Map& map)
         (x1 >= surface_rect.x && x1 <= surface_rect.x + surface_rect.w))
     {
         Rect rect = {x0, y0, x1 - x0, y1 - y0};
-        int step = rect.w / count;
+        int step = std::max(1, rect.w / count);
 
         auto& water = map.GeneratedStructure(Structures::WATER);
         
         for (auto x = rect.x; x <= rect.x + rect.w; ++x)
             if (((x - rect.x) % step) == 0)
-                CreateLiquid(rect, water, {x, rect.y}, 1, map, WALL_MASK, false); 
+                CreateLiquid(rect, water, rng, {x, rect.y}, 1, map, WALL_MASK, false); 
     }
     else
     {
@@ -2216,7 +2650,9 @@ EXPORT inline void GenerateGrass(Map& map)
 EXPORT inline void GenerateTrees(Map& map)
 {
     printf("GenerateTrees\n");
-    auto count = 100 + (int)(map.TreeFrequency() * 200);
+    Random rng {map.Seed(), Streams::GENERATE_TREES};
+    auto scale = map.Scale();
+    auto count = Scaled(100 + (int)(map.TreeFrequency() * 200), scale);
 
     auto* grass = map.GetGeneratedStructures(Structures::GRASS)[0];
     auto size = grass->size(); 
@@ -2237,10 +2673,10 @@ EXPORT inline void GenerateTrees(Map& map)
         return true;
     };
 
-    while (!map.ShouldForceStop() && count > 0)
+    while (!map.ShouldForceStop() && !BudgetExpired() && count > 0)
     {
-        auto h = 10 + rand() % 10;
-        auto p = *std::next(grass->begin(), rand() % size);
+        auto h = Scaled(10, scale) + rng() % Scaled(10, scale);
+        auto p = *std::next(grass->begin(), rng() % size);
 
         if (check_placement(p, h))
         {
@@ -2249,11 +2685,11 @@ EXPORT inline void GenerateTrees(Map& map)
             while (_h < h + 1)
             {
                 tree.add({p.x, p.y - _h});
-                if ( _h > 5)
+                if ( _h > Scaled(5, scale))
                 {
-                    if ((rand() % 6) == 5)
+                    if ((rng() % 6) == 5)
                     {
-                        if ((rand() % 2) == 1)
+                        if ((rng() % 2) == 1)
                             tree.add({p.x - 1, p.y - _h});
                         else
                             tree.add({p.x + 1, p.y - _h});
@@ -2264,90 +2700,124 @@ EXPORT inline void GenerateTrees(Map& map)
             --count;
         }
     };
+
+    // OUT OF BUDGET, KEEP TREES PLACED SO FAR
+    if (!map.ShouldForceStop() && count > 0)
+    {
+        printf("GenerateTrees out of budget, %d trees left\n", count);
+        map.Degrade(3, "TREES");
+    }
 };
 
 EXPORT inline void GenerateCaves(Map& map)
 {
     printf("GenerateCaves\n");
+    Random rng {map.Seed(), Streams::GENERATE_CAVES};
 
-    auto count = 200 + (int)(1200 * map.CaveFrequency());
+    auto scale = map.Scale();
+    auto count = ScaledCount(200 + (int)(1200 * map.CaveFrequency()), scale);
     auto& Cavern = map.Cavern();
     auto& Underground = map.Underground();
     auto cavern_rect = Cavern.bbox();
     auto underground_rect = Underground.bbox();
 
-    for (auto i = 0; i < count; ++i)
+    auto points_size = map.CavePointsSize();
+    auto stroke_size = map.CaveStrokeSize();
+    auto curvness = map.CaveCurvness();
+
+    PlaceInRegion(map, rng, count, [&]()
+    {
+        auto x = cavern_rect.x + rng() % (cavern_rect.w - Scaled(131, scale));
+        auto y = underground_rect.y + rng() % (underground_rect.h + cavern_rect.h - Scaled(131, scale));
+        auto r = Scaled(50, scale) + rng() % Scaled(80, scale);
+        return Rect {x, y, r, r};
+    }, [&](const Rect& rect, PixelArray& shape, Random& rng)
+    {
+        Pixel sp {rect.x + rect.w / 2, rect.y + rect.h / 2};
+        CreateCave(rect, shape, rng, sp, points_size, stroke_size, curvness, scale);
+    }, [&](const Rect&, const PixelArray& shape)
     {
         auto& cave = map.UndergroundStructure(Structures::CAVE);
-        auto x = cavern_rect.x + rand() % (cavern_rect.w - 131);
-        auto y = underground_rect.y + rand() % (underground_rect.h + cavern_rect.h - 131);
-        auto r = 50 + rand() % 80;
-        auto w = r; 
-        auto h = r;
-        Pixel sp {x + w / 2, y + h / 2};
+        cave.reserve(shape.size());
+        for (auto p: shape)
+            cave.add(p);
+    });
+};
 
-        CreateCave({x, y, w, h}, cave, sp, map.CavePointsSize(), map.CaveStrokeSize(), map.CaveCurvness());
+/**
+ * Caves run concurrently with surface stages, writing them again once both finished
+ * makes caves win over surface structures independently of thread timing
+ */
+EXPORT inline void OverlayCaves(Map& map)
+{
+    printf("OverlayCaves\n");
+    for (auto* cave: map.GetUndergroundStructures(Structures::CAVE))
+    {
+        for (auto p: *cave)
+            map.SetGeneratedStructure(p, cave);
     }
 };
 
 EXPORT inline void GenerateSurfaceMaterials(Map& map)
 {
     printf("GenerateSurfaceMaterials\n");
+    Random rng {map.Seed(), Streams::GENERATE_SURFACE_MATERIALS};
+    auto scale = map.Scale();
 
     auto rect = map.Surface().bbox();
     auto A_STRUCTURES = Structures::SURFACE_PART | Structures::HILL | 
         Structures::HOLE | Structures::TRANSITION | Structures::HOLE |
         Structures::CHASM | Structures::CLIFF;
 
-    auto base_material_count = 100;
-    while (base_material_count > 0)
+    // BOTH CORNERS OF MATERIAL HAVE TO BE INSIDE OF SURFACE
+    auto inside = [&](const Rect& rect)
     {
-        auto w = 20 + rand() % 15;
-        auto h = 20 + rand() % 15;
-        auto x = rect.x + rand() % (rect.w - w);
-        auto y = rect.y + rand() % (rect.h - h);
-        
-        auto meta0 = map.GetMetadata({x, y});
-        auto meta1 = map.GetMetadata({x + w, y + h});
+        auto meta0 = map.GetMetadata({rect.x, rect.y});
+        auto meta1 = map.GetMetadata({rect.x + rect.w, rect.y + rect.h});
 
-        if (meta0.generated_structure != nullptr && meta0.generated_structure->GetType() & A_STRUCTURES && 
-            meta1.generated_structure != nullptr && meta1.generated_structure->GetType() & A_STRUCTURES)
-        {
-            auto& material = map.GeneratedStructure(Structures::S_MATERIAL_BASE);
-            Rect rect {x, y, w, h};
-            CreateMaterial(rect, material, 1.0, 0.2, map, A_STRUCTURES, false);
-            base_material_count -= 1;
-        }
-    }
+        return meta0.generated_structure != nullptr && meta0.generated_structure->GetType() & A_STRUCTURES && 
+               meta1.generated_structure != nullptr && meta1.generated_structure->GetType() & A_STRUCTURES;
+    };
 
-    auto secondary_material_count = 80;
-    while (secondary_material_count > 0)
+    PlaceBatched(map, rng, ScaledCount(100, scale), [&](Random& rng)
     {
-        auto w = 30 + rand() % 15;
-        auto h = 30 + rand() % 15;
-        auto x = rect.x + rand() % (rect.w - w);
-        auto y = rect.y + rand() % (rect.h - h);
-        
-        auto meta0 = map.GetMetadata({x, y});
-        auto meta1 = map.GetMetadata({x + w, y + h});
+        auto w = Scaled(20, scale) + rng() % Scaled(15, scale);
+        auto h = Scaled(20, scale) + rng() % Scaled(15, scale);
+        auto x = rect.x + rng() % (rect.w - w);
+        auto y = rect.y + rng() % (rect.h - h);
+        return Rect {x, y, w, h};
+    }, inside, [&](const Rect& rect, PixelArray& shape, Random& rng)
+    {
+        CreateMaterial(rect, shape, rng, 1.0, 0.2, scale);
+    }, [&](const Rect&, const PixelArray& shape)
+    {
+        auto& material = map.GeneratedStructure(Structures::S_MATERIAL_BASE);
+        AddAccepted(shape, material, map, A_STRUCTURES, false);
+    });
 
-        if (meta0.generated_structure != nullptr && meta0.generated_structure->GetType() & A_STRUCTURES && 
-            meta1.generated_structure != nullptr && meta1.generated_structure->GetType() & A_STRUCTURES)
-        {
-            auto& material = map.GeneratedStructure(Structures::S_MATERIAL_SEC);
-            Rect rect {x, y, w, h};
-            CreateMaterial(rect, material, 1.0, 0.2, map, A_STRUCTURES, false);
-            secondary_material_count -= 1;
-        }
-    }
+    PlaceBatched(map, rng, ScaledCount(80, scale), [&](Random& rng)
+    {
+        auto w = Scaled(30, scale) + rng() % Scaled(15, scale);
+        auto h = Scaled(30, scale) + rng() % Scaled(15, scale);
+        auto x = rect.x + rng() % (rect.w - w);
+        auto y = rect.y + rng() % (rect.h - h);
+        return Rect {x, y, w, h};
+    }, inside, [&](const Rect& rect, PixelArray& shape, Random& rng)
+    {
+        CreateMaterial(rect, shape, rng, 1.0, 0.2, scale);
+    }, [&](const Rect&, const PixelArray& shape)
+    {
+        auto& material = map.GeneratedStructure(Structures::S_MATERIAL_SEC);
+        AddAccepted(shape, material, map, A_STRUCTURES, false);
+    });
 
-    auto grass_count = 1000;
+    auto grass_count = ScaledCount(1000, scale);
     auto& grass = map.GeneratedStructure(Structures::GRASS);
 
     while (grass_count > 0)
     {
-        auto x = rect.x + rand() % rect.w;
-        auto y = rect.y + rand() % rect.h;
+        auto x = rect.x + rng() % rect.w;
+        auto y = rect.y + rng() % rect.h;
         
         auto meta = map.GetMetadata({x, y});
         if (meta.generated_structure != nullptr && meta.generated_structure->GetType() & A_STRUCTURES &&
@@ -2362,11 +2832,13 @@ EXPORT inline void GenerateSurfaceMaterials(Map& map)
 EXPORT inline void GenerateSurfaceOres(Map& map)
 {
     printf("GenerateSurfaceOres\n");
-    auto copper_count = 100 + (int)(300 * map.CopperFrequency());
-    auto copper_size_max = 7 + (int)(22 * map.CopperSize());
+    Random rng {map.Seed(), Streams::GENERATE_SURFACE_ORES};
+    auto scale = map.Scale();
+    auto copper_count = ScaledCount(100 + (int)(300 * map.CopperFrequency()), scale);
+    auto copper_size_max = ScaledCount(7 + (int)(22 * map.CopperSize()), scale);
 
-    auto iron_count = 50 + (int)(200 * map.IronFrequency());
-    auto iron_size_max = 12 + (int)(32 * map.IronSize()); 
+    auto iron_count = ScaledCount(50 + (int)(200 * map.IronFrequency()), scale);
+    auto iron_size_max = ScaledCount(12 + (int)(32 * map.IronSize()), scale); 
 
     auto& Surface = map.Surface();
     auto surface_rect = Surface.bbox();
@@ -2376,247 +2848,283 @@ EXPORT inline void GenerateSurfaceOres(Map& map)
         Structures::GOLD_ORE | Structures::S_MATERIAL_BASE | Structures::S_MATERIAL_SEC | 
         Structures::S_MATERIAL_TER; 
 
-    while (copper_count > 0)
+    // ORE HAS TO START INSIDE OF SURFACE
+    auto inside = [&](const Rect& rect)
     {
-        auto x = surface_rect.x + rand() % (surface_rect.w - 12);
-        auto y = surface_rect.y + rand() % (surface_rect.h - 12);
+        auto meta = map.GetMetadata({rect.x, rect.y}); 
+        return meta.generated_structure != nullptr && meta.generated_structure->GetType() & A_STRUCTURES;
+    };
 
-        Pixel p {x, y};
-        auto meta = map.GetMetadata(p); 
-        if (meta.generated_structure != nullptr && meta.generated_structure->GetType() & A_STRUCTURES)
-        {
-            auto& ore = map.GeneratedStructure(Structures::COPPER_ORE);
-            Rect rect {x, y, 12, 12};
-            CreateOre(rect, ore, 7, copper_size_max, map, A_STRUCTURES, false);
-            copper_count -= 1;
-        }
-    }
+    PlaceBatched(map, rng, copper_count, [&](Random& rng)
+    {
+        auto x = surface_rect.x + rng() % (surface_rect.w - Scaled(12, scale));
+        auto y = surface_rect.y + rng() % (surface_rect.h - Scaled(12, scale));
+        return Rect {x, y, Scaled(12, scale), Scaled(12, scale)};
+    }, inside, [&](const Rect& rect, PixelArray& shape, Random& rng)
+    {
+        CreateOre(rect, shape, rng, ScaledCount(7, scale), copper_size_max);
+    }, [&](const Rect&, const PixelArray& shape)
+    {
+        auto& ore = map.GeneratedStructure(Structures::COPPER_ORE);
+        AddAccepted(shape, ore, map, A_STRUCTURES, false);
+    });
 
-    while (iron_count > 0)
+    PlaceBatched(map, rng, iron_count, [&](Random& rng)
     {
-        auto x = surface_rect.x + rand() % (surface_rect.w - 14);
-        auto y = surface_rect.y + rand() % (surface_rect.h - 14);
- 
-        Pixel p {x, y};
-        auto meta = map.GetMetadata(p); 
-        if (meta.generated_structure != nullptr && meta.generated_structure->GetType() & A_STRUCTURES)
-        {
-            auto& ore = map.GeneratedStructure(Structures::IRON_ORE);
-            Rect rect {x, y, 14, 14};
-            CreateOre(rect, ore, 9, iron_size_max, map, A_STRUCTURES, false);
-            iron_count -= 1;
-        }
-    }
+        auto x = surface_rect.x + rng() % (surface_rect.w - Scaled(14, scale));
+        auto y = surface_rect.y + rng() % (surface_rect.h - Scaled(14, scale));
+        return Rect {x, y, Scaled(14, scale), Scaled(14, scale)};
+    }, inside, [&](const Rect& rect, PixelArray& shape, Random& rng)
+    {
+        CreateOre(rect, shape, rng, ScaledCount(9, scale), iron_size_max);
+    }, [&](const Rect&, const PixelArray& shape)
+    {
+        auto& ore = map.GeneratedStructure(Structures::IRON_ORE);
+        AddAccepted(shape, ore, map, A_STRUCTURES, false);
+    });
 };
 
 EXPORT inline void GenerateUndergroudMaterials(Map& map)
 {
     printf("GenerateUndergroudMaterials\n");
+    Random rng {map.Seed(), Streams::GENERATE_UNDERGROUD_MATERIALS};
+    auto scale = map.Scale();
 
     auto rect = map.Underground().bbox();
 
-    auto base_material_count = 700;
-    while (base_material_count > 0)
+    PlaceInRegion(map, rng, ScaledCount(700, scale), [&]()
+    {
+        auto w = Scaled(20, scale) + rng() % Scaled(20, scale);
+        auto h = Scaled(20, scale) + rng() % Scaled(20, scale);
+        auto x = rect.x + rng() % (rect.w - w);
+        auto y = rect.y + rng() % rect.h;
+        return Rect {x, y, w, h};
+    }, [&](const Rect& rect, PixelArray& shape, Random& rng)
+    {
+        CreateMaterial(rect, shape, rng, 1.0, 0.2, scale);
+    }, [&](const Rect&, const PixelArray& shape)
     {
-        auto w = 20 + rand() % 20;
-        auto h = 20 + rand() % 20;
-        auto x = rect.x + rand() % (rect.w - w);
-        auto y = rect.y + rand() % rect.h;
-
         auto& material = map.UndergroundStructure(Structures::U_MATERIAL_BASE);
-        Rect rect {x, y, w, h};
-        CreateMaterial(rect, material, 1.0, 0.2, map, 0, true);
-        base_material_count -= 1;
-    }
+        AddAccepted(shape, material, map, 0, true);
+    });
 
-    auto secondary_material_count = 100;
-    while (secondary_material_count > 0)
+    PlaceInRegion(map, rng, ScaledCount(100, scale), [&]()
+    {
+        auto w = Scaled(30, scale) + rng() % Scaled(20, scale);
+        auto h = Scaled(30, scale) + rng() % Scaled(20, scale);
+        auto x = rect.x + rng() % (rect.w - w);
+        auto y = rect.y + rng() % rect.h;
+        return Rect {x, y, w, h};
+    }, [&](const Rect& rect, PixelArray& shape, Random& rng)
+    {
+        CreateMaterial(rect, shape, rng, 1.0, 0.2, scale);
+    }, [&](const Rect&, const PixelArray& shape)
     {
-        auto w = 30 + rand() % 20;
-        auto h = 30 + rand() % 20;
-        auto x = rect.x + rand() % (rect.w - w);
-        auto y = rect.y + rand() % rect.h;
-
         auto& material = map.UndergroundStructure(Structures::U_MATERIAL_SEC);
-        Rect rect {x, y, w, h};
-        CreateMaterial(rect, material, 1.0, 0.2, map, 0, true);
-        secondary_material_count -= 1;
-    }
+        AddAccepted(shape, material, map, 0, true);
+    });
 };
 
 EXPORT inline void GenerateUndergroundOres(Map& map)
 {
     printf("GenerateUndergroundOres\n");
+    Random rng {map.Seed(), Streams::GENERATE_UNDERGROUND_ORES};
+    auto scale = map.Scale();
 
-    auto copper_count = 100 + (int)(300 * map.CopperFrequency());
-    auto copper_size_max = 10 + (int)(22 * map.CopperSize());
+    auto copper_count = ScaledCount(100 + (int)(300 * map.CopperFrequency()), scale);
+    auto copper_size_max = ScaledCount(10 + (int)(22 * map.CopperSize()), scale);
 
-    auto iron_count = 200 + (int)(200 * map.IronFrequency());
-    auto iron_size_max = 12 + (int)(32 * map.IronSize()); 
+    auto iron_count = ScaledCount(200 + (int)(200 * map.IronFrequency()), scale);
+    auto iron_size_max = ScaledCount(12 + (int)(32 * map.IronSize()), scale); 
 
-    auto silver_count = 150 + (int)(200 * map.SilverFrequency());
-    auto silver_size_max = 28 + (int)(42 * map.SilverSize());
+    auto silver_count = ScaledCount(150 + (int)(200 * map.SilverFrequency()), scale);
+    auto silver_size_max = ScaledCount(28 + (int)(42 * map.SilverSize()), scale);
 
     auto rect = map.Underground().bbox();
     auto A_STRUCTURES = Structures::U_MATERIAL_BASE | Structures::U_MATERIAL_SEC | Structures::U_MATERIAL_TER; 
 
-    while (copper_count > 0)
+    PlaceInRegion(map, rng, copper_count, [&]()
+    {
+        auto x = rect.x + rng() % (rect.w - Scaled(12, scale));
+        auto y = rect.y + rng() % (rect.h - Scaled(12, scale));
+        return Rect {x, y, Scaled(12, scale), Scaled(12, scale)};
+    }, [&](const Rect& rect, PixelArray& shape, Random& rng)
+    {
+        CreateOre(rect, shape, rng, ScaledCount(7, scale), copper_size_max);
+    }, [&](const Rect&, const PixelArray& shape)
     {
-        auto x = rect.x + rand() % (rect.w - 12);
-        auto y = rect.y + rand() % (rect.h - 12);
-
         auto& ore = map.UndergroundStructure(Structures::COPPER_ORE);
-        Rect rect {x, y, 12, 12};
-        CreateOre(rect, ore, 7, copper_size_max, map, A_STRUCTURES, true);
-        copper_count -= 1;
-    }
+        AddAccepted(shape, ore, map, A_STRUCTURES, true);
+    });
 
-    while (iron_count > 0)
+    PlaceInRegion(map, rng, iron_count, [&]()
+    {
+        auto x = rect.x + rng() % (rect.w - Scaled(14, scale));
+        auto y = rect.y + rng() % (rect.h - Scaled(14, scale));
+        return Rect {x, y, Scaled(14, scale), Scaled(14, scale)};
+    }, [&](const Rect& rect, PixelArray& shape, Random& rng)
+    {
+        CreateOre(rect, shape, rng, ScaledCount(9, scale), iron_size_max);
+    }, [&](const Rect&, const PixelArray& shape)
     {
-        auto x = rect.x + rand() % (rect.w - 14);
-        auto y = rect.y + rand() % (rect.h - 14);
- 
         auto& ore = map.UndergroundStructure(Structures::IRON_ORE);
-        Rect rect {x, y, 14, 14};
-        CreateOre(rect, ore, 9, iron_size_max, map, A_STRUCTURES, true);
-        iron_count -= 1;
-    }
+        AddAccepted(shape, ore, map, A_STRUCTURES, true);
+    });
 
-    while (silver_count > 0)
+    PlaceInRegion(map, rng, silver_count, [&]()
+    {
+        auto x = rect.x + rng() % (rect.w - Scaled(14, scale));
+        auto y = rect.y + rng() % (rect.h - Scaled(14, scale));
+        return Rect {x, y, Scaled(14, scale), Scaled(14, scale)};
+    }, [&](const Rect& rect, PixelArray& shape, Random& rng)
+    {
+        CreateOre(rect, shape, rng, ScaledCount(12, scale), silver_size_max);
+    }, [&](const Rect&, const PixelArray& shape)
     {
-        auto x = rect.x + rand() % (rect.w - 14);
-        auto y = rect.y + rand() % (rect.h - 14);
- 
-        Pixel p {x, y};
         auto& ore = map.UndergroundStructure(Structures::SILVER_ORE);
-        Rect rect {x, y, 14, 14};
-        CreateOre(rect, ore, 12, silver_size_max, map, A_STRUCTURES, true);
-        silver_count -= 1;
-    }
+        AddAccepted(shape, ore, map, A_STRUCTURES, true);
+    });
 };
 
 EXPORT inline void GenerateCavernMaterials(Map& map)
 {
     printf("GenerateCavernMaterials\n");
+    Random rng {map.Seed(), Streams::GENERATE_CAVERN_MATERIALS};
+    auto scale = map.Scale();
 
     auto rect = map.Cavern().bbox();
 
-    auto base_material_count = 1600;
-    while (base_material_count > 0)
+    PlaceInRegion(map, rng, ScaledCount(1600, scale), [&]()
+    {
+        auto w = Scaled(20, scale) + rng() % Scaled(30, scale);
+        auto h = Scaled(20, scale) + rng() % Scaled(30, scale);
+        auto x = rect.x + rng() % (rect.w - w);
+        auto y = (rect.y - Scaled(30, scale)) + rng() % (rect.h - h + Scaled(30, scale));
+        return Rect {x, y, w, h};
+    }, [&](const Rect& rect, PixelArray& shape, Random& rng)
+    {
+        CreateMaterial(rect, shape, rng, 1.0, 0.2, scale);
+    }, [&](const Rect&, const PixelArray& shape)
     {
-        auto w = 20 + rand() % 30;
-        auto h = 20 + rand() % 30;
-        auto x = rect.x + rand() % (rect.w - w);
-        auto y = (rect.y - 30) + rand() % (rect.h - h + 30);
-
         auto& material = map.UndergroundStructure(Structures::C_MATERIAL_BASE);
-        Rect rect {x, y, w, h};
-        CreateMaterial(rect, material, 1.0, 0.2, map, 0, true);
-        base_material_count -= 1;
-    }
+        AddAccepted(shape, material, map, 0, true);
+    });
 
-    auto secondary_material_count = 200;
-    while (secondary_material_count > 0)
+    PlaceInRegion(map, rng, ScaledCount(200, scale), [&]()
+    {
+        auto w = Scaled(20, scale) + rng() % Scaled(40, scale);
+        auto h = Scaled(20, scale) + rng() % Scaled(40, scale);
+        auto x = rect.x + rng() % (rect.w - w);
+        auto y = (rect.y - Scaled(30, scale)) + rng() % (rect.h - h + Scaled(30, scale));
+        return Rect {x, y, w, h};
+    }, [&](const Rect& rect, PixelArray& shape, Random& rng)
+    {
+        CreateMaterial(rect, shape, rng, 1.0, 0.2, scale);
+    }, [&](const Rect&, const PixelArray& shape)
     {
-        auto w = 20 + rand() % 40;
-        auto h = 20 + rand() % 40;
-        auto x = rect.x + rand() % (rect.w - w);
-        auto y = (rect.y - 30) + rand() % (rect.h - h + 30);
-
         auto& material = map.UndergroundStructure(Structures::C_MATERIAL_SEC);
-        Rect rect {x, y, w, h};
-        CreateMaterial(rect, material, 1.0, 0.2, map, 0, true);
-        secondary_material_count -= 1;
-    }
+        AddAccepted(shape, material, map, 0, true);
+    });
 };
 
 EXPORT inline void GenerateCavernOres(Map& map)
 {
     printf("GenerateCavernOres\n");
+    Random rng {map.Seed(), Streams::GENERATE_CAVERN_ORES};
+    auto scale = map.Scale();
 
-    auto copper_count = 100 + (int)(300 * map.CopperFrequency());
-    auto copper_size_max = 10 + (int)(22 * map.CopperSize());
+    auto copper_count = ScaledCount(100 + (int)(300 * map.CopperFrequency()), scale);
+    auto copper_size_max = ScaledCount(10 + (int)(22 * map.CopperSize()), scale);
 
-    auto iron_count = 200 + (int)(200 * map.IronFrequency());
-    auto iron_size_max = 12 + (int)(32 * map.IronSize()); 
+    auto iron_count = ScaledCount(200 + (int)(200 * map.IronFrequency()), scale);
+    auto iron_size_max = ScaledCount(12 + (int)(32 * map.IronSize()), scale); 
 
-    auto silver_count = 300 + (int)(200 * map.SilverFrequency());
-    auto silver_size_max = 18 + (int)(42 * map.SilverSize());
+    auto silver_count = ScaledCount(300 + (int)(200 * map.SilverFrequency()), scale);
+    auto silver_size_max = ScaledCount(18 + (int)(42 * map.SilverSize()), scale);
 
-    auto gold_count = 200 + (int)(200 * map.GoldFrequency());
-    auto gold_size_max = 20 + (int)(52 * map.GoldSize());
+    auto gold_count = ScaledCount(200 + (int)(200 * map.GoldFrequency()), scale);
+    auto gold_size_max = ScaledCount(20 + (int)(52 * map.GoldSize()), scale);
 
     auto rect = map.Cavern().bbox();
     auto A_STRUCTURES = Structures::C_MATERIAL_BASE | Structures::C_MATERIAL_SEC | Structures::C_MATERIAL_TER; 
 
-    while (copper_count > 0)
+    PlaceInRegion(map, rng, copper_count, [&]()
+    {
+        auto x = rect.x + rng() % (rect.w - Scaled(12, scale));
+        auto y = rect.y + rng() % (rect.h - Scaled(12, scale));
+        return Rect {x, y, Scaled(12, scale), Scaled(12, scale)};
+    }, [&](const Rect& rect, PixelArray& shape, Random& rng)
+    {
+        CreateOre(rect, shape, rng, ScaledCount(7, scale), copper_size_max);
+    }, [&](const Rect&, const PixelArray& shape)
     {
-        auto x = rect.x + rand() % (rect.w - 12);
-        auto y = rect.y + rand() % (rect.h - 12);
-
         auto& ore = map.UndergroundStructure(Structures::COPPER_ORE);
-        Rect rect {x, y, 12, 12};
-        CreateOre(rect, ore, 7, copper_size_max, map, A_STRUCTURES, true);
-        copper_count -= 1;
-    }
+        AddAccepted(shape, ore, map, A_STRUCTURES, true);
+    });
 
-    while (iron_count > 0)
+    PlaceInRegion(map, rng, iron_count, [&]()
+    {
+        auto x = rect.x + rng() % (rect.w - Scaled(14, scale));
+        auto y = rect.y + rng() % (rect.h - Scaled(14, scale));
+        return Rect {x, y, Scaled(14, scale), Scaled(14, scale)};
+    }, [&](const Rect& rect, PixelArray& shape, Random& rng)
+    {
+        CreateOre(rect, shape, rng, ScaledCount(9, scale), iron_size_max);
+    }, [&](const Rect&, const PixelArray& shape)
     {
-        auto x = rect.x + rand() % (rect.w - 14);
-        auto y = rect.y + rand() % (rect.h - 14);
- 
         auto& ore = map.UndergroundStructure(Structures::IRON_ORE);
-        Rect rect {x, y, 14, 14};
-        CreateOre(rect, ore, 9, iron_size_max, map, A_STRUCTURES, true);
-        iron_count -= 1;
-    }
+        AddAccepted(shape, ore, map, A_STRUCTURES, true);
+    });
 
-    while (silver_count > 0)
+    PlaceInRegion(map, rng, silver_count, [&]()
+    {
+        auto x = rect.x + rng() % (rect.w - Scaled(16, scale));
+        auto y = rect.y + rng() % (rect.h - Scaled(16, scale));
+        return Rect {x, y, Scaled(16, scale), Scaled(16, scale)};
+    }, [&](const Rect& rect, PixelArray& shape, Random& rng)
+    {
+        CreateOre(rect, shape, rng, ScaledCount(12, scale), silver_size_max);
+    }, [&](const Rect&, const PixelArray& shape)
     {
-        auto x = rect.x + rand() % (rect.w - 16);
-        auto y = rect.y + rand() % (rect.h - 16);
- 
         auto& ore = map.UndergroundStructure(Structures::SILVER_ORE);
-        Rect rect {x, y, 16, 16};
-        CreateOre(rect, ore, 12, silver_size_max, map, A_STRUCTURES, true);
-        silver_count -= 1;
-    }
+        AddAccepted(shape, ore, map, A_STRUCTURES, true);
+    });
 
-    while (gold_count > 0)
+    PlaceInRegion(map, rng, gold_count, [&]()
+    {
+        auto x = rect.x + rng() % (rect.w - Scaled(17, scale));
+        auto y = rect.y + rng() % (rect.h - Scaled(17, scale));
+        return Rect {x, y, Scaled(17, scale), Scaled(17, scale)};
+    }, [&](const Rect& rect, PixelArray& shape, Random& rng)
+    {
+        CreateOre(rect, shape, rng, ScaledCount(14, scale), gold_size_max);
+    }, [&](const Rect&, const PixelArray& shape)
     {
-        auto x = rect.x + rand() % (rect.w - 17);
-        auto y = rect.y + rand() % (rect.h - 17);
- 
         auto& ore = map.UndergroundStructure(Structures::GOLD_ORE);
-        Rect rect {x, y, 17, 17};
-        CreateOre(rect, ore, 14, gold_size_max, map, A_STRUCTURES, true);
-        gold_count -= 1;
-    }
+        AddAccepted(shape, ore, map, A_STRUCTURES, true);
+    });
 };
 
 EXPORT inline void GenerateCaveLakes(Map& map)
 {
     auto cavern_rect = map.Cavern().bbox();
     auto caves = map.GetUndergroundStructures(Structures::CAVE);
-    auto count = (int)(0.2 * caves.size()); 
     auto WALL_MASK = Structures::COPPER_ORE | Structures::IRON_ORE | Structures::SILVER_ORE |
                      Structures::GOLD_ORE | Structures::C_MATERIAL_BASE | Structures::C_MATERIAL_SEC |
                      Structures::C_MATERIAL_TER | Structures::U_MATERIAL_BASE | Structures::U_MATERIAL_SEC |
                      Structures::U_MATERIAL_TER;
 
     std::unordered_set<Structures::GeneratedStructure*> visited_caves;
-    auto it = caves.begin();
-    while (count > 0 && it != caves.end())
+    for (auto* cave: caves)
     {
-        auto* cave = *(it++); 
-        if (visited_caves.count(cave) > 0)
-        {
-            count -= 1;
-            continue;
-        }
-
         auto rect = cave->bbox();
 
+        // EVERY 5TH CAVE BY POSITION, NOT BY ORDER, SO SELECTION DOES NOT DEPEND ON REGION OF INTEREST
+        auto selector = ((unsigned)rect.x * 73856093u) ^ ((unsigned)rect.y * 19349663u);
+        if (selector % 5 != 0 || visited_caves.count(cave) > 0)
+            continue;
+        Random rng {map.Seed(), Streams::GENERATE_CAVE_LAKES, selector};
+
         Pixel p = {-1, -1};
         for (auto x = rect.x; x <= rect.x + rect.w; ++x)
         {
@@ -2651,15 +3159,15 @@ found_first_highest_point:
 
             if ((rect.y + rect.h) < (cavern_rect.y + cavern_rect.h * 0.75))
             {
-                auto drops_count = 20 + rand() % rect.h;
+                auto drops_count = Scaled(20, map.Scale()) + rng() % rect.h;
                 auto& water = map.UndergroundStructure(Structures::WATER);
-                CreateLiquid(rect, water, p, drops_count, map, WALL_MASK, true);
+                CreateLiquid(rect, water, rng, p, drops_count, map, WALL_MASK, true);
             }
             else
             {
-                auto drops_count = 10 + rand() % (int)(rect.h / 2);
+                auto drops_count = 10 + rng() % (int)(rect.h / 2);
                 auto& lava = map.UndergroundStructure(Structures::LAVA);
-                CreateLiquid(rect, lava, p, drops_count, map, WALL_MASK, true);
+                CreateLiquid(rect, lava, rng, p, drops_count, map, WALL_MASK, true);
             } 
 
             // UPDATE VISITED POINTS SO WE DONT CREATE WATER IN THE SAME CAVE
@@ -2669,7 +3177,6 @@ found_first_highest_point:
                 if (meta.generated_structure->GetType() & Structures::CAVE)
                     visited_caves.insert(meta.generated_structure);
             }
-            count -= 1;
         }
     }
 };
@@ -0,0 +1,242 @@
+#ifndef POOL
+#define POOL
+
+#include <functional>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <unordered_map>
+
+/************************************************
+*
+* THREAD POOL
+*
+*************************************************/
+
+/**
+ * Task group of current thread, pool serves groups round robin. Tasks submitted from pool worker
+ * inherit group of task it runs
+ */
+inline unsigned int& TaskGroup()
+{
+    static thread_local unsigned int group = 0;
+    return group;
+};
+
+class ThreadPool
+{
+    protected:
+        std::vector<std::thread> workers;
+        std::unordered_map<unsigned int, std::deque<std::function<void()>>> queues;
+        std::deque<unsigned int> ready;
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool stop {false};
+
+        void Loop()
+        {
+            while (true)
+            {
+                std::function<void()> task;
+                unsigned int group;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.wait(lock, [&](){ return stop || !ready.empty(); });
+                    if (stop && ready.empty())
+                        return;
+
+                    // GROUPS TAKE TURNS SO ONE WORLD CAN NOT STARVE OTHERS
+                    group = ready.front();
+                    ready.pop_front();
+                    auto& queue = queues[group];
+                    task = std::move(queue.front());
+                    queue.pop_front();
+                    if (queue.empty())
+                        queues.erase(group);
+                    else
+                        ready.push_back(group);
+                }
+
+                auto previous = TaskGroup();
+                TaskGroup() = group;
+                task();
+                TaskGroup() = previous;
+            }
+        };
+
+    public:
+        explicit ThreadPool(unsigned int count)
+        {
+            for (auto i = 0u; i < std::max(1u, count); ++i)
+                workers.emplace_back(&ThreadPool::Loop, this);
+        };
+
+        ~ThreadPool()
+        {
+            {
+                const std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+            }
+            cv.notify_all();
+            for (auto& worker: workers)
+                worker.join();
+        };
+
+        auto Size() const { return workers.size(); };
+
+        /**
+         * Queue task in task group of calling thread
+         */
+        void Submit(std::function<void()> task)
+        {
+            {
+                const std::lock_guard<std::mutex> lock(mutex);
+                auto group = TaskGroup();
+                auto& queue = queues[group];
+                if (queue.empty())
+                    ready.push_back(group);
+                queue.push_back(std::move(task));
+            }
+            cv.notify_one();
+        };
+
+        /**
+         * Run body(i) for i in [0, count), calling thread takes part so nested calls
+         * from workers never wait on helpers which did not start yet
+         */
+        template <typename F>
+        void ParallelFor(int count, F body)
+        {
+            if (count <= 0)
+                return;
+
+            struct State
+            {
+                std::atomic<int> next {0};
+                std::mutex mutex;
+                std::condition_variable cv;
+                int running {0};
+                bool closed {false};
+            };
+            auto state = std::make_shared<State>();
+            std::function<void(int)> run = body;
+
+            auto work = [state, count, &run]()
+            {
+                for (auto i = state->next++; i < count; i = state->next++)
+                    run(i);
+            };
+
+            auto helpers = std::min((int)workers.size(), count - 1);
+            for (auto h = 0; h < helpers; ++h)
+            {
+                Submit([state, work]()
+                {
+                    {
+                        const std::lock_guard<std::mutex> lock(state->mutex);
+                        if (state->closed) return;
+                        state->running += 1;
+                    }
+                    work();
+                    const std::lock_guard<std::mutex> lock(state->mutex);
+                    state->running -= 1;
+                    state->cv.notify_all();
+                });
+            }
+
+            work();
+
+            // HELPERS WHICH DID NOT START UNTIL NOW NEVER TOUCH BODY
+            std::unique_lock<std::mutex> lock(state->mutex);
+            state->closed = true;
+            state->cv.wait(lock, [&](){ return state->running == 0; });
+        };
+};
+
+/**
+ * Queue between pipeline stages, producers wait while it is full so slow consumer holds them back
+ */
+template <typename T>
+class BoundedQueue
+{
+    protected:
+        std::deque<T> items;
+        size_t capacity;
+        std::mutex mutex;
+        std::condition_variable not_full;
+        std::condition_variable not_empty;
+        bool closed {false};
+
+    public:
+        explicit BoundedQueue(size_t _capacity): capacity{std::max<size_t>(1, _capacity)} {};
+
+        /**
+         * Wait for free slot, false if queue was closed
+         */
+        bool Push(T item)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            not_full.wait(lock, [&](){ return closed || items.size() < capacity; });
+            if (closed)
+                return false;
+
+            items.push_back(std::move(item));
+            not_empty.notify_one();
+            return true;
+        };
+
+        /**
+         * Wait for item, false when queue is closed and drained
+         */
+        bool Pop(T& item)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            not_empty.wait(lock, [&](){ return closed || !items.empty(); });
+            if (items.empty())
+                return false;
+
+            item = std::move(items.front());
+            items.pop_front();
+            not_full.notify_one();
+            return true;
+        };
+
+        bool TryPop(T& item)
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            if (items.empty())
+                return false;
+
+            item = std::move(items.front());
+            items.pop_front();
+            not_full.notify_one();
+            return true;
+        };
+
+        /**
+         * No more items are pushed, consumers drain what is left
+         */
+        void Close()
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+            not_full.notify_all();
+            not_empty.notify_all();
+        };
+};
+
+/**
+ * Pool shared by all stages, one worker per hardware thread
+ */
+inline ThreadPool& SharedThreadPool()
+{
+    static ThreadPool pool {std::thread::hardware_concurrency()};
+    return pool;
+};
+
+#endif // POOL
@@ -0,0 +1,77 @@
+#ifndef RANDOM
+#define RANDOM
+
+#include <cstdint>
+
+/************************************************
+*
+* RANDOM STREAMS
+*
+*************************************************/
+
+/**
+ * Counter based random stream, n-th value is SplitMix64 finalizer of key and n. Streams are
+ * derived from (seed, stage, task) so results do not depend on thread count or scheduling
+ */
+class Random
+{
+    protected:
+        uint64_t key {0};
+        uint64_t counter {0};
+
+        static const uint64_t GOLDEN = 0x9e3779b97f4a7c15ull;
+
+        explicit Random(uint64_t _key, bool): key{_key} {};
+
+    public:
+        Random(uint64_t seed, uint64_t stage = 0, uint64_t task = 0):
+            key{Mix(Mix(Mix(seed) ^ (stage * GOLDEN)) ^ (task * GOLDEN))} {};
+
+        static uint64_t Mix(uint64_t z)
+        {
+            z += GOLDEN;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            return z ^ (z >> 31);
+        };
+
+        uint64_t Next64()
+        {
+            counter += 1;
+            return Mix(key + counter * GOLDEN);
+        };
+
+        /**
+         * Non negative int in the range of rand()
+         */
+        int operator()()
+        {
+            return (int)(Next64() >> 33);
+        };
+
+        /**
+         * Float in [0, 1)
+         */
+        float Uniform()
+        {
+            return (Next64() >> 40) * (1.0f / (1ull << 24));
+        };
+
+        /**
+         * Independent stream of given task, does not advance this stream
+         */
+        Random Stream(uint64_t task) const
+        {
+            return Random {Mix(key ^ Mix(task * GOLDEN)), true};
+        };
+
+        /**
+         * Independent stream for a batch of tasks, advances this stream by one value
+         */
+        Random Split()
+        {
+            return Random {Next64(), true};
+        };
+};
+
+#endif // RANDOM
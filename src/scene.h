@@ -4,10 +4,13 @@
 #include <future>
 #include <chrono>
 #include <utility>
+#include <memory>
 
+#ifndef HEADLESS
 #ifndef RAYLIB_H
 #include "raylib.h"
 #endif
+#endif
 
 #ifndef UTILS
 #include "utils.h"
@@ -17,37 +20,52 @@
 #include "pcg.h"
 #endif
 
+#ifndef HEADLESS
 #ifndef DRAW 
 #include "draw.h"
 #endif
+#endif
+
+#ifndef CACHE
+#include "cache.h"
+#endif
 
 
 using namespace std::chrono_literals;
-static bool GenerateStage0 = true;
-static bool GenerateStage1 = true;
-static bool GenerateStage2 = true;
-static bool GenerateStage3 = true;
-static bool GenerateStage4 = true;
+
+/**
+ * Budgets of stages which return partial result when they run out of time, run is stopped only
+ * when stage does not return within grace period after its budget
+ */
+const auto STRUCTURES_BUDGET = 5s;
+const auto TREES_BUDGET = 2s;
+const auto BUDGET_GRACE = 1s;
+
+/**
+ * Caves do not poll budget, run is stopped when underground is not done this long after surface
+ * stages which run meanwhile
+ */
+const auto UNDERGROUND_BUDGET = 5s;
 
 inline void GenerateHorizontalAreas(Map& map)
 {
-    GenerateStage0 = true;
+    map.GenerateStage(0, true);
 };
 
 inline void GenerateBiomes(Map& map)
 {
-    GenerateStage1 = true;
+    map.GenerateStage(1, true);
 };
 
 inline void GenerateSurface(Map& map)
 {
-    GenerateStage2 = true;
-    GenerateStage3 = true;
+    map.GenerateStage(2, true);
+    map.GenerateStage(3, true);
 };
 
 inline void GenerateUnderground(Map& map)
 {
-    GenerateStage4 = true;
+    map.GenerateStage(4, true);
 };
 
 inline void GenerateAll(Map& map)
@@ -60,123 +78,176 @@ inline void GenerateAll(Map& map)
 
 inline void GenerationDone(Map& map)
 {
-    GenerateStage0 = false;
-    GenerateStage1 = false;
-    GenerateStage2 = false;
-    GenerateStage3 = false;
-    GenerateStage4 = false;
+    for (auto stage = 0; stage < 5; ++stage)
+        map.GenerateStage(stage, false);
+};
+
+/**
+ * Underground and cavern materials with ores run concurrently inside of their horizontal
+ * areas, writes crossing the border are flushed afterwards in underground, cavern order
+ */
+inline void GenerateUndergroundCavernMaterials(Map& map, StageRecorder& stage)
+{
+    auto underground_rect = map.Underground().bbox();
+    underground_rect.h -= 1; // LAST ROW IS SHARED WITH CAVERN
+    WriteArea underground {map, underground_rect};
+    WriteArea cavern {map, map.Cavern().bbox()};
+
+    auto cavern_future = std::async(std::launch::async, stage.Journaled(cavern.Declared([](Map& map)
+    {
+        GenerateCavernMaterials(map);
+        GenerateCavernOres(map);
+    })), std::ref(map));
+
+    underground.Declared([](Map& map)
+    {
+        GenerateUndergroudMaterials(map);
+        GenerateUndergroundOres(map);
+    })(map);
+
+    cavern_future.wait();
+    underground.Flush();
+    cavern.Flush();
 };
 
 class Scene
 {
     public:
+        /** Identifies scene in stage cache keys */
+        virtual const char* Name() const = 0;
         virtual void Run(Map& map) = 0;
+#ifndef HEADLESS
         virtual void Render(Map& map) = 0;
+#endif
 };
 
 
 class DefaultScene: public Scene
 {
     public:
+        virtual const char* Name() const override { return "DefaultScene"; };
+
         virtual void Run(Map& map) override
         {
+            std::unique_ptr<StageRecorder> underground;
             std::vector<std::tuple<std::string, std::string, std::future<void>>> futures_to_wait;
 
-            if (!map.ShouldForceStop() && GenerateStage0)
+            if (!map.ShouldForceStop() && map.GenerateStage(0))
             {
                 map.ClearStage0();
-                map.SetGenerationMessage("DEFINITION OF HORIZONTAL AREAS...");
-                DefineHorizontal(map);
+                StageRecorder stage {map, Name(), 0};
+                if (!stage.Restore()) stage.Record([&]()
+                {
+                    map.SetGenerationMessage("DEFINITION OF HORIZONTAL AREAS...");
+                    DefineHorizontal(map);
+                });
             }
 
-            if (!map.ShouldForceStop() && GenerateStage4)
+            if (!map.ShouldForceStop() && map.GenerateStage(4))
             {
                 map.ClearStage4();
-                map.SetGenerationMessage("GENERATION OF CAVES...");
-                auto generate_caves_future = std::async(std::launch::async, GenerateCaves, std::ref(map));
-                futures_to_wait.emplace_back(
-                        "GENERATION OF CAVES...", 
-                        "GENERATION OF CAVES INFEASIBLE...", 
-                        std::move(generate_caves_future)
-                );
+                underground.reset(new StageRecorder(map, Name(), 4));
+                if (!underground->Restore())
+                {
+                    map.SetGenerationMessage("GENERATION OF CAVES...");
+                    auto generate_caves_future = std::async(std::launch::async, underground->Journaled(GenerateCaves), std::ref(map));
+                    futures_to_wait.emplace_back(
+                            "GENERATION OF CAVES...", 
+                            "GENERATION OF CAVES INFEASIBLE...", 
+                            std::move(generate_caves_future)
+                    );
+                }
+                else underground.reset();
             }
 
-            if (!map.ShouldForceStop() && GenerateStage1)
+            if (!map.ShouldForceStop() && map.GenerateStage(1))
             {
                 map.ClearStage1();
-                map.SetGenerationMessage("DEFINITION OF BIOMES...");
-                DefineBiomes(map);
+                StageRecorder stage {map, Name(), 1};
+                if (!stage.Restore()) stage.Record([&]()
+                {
+                    map.SetGenerationMessage("DEFINITION OF BIOMES...");
+                    DefineBiomes(map);
+                });
             }
 
-            if (!map.ShouldForceStop() && GenerateStage2)
+            if (!map.ShouldForceStop() && map.GenerateStage(2))
             {
                 map.ClearStage2();
-                auto define_structures_future = std::async(std::launch::async, DefineHillsHolesIslands, std::ref(map));
-                auto define_cabins_future = std::async(std::launch::async, DefineCabins, std::ref(map));
-                auto define_castles_future = std::async(std::launch::async, DefineCastles, std::ref(map));
-
-                map.SetGenerationMessage("DEFINITION OF HILLS, HOLES, ISLANDS...");
-                if (define_structures_future.wait_for(5s) == std::future_status::timeout)
+                StageRecorder stage {map, Name(), 2};
+                if (!stage.Restore()) stage.Record([&]()
                 {
-                    map.SetForceStop(true);
-                    map.Error("DEFINITION OF HILLS, HOLES, ISLANDS INFEASIBLE");
-                }
-                
-                /*
-                map.SetGenerationMessage("DEFINITION OF UNDERGROUND CABINS...");
-                if (define_cabins_future.wait_for(5s) == std::future_status::timeout)
-                {
-                    map.SetForceStop(true);
-                    map.Error("DEFINITION OF UNDERGROUND CABINS INFEASIBLE");
-                }
-
-                map.SetGenerationMessage("DEFINITION OF UNDERGROUND CASTLES...");
-                if (define_cabins_future.wait_for(5s) == std::future_status::timeout)
-                {
-                    map.SetForceStop(true);
-                    map.Error("DEFINITION OF UNDERGROUND CASTLES INFEASIBLE");
-                }
-                */
+                    // STRUCTURES RUN AT ONCE, SO ALL OF THEM SHARE DEADLINE OF THEIR BUDGET
+                    auto deadline = std::chrono::steady_clock::now() + STRUCTURES_BUDGET + BUDGET_GRACE;
+                    auto define_structures_future = std::async(std::launch::async, stage.Journaled(WithBudget(STRUCTURES_BUDGET, DefineHillsHolesIslands)), std::ref(map));
+                    auto define_cabins_future = std::async(std::launch::async, stage.Journaled(WithBudget(STRUCTURES_BUDGET, DefineCabins)), std::ref(map));
+                    auto define_castles_future = std::async(std::launch::async, stage.Journaled(WithBudget(STRUCTURES_BUDGET, DefineCastles)), std::ref(map));
+
+                    map.SetGenerationMessage("DEFINITION OF HILLS, HOLES, ISLANDS...");
+                    if (define_structures_future.wait_until(deadline) == std::future_status::timeout)
+                    {
+                        map.SetForceStop(true);
+                        map.Error("DEFINITION OF HILLS, HOLES, ISLANDS INFEASIBLE");
+                    }
+
+                    map.SetGenerationMessage("DEFINITION OF UNDERGROUND CABINS...");
+                    if (define_cabins_future.wait_until(deadline) == std::future_status::timeout)
+                    {
+                        map.SetForceStop(true);
+                        map.Error("DEFINITION OF UNDERGROUND CABINS INFEASIBLE");
+                    }
+
+                    map.SetGenerationMessage("DEFINITION OF UNDERGROUND CASTLES...");
+                    if (define_castles_future.wait_until(deadline) == std::future_status::timeout)
+                    {
+                        map.SetForceStop(true);
+                        map.Error("DEFINITION OF UNDERGROUND CASTLES INFEASIBLE");
+                    }
+                });
             }
 
-            if (!map.ShouldForceStop() && GenerateStage3)
+            if (!map.ShouldForceStop() && map.GenerateStage(3))
             {
                 map.ClearStage3();
-                map.SetGenerationMessage("DEFINITION OF SURFACE...");
-                DefineSurface(map);
-                map.SetGenerationMessage("GENERATION OF HILLS...");
-                GenerateHills(map);
-                map.SetGenerationMessage("GENERATION OF HOLES...");
-                GenerateHoles(map);
-                map.SetGenerationMessage("GENERATION OF CLIFFS AND TRANSITIONS...");
-                GenerateCliffsTransitions(map);
-                map.SetGenerationMessage("GENERATION OF LEFT OCEAN...");
-                GenerateOceanLeft(map);
-                map.SetGenerationMessage("GENERATION OF RIGHT OCEAN...");
-                GenerateOceanRight(map);
-                map.SetGenerationMessage("GENERATION OF CHASMS...");
-                GenerateChasms(map);
-                map.SetGenerationMessage("GENERATION OF LAKES...");
-                GenerateLakes(map);
-                map.SetGenerationMessage("GENERATION OF JUNGLE SWAMP...");
-                GenerateJungleSwamp(map);
-                map.SetGenerationMessage("GENERATION OF GRASS...");
-                GenerateGrass(map);
-                map.SetGenerationMessage("GENERATION OF ISLANDS...");
-                GenerateIslands(map);
-
-                auto generate_trees_future = std::async(std::launch::async, GenerateTrees, std::ref(map));
-                map.SetGenerationMessage("GENERATION OF TREES...");
-                if (generate_trees_future.wait_for(2s) == std::future_status::timeout)
+                StageRecorder stage {map, Name(), 3};
+                if (!stage.Restore()) stage.Record([&]()
                 {
-                    map.SetForceStop(true);
-                    map.Error("DEFINITION OF TREES INFEASIBLE"); 
-                }
-
-                map.SetGenerationMessage("GENERATION OF SURFACE MATERIALS...");
-                GenerateSurfaceMaterials(map);
-                map.SetGenerationMessage("GENERATION OF SURFACE ORES...");
-                GenerateSurfaceOres(map);
+                    map.SetGenerationMessage("DEFINITION OF SURFACE...");
+                    DefineSurface(map);
+                    map.SetGenerationMessage("GENERATION OF HILLS...");
+                    GenerateHills(map);
+                    map.SetGenerationMessage("GENERATION OF HOLES...");
+                    GenerateHoles(map);
+                    map.SetGenerationMessage("GENERATION OF CLIFFS AND TRANSITIONS...");
+                    GenerateCliffsTransitions(map);
+                    map.SetGenerationMessage("GENERATION OF LEFT OCEAN...");
+                    GenerateOceanLeft(map);
+                    map.SetGenerationMessage("GENERATION OF RIGHT OCEAN...");
+                    GenerateOceanRight(map);
+                    map.SetGenerationMessage("GENERATION OF CHASMS...");
+                    GenerateChasms(map);
+                    map.SetGenerationMessage("GENERATION OF LAKES...");
+                    GenerateLakes(map);
+                    map.SetGenerationMessage("GENERATION OF JUNGLE SWAMP...");
+                    GenerateJungleSwamp(map);
+                    map.SetGenerationMessage("GENERATION OF GRASS...");
+                    GenerateGrass(map);
+                    map.SetGenerationMessage("GENERATION OF ISLANDS...");
+                    GenerateIslands(map);
+
+                    auto generate_trees_future = std::async(std::launch::async, stage.Journaled(WithBudget(TREES_BUDGET, GenerateTrees)), std::ref(map));
+                    map.SetGenerationMessage("GENERATION OF TREES...");
+                    if (generate_trees_future.wait_for(TREES_BUDGET + BUDGET_GRACE) == std::future_status::timeout)
+                    {
+                        map.SetForceStop(true);
+                        map.Error("DEFINITION OF TREES INFEASIBLE"); 
+                    }
+
+                    map.SetGenerationMessage("GENERATION OF SURFACE MATERIALS...");
+                    GenerateSurfaceMaterials(map);
+                    map.SetGenerationMessage("GENERATION OF SURFACE ORES...");
+                    GenerateSurfaceOres(map);
+                });
             }
             
             for (auto& pair: futures_to_wait)
@@ -185,28 +256,27 @@ class DefaultScene: public Scene
                 auto error_message = std::get<1>(pair);
                 auto& future = std::get<2>(pair);
                 map.SetGenerationMessage(message);
-                if (future.wait_for(5s) == std::future_status::timeout)
+                if (future.wait_for(UNDERGROUND_BUDGET) == std::future_status::timeout)
                 {
                     map.SetForceStop(true);
                     map.Error(error_message);
                 }
             }
 
-            if (!map.ShouldForceStop() && GenerateStage4)
+            if (!map.ShouldForceStop() && underground != nullptr)
             {
-                map.SetGenerationMessage("GENERATION OF UNDERGROUND MATERIALS...");
-                GenerateUndergroudMaterials(map);
-                map.SetGenerationMessage("GENERATION OF UNDERGROUND ORES...");
-                GenerateUndergroundOres(map);
-                map.SetGenerationMessage("GENERATION OF CAVERN MATERIALS...");
-                GenerateCavernMaterials(map);
-                map.SetGenerationMessage("GENERATION OF CAVERN ORES...");
-                GenerateCavernOres(map);
-                map.SetGenerationMessage("GENERATION OF CAVE LAKES...");
-                GenerateCaveLakes(map);
+                underground->Record([&]()
+                {
+                    OverlayCaves(map);
+                    map.SetGenerationMessage("GENERATION OF UNDERGROUND AND CAVERN MATERIALS...");
+                    GenerateUndergroundCavernMaterials(map, *underground);
+                    map.SetGenerationMessage("GENERATION OF CAVE LAKES...");
+                    GenerateCaveLakes(map);
+                });
             }
         };
 
+#ifndef HEADLESS
         virtual void Render(Map& map) override
         {
             DrawHorizontal(map);
@@ -216,6 +286,7 @@ class DefaultScene: public Scene
             DrawSurfaceDebug(map);
 #endif
         };
+#endif
 
 };
 
@@ -223,47 +294,82 @@ class DefaultScene: public Scene
 class Scene0: public Scene
 {
     public:
+        virtual const char* Name() const override { return "Scene0"; };
+
         virtual void Run(Map& map) override
         {
             map.ClearStage4();
 
-            if (!map.ShouldForceStop() && GenerateStage0)
+            if (!map.ShouldForceStop() && map.GenerateStage(0))
             {
                 map.ClearStage0();
-                map.SetGenerationMessage("DEFINITION OF HORIZONTAL AREAS...");
-                DefineHorizontal(map);
+                StageRecorder stage {map, Name(), 0};
+                if (!stage.Restore()) stage.Record([&]()
+                {
+                    map.SetGenerationMessage("DEFINITION OF HORIZONTAL AREAS...");
+                    DefineHorizontal(map);
+                });
             }
 
-            if (!map.ShouldForceStop() && GenerateStage1)
+            if (!map.ShouldForceStop() && map.GenerateStage(1))
             {
                 map.ClearStage1();
-                map.SetGenerationMessage("DEFINITION OF BIOMES...");
-                DefineBiomes(map);
+                StageRecorder stage {map, Name(), 1};
+                if (!stage.Restore()) stage.Record([&]()
+                {
+                    map.SetGenerationMessage("DEFINITION OF BIOMES...");
+                    DefineBiomes(map);
+                });
             }
 
-            if (!map.ShouldForceStop() && GenerateStage2)
+            if (!map.ShouldForceStop() && map.GenerateStage(2))
             {
                 map.ClearStage2();
-                auto define_structures_future = std::async(std::launch::async, DefineHillsHolesIslands, std::ref(map));
-                auto define_cabins_future = std::async(std::launch::async, DefineCabins, std::ref(map));
-                auto define_castles_future = std::async(std::launch::async, DefineCastles, std::ref(map));
-
-                map.SetGenerationMessage("DEFINITION OF HILLS, HOLES, ISLANDS...");
-                if (define_structures_future.wait_for(5s) == std::future_status::timeout)
+                StageRecorder stage {map, Name(), 2};
+                if (!stage.Restore()) stage.Record([&]()
                 {
-                    map.SetForceStop(true);
-                    map.Error("DEFINITION OF HILLS, HOLES, ISLANDS INFEASIBLE");
-                }
+                    // STRUCTURES RUN AT ONCE, SO ALL OF THEM SHARE DEADLINE OF THEIR BUDGET
+                    auto deadline = std::chrono::steady_clock::now() + STRUCTURES_BUDGET + BUDGET_GRACE;
+                    auto define_structures_future = std::async(std::launch::async, stage.Journaled(WithBudget(STRUCTURES_BUDGET, DefineHillsHolesIslands)), std::ref(map));
+                    auto define_cabins_future = std::async(std::launch::async, stage.Journaled(WithBudget(STRUCTURES_BUDGET, DefineCabins)), std::ref(map));
+                    auto define_castles_future = std::async(std::launch::async, stage.Journaled(WithBudget(STRUCTURES_BUDGET, DefineCastles)), std::ref(map));
+
+                    map.SetGenerationMessage("DEFINITION OF HILLS, HOLES, ISLANDS...");
+                    if (define_structures_future.wait_until(deadline) == std::future_status::timeout)
+                    {
+                        map.SetForceStop(true);
+                        map.Error("DEFINITION OF HILLS, HOLES, ISLANDS INFEASIBLE");
+                    }
+
+                    map.SetGenerationMessage("DEFINITION OF UNDERGROUND CABINS...");
+                    if (define_cabins_future.wait_until(deadline) == std::future_status::timeout)
+                    {
+                        map.SetForceStop(true);
+                        map.Error("DEFINITION OF UNDERGROUND CABINS INFEASIBLE");
+                    }
+
+                    map.SetGenerationMessage("DEFINITION OF UNDERGROUND CASTLES...");
+                    if (define_castles_future.wait_until(deadline) == std::future_status::timeout)
+                    {
+                        map.SetForceStop(true);
+                        map.Error("DEFINITION OF UNDERGROUND CASTLES INFEASIBLE");
+                    }
+                });
             }
 
-            if (!map.ShouldForceStop() && GenerateStage3)
+            if (!map.ShouldForceStop() && map.GenerateStage(3))
             {
                 map.ClearStage3();
-                map.SetGenerationMessage("DEFINITION OF SURFACE...");
-                DefineSurface(map);
+                StageRecorder stage {map, Name(), 3};
+                if (!stage.Restore()) stage.Record([&]()
+                {
+                    map.SetGenerationMessage("DEFINITION OF SURFACE...");
+                    DefineSurface(map);
+                });
             }
         };
 
+#ifndef HEADLESS
         virtual void Render(Map& map) override
         {
             DrawHorizontal(map);
@@ -273,57 +379,93 @@ class Scene0: public Scene
             DrawSurfaceDebug(map);
 #endif
         };
+#endif
 };
 
 
 class Scene1: public Scene
 {
     public:
+        virtual const char* Name() const override { return "Scene1"; };
+
         virtual void Run(Map& map) override
         {
             map.ClearStage4();
 
-            if (!map.ShouldForceStop() && GenerateStage0)
+            if (!map.ShouldForceStop() && map.GenerateStage(0))
             {
                 map.ClearStage0();
-                map.SetGenerationMessage("DEFINITION OF HORIZONTAL AREAS...");
-                DefineHorizontal(map);
+                StageRecorder stage {map, Name(), 0};
+                if (!stage.Restore()) stage.Record([&]()
+                {
+                    map.SetGenerationMessage("DEFINITION OF HORIZONTAL AREAS...");
+                    DefineHorizontal(map);
+                });
             }
 
-            if (!map.ShouldForceStop() && GenerateStage1)
+            if (!map.ShouldForceStop() && map.GenerateStage(1))
             {
                 map.ClearStage1();
-                map.SetGenerationMessage("DEFINITION OF BIOMES...");
-                DefineBiomes(map);
+                StageRecorder stage {map, Name(), 1};
+                if (!stage.Restore()) stage.Record([&]()
+                {
+                    map.SetGenerationMessage("DEFINITION OF BIOMES...");
+                    DefineBiomes(map);
+                });
             }
 
-            if (!map.ShouldForceStop() && GenerateStage2)
+            if (!map.ShouldForceStop() && map.GenerateStage(2))
             {
                 map.ClearStage2();
-                auto define_structures_future = std::async(std::launch::async, DefineHillsHolesIslands, std::ref(map));
-                auto define_cabins_future = std::async(std::launch::async, DefineCabins, std::ref(map));
-                auto define_castles_future = std::async(std::launch::async, DefineCastles, std::ref(map));
-
-                map.SetGenerationMessage("DEFINITION OF HILLS, HOLES, ISLANDS...");
-                if (define_structures_future.wait_for(5s) == std::future_status::timeout)
+                StageRecorder stage {map, Name(), 2};
+                if (!stage.Restore()) stage.Record([&]()
                 {
-                    map.SetForceStop(true);
-                    map.Error("DEFINITION OF HILLS, HOLES, ISLANDS INFEASIBLE");
-                }
+                    // STRUCTURES RUN AT ONCE, SO ALL OF THEM SHARE DEADLINE OF THEIR BUDGET
+                    auto deadline = std::chrono::steady_clock::now() + STRUCTURES_BUDGET + BUDGET_GRACE;
+                    auto define_structures_future = std::async(std::launch::async, stage.Journaled(WithBudget(STRUCTURES_BUDGET, DefineHillsHolesIslands)), std::ref(map));
+                    auto define_cabins_future = std::async(std::launch::async, stage.Journaled(WithBudget(STRUCTURES_BUDGET, DefineCabins)), std::ref(map));
+                    auto define_castles_future = std::async(std::launch::async, stage.Journaled(WithBudget(STRUCTURES_BUDGET, DefineCastles)), std::ref(map));
+
+                    map.SetGenerationMessage("DEFINITION OF HILLS, HOLES, ISLANDS...");
+                    if (define_structures_future.wait_until(deadline) == std::future_status::timeout)
+                    {
+                        map.SetForceStop(true);
+                        map.Error("DEFINITION OF HILLS, HOLES, ISLANDS INFEASIBLE");
+                    }
+
+                    map.SetGenerationMessage("DEFINITION OF UNDERGROUND CABINS...");
+                    if (define_cabins_future.wait_until(deadline) == std::future_status::timeout)
+                    {
+                        map.SetForceStop(true);
+                        map.Error("DEFINITION OF UNDERGROUND CABINS INFEASIBLE");
+                    }
+
+                    map.SetGenerationMessage("DEFINITION OF UNDERGROUND CASTLES...");
+                    if (define_castles_future.wait_until(deadline) == std::future_status::timeout)
+                    {
+                        map.SetForceStop(true);
+                        map.Error("DEFINITION OF UNDERGROUND CASTLES INFEASIBLE");
+                    }
+                });
             }
 
-            if (!map.ShouldForceStop() && GenerateStage3)
+            if (!map.ShouldForceStop() && map.GenerateStage(3))
             {
                 map.ClearStage3();
-                map.SetGenerationMessage("DEFINITION OF SURFACE...");
-                DefineSurface(map);
-                map.SetGenerationMessage("GENERATION OF HILLS...");
-                GenerateHills(map);
-                map.SetGenerationMessage("GENERATION OF HOLES...");
-                GenerateHoles(map);
+                StageRecorder stage {map, Name(), 3};
+                if (!stage.Restore()) stage.Record([&]()
+                {
+                    map.SetGenerationMessage("DEFINITION OF SURFACE...");
+                    DefineSurface(map);
+                    map.SetGenerationMessage("GENERATION OF HILLS...");
+                    GenerateHills(map);
+                    map.SetGenerationMessage("GENERATION OF HOLES...");
+                    GenerateHoles(map);
+                });
             }
         };
 
+#ifndef HEADLESS
         virtual void Render(Map& map) override
         {
             DrawHorizontal(map);
@@ -333,6 +475,7 @@ class Scene1: public Scene
             DrawSurfaceDebug(map);
 #endif
         };
+#endif
 
 };
 
@@ -340,53 +483,88 @@ class Scene1: public Scene
 class Scene2: public Scene
 {
     public:
+        virtual const char* Name() const override { return "Scene2"; };
+
         virtual void Run(Map& map) override
         {
             map.ClearStage4();
 
-            if (!map.ShouldForceStop() && GenerateStage0)
+            if (!map.ShouldForceStop() && map.GenerateStage(0))
             {
                 map.ClearStage0();
-                map.SetGenerationMessage("DEFINITION OF HORIZONTAL AREAS...");
-                DefineHorizontal(map);
+                StageRecorder stage {map, Name(), 0};
+                if (!stage.Restore()) stage.Record([&]()
+                {
+                    map.SetGenerationMessage("DEFINITION OF HORIZONTAL AREAS...");
+                    DefineHorizontal(map);
+                });
             }
 
-            if (!map.ShouldForceStop() && GenerateStage1)
+            if (!map.ShouldForceStop() && map.GenerateStage(1))
             {
                 map.ClearStage1();
-                map.SetGenerationMessage("DEFINITION OF BIOMES...");
-                DefineBiomes(map);
+                StageRecorder stage {map, Name(), 1};
+                if (!stage.Restore()) stage.Record([&]()
+                {
+                    map.SetGenerationMessage("DEFINITION OF BIOMES...");
+                    DefineBiomes(map);
+                });
             }
 
-            if (!map.ShouldForceStop() && GenerateStage2)
+            if (!map.ShouldForceStop() && map.GenerateStage(2))
             {
                 map.ClearStage2();
-                auto define_structures_future = std::async(std::launch::async, DefineHillsHolesIslands, std::ref(map));
-                auto define_cabins_future = std::async(std::launch::async, DefineCabins, std::ref(map));
-                auto define_castles_future = std::async(std::launch::async, DefineCastles, std::ref(map));
-
-                map.SetGenerationMessage("DEFINITION OF HILLS, HOLES, ISLANDS...");
-                if (define_structures_future.wait_for(5s) == std::future_status::timeout)
+                StageRecorder stage {map, Name(), 2};
+                if (!stage.Restore()) stage.Record([&]()
                 {
-                    map.SetForceStop(true);
-                    map.Error("DEFINITION OF HILLS, HOLES, ISLANDS INFEASIBLE");
-                }
+                    // STRUCTURES RUN AT ONCE, SO ALL OF THEM SHARE DEADLINE OF THEIR BUDGET
+                    auto deadline = std::chrono::steady_clock::now() + STRUCTURES_BUDGET + BUDGET_GRACE;
+                    auto define_structures_future = std::async(std::launch::async, stage.Journaled(WithBudget(STRUCTURES_BUDGET, DefineHillsHolesIslands)), std::ref(map));
+                    auto define_cabins_future = std::async(std::launch::async, stage.Journaled(WithBudget(STRUCTURES_BUDGET, DefineCabins)), std::ref(map));
+                    auto define_castles_future = std::async(std::launch::async, stage.Journaled(WithBudget(STRUCTURES_BUDGET, DefineCastles)), std::ref(map));
+
+                    map.SetGenerationMessage("DEFINITION OF HILLS, HOLES, ISLANDS...");
+                    if (define_structures_future.wait_until(deadline) == std::future_status::timeout)
+                    {
+                        map.SetForceStop(true);
+                        map.Error("DEFINITION OF HILLS, HOLES, ISLANDS INFEASIBLE");
+                    }
+
+                    map.SetGenerationMessage("DEFINITION OF UNDERGROUND CABINS...");
+                    if (define_cabins_future.wait_until(deadline) == std::future_status::timeout)
+                    {
+                        map.SetForceStop(true);
+                        map.Error("DEFINITION OF UNDERGROUND CABINS INFEASIBLE");
+                    }
+
+                    map.SetGenerationMessage("DEFINITION OF UNDERGROUND CASTLES...");
+                    if (define_castles_future.wait_until(deadline) == std::future_status::timeout)
+                    {
+                        map.SetForceStop(true);
+                        map.Error("DEFINITION OF UNDERGROUND CASTLES INFEASIBLE");
+                    }
+                });
             }
 
-            if (!map.ShouldForceStop() && GenerateStage3)
+            if (!map.ShouldForceStop() && map.GenerateStage(3))
             {
                 map.ClearStage3();
-                map.SetGenerationMessage("DEFINITION OF SURFACE...");
-                DefineSurface(map);
-                map.SetGenerationMessage("GENERATION OF HILLS...");
-                GenerateHills(map);
-                map.SetGenerationMessage("GENERATION OF HOLES...");
-                GenerateHoles(map);
-                map.SetGenerationMessage("GENERATION OF CLIFFS AND TRANSITIONS...");
-                GenerateCliffsTransitions(map);
+                StageRecorder stage {map, Name(), 3};
+                if (!stage.Restore()) stage.Record([&]()
+                {
+                    map.SetGenerationMessage("DEFINITION OF SURFACE...");
+                    DefineSurface(map);
+                    map.SetGenerationMessage("GENERATION OF HILLS...");
+                    GenerateHills(map);
+                    map.SetGenerationMessage("GENERATION OF HOLES...");
+                    GenerateHoles(map);
+                    map.SetGenerationMessage("GENERATION OF CLIFFS AND TRANSITIONS...");
+                    GenerateCliffsTransitions(map);
+                });
             }
         };
 
+#ifndef HEADLESS
         virtual void Render(Map& map) override
         {
             DrawHorizontal(map);
@@ -396,6 +574,7 @@ class Scene2: public Scene
             DrawSurfaceDebug(map);
 #endif
         };
+#endif
 
 };
 
@@ -404,57 +583,92 @@ class Scene2: public Scene
 class Scene3: public Scene
 {
     public:
+        virtual const char* Name() const override { return "Scene3"; };
+
         virtual void Run(Map& map) override
         {
             map.ClearStage4();
 
-            if (!map.ShouldForceStop() && GenerateStage0)
+            if (!map.ShouldForceStop() && map.GenerateStage(0))
             {
                 map.ClearStage0();
-                map.SetGenerationMessage("DEFINITION OF HORIZONTAL AREAS...");
-                DefineHorizontal(map);
+                StageRecorder stage {map, Name(), 0};
+                if (!stage.Restore()) stage.Record([&]()
+                {
+                    map.SetGenerationMessage("DEFINITION OF HORIZONTAL AREAS...");
+                    DefineHorizontal(map);
+                });
             }
 
-            if (!map.ShouldForceStop() && GenerateStage1)
+            if (!map.ShouldForceStop() && map.GenerateStage(1))
             {
                 map.ClearStage1();
-                map.SetGenerationMessage("DEFINITION OF BIOMES...");
-                DefineBiomes(map);
+                StageRecorder stage {map, Name(), 1};
+                if (!stage.Restore()) stage.Record([&]()
+                {
+                    map.SetGenerationMessage("DEFINITION OF BIOMES...");
+                    DefineBiomes(map);
+                });
             }
 
-            if (!map.ShouldForceStop() && GenerateStage2)
+            if (!map.ShouldForceStop() && map.GenerateStage(2))
             {
                 map.ClearStage2();
-                auto define_structures_future = std::async(std::launch::async, DefineHillsHolesIslands, std::ref(map));
-                auto define_cabins_future = std::async(std::launch::async, DefineCabins, std::ref(map));
-                auto define_castles_future = std::async(std::launch::async, DefineCastles, std::ref(map));
-
-                map.SetGenerationMessage("DEFINITION OF HILLS, HOLES, ISLANDS...");
-                if (define_structures_future.wait_for(5s) == std::future_status::timeout)
+                StageRecorder stage {map, Name(), 2};
+                if (!stage.Restore()) stage.Record([&]()
                 {
-                    map.SetForceStop(true);
-                    map.Error("DEFINITION OF HILLS, HOLES, ISLANDS INFEASIBLE");
-                }
+                    // STRUCTURES RUN AT ONCE, SO ALL OF THEM SHARE DEADLINE OF THEIR BUDGET
+                    auto deadline = std::chrono::steady_clock::now() + STRUCTURES_BUDGET + BUDGET_GRACE;
+                    auto define_structures_future = std::async(std::launch::async, stage.Journaled(WithBudget(STRUCTURES_BUDGET, DefineHillsHolesIslands)), std::ref(map));
+                    auto define_cabins_future = std::async(std::launch::async, stage.Journaled(WithBudget(STRUCTURES_BUDGET, DefineCabins)), std::ref(map));
+                    auto define_castles_future = std::async(std::launch::async, stage.Journaled(WithBudget(STRUCTURES_BUDGET, DefineCastles)), std::ref(map));
+
+                    map.SetGenerationMessage("DEFINITION OF HILLS, HOLES, ISLANDS...");
+                    if (define_structures_future.wait_until(deadline) == std::future_status::timeout)
+                    {
+                        map.SetForceStop(true);
+                        map.Error("DEFINITION OF HILLS, HOLES, ISLANDS INFEASIBLE");
+                    }
+
+                    map.SetGenerationMessage("DEFINITION OF UNDERGROUND CABINS...");
+                    if (define_cabins_future.wait_until(deadline) == std::future_status::timeout)
+                    {
+                        map.SetForceStop(true);
+                        map.Error("DEFINITION OF UNDERGROUND CABINS INFEASIBLE");
+                    }
+
+                    map.SetGenerationMessage("DEFINITION OF UNDERGROUND CASTLES...");
+                    if (define_castles_future.wait_until(deadline) == std::future_status::timeout)
+                    {
+                        map.SetForceStop(true);
+                        map.Error("DEFINITION OF UNDERGROUND CASTLES INFEASIBLE");
+                    }
+                });
             }
 
-            if (!map.ShouldForceStop() && GenerateStage3)
+            if (!map.ShouldForceStop() && map.GenerateStage(3))
             {
                 map.ClearStage3();
-                map.SetGenerationMessage("DEFINITION OF SURFACE...");
-                DefineSurface(map);
-                map.SetGenerationMessage("GENERATION OF HILLS...");
-                GenerateHills(map);
-                map.SetGenerationMessage("GENERATION OF HOLES...");
-                GenerateHoles(map);
-                map.SetGenerationMessage("GENERATION OF CLIFFS AND TRANSITIONS...");
-                GenerateCliffsTransitions(map);
-                map.SetGenerationMessage("GENERATION OF LEFT OCEAN...");
-                GenerateOceanLeft(map);
-                map.SetGenerationMessage("GENERATION OF RIGHT OCEAN...");
-                GenerateOceanRight(map);
+                StageRecorder stage {map, Name(), 3};
+                if (!stage.Restore()) stage.Record([&]()
+                {
+                    map.SetGenerationMessage("DEFINITION OF SURFACE...");
+                    DefineSurface(map);
+                    map.SetGenerationMessage("GENERATION OF HILLS...");
+                    GenerateHills(map);
+                    map.SetGenerationMessage("GENERATION OF HOLES...");
+                    GenerateHoles(map);
+                    map.SetGenerationMessage("GENERATION OF CLIFFS AND TRANSITIONS...");
+                    GenerateCliffsTransitions(map);
+                    map.SetGenerationMessage("GENERATION OF LEFT OCEAN...");
+                    GenerateOceanLeft(map);
+                    map.SetGenerationMessage("GENERATION OF RIGHT OCEAN...");
+                    GenerateOceanRight(map);
+                });
             }
         };
 
+#ifndef HEADLESS
         virtual void Render(Map& map) override
         {
             DrawHorizontal(map);
@@ -464,6 +678,7 @@ class Scene3: public Scene
             DrawSurfaceDebug(map);
 #endif
         };
+#endif
 
 };
 
@@ -471,59 +686,94 @@ class Scene3: public Scene
 class Scene4: public Scene
 {
     public:
+        virtual const char* Name() const override { return "Scene4"; };
+
         virtual void Run(Map& map) override
         {
             map.ClearStage4();
 
-            if (!map.ShouldForceStop() && GenerateStage0)
+            if (!map.ShouldForceStop() && map.GenerateStage(0))
             {
                 map.ClearStage0();
-                map.SetGenerationMessage("DEFINITION OF HORIZONTAL AREAS...");
-                DefineHorizontal(map);
+                StageRecorder stage {map, Name(), 0};
+                if (!stage.Restore()) stage.Record([&]()
+                {
+                    map.SetGenerationMessage("DEFINITION OF HORIZONTAL AREAS...");
+                    DefineHorizontal(map);
+                });
             }
 
-            if (!map.ShouldForceStop() && GenerateStage1)
+            if (!map.ShouldForceStop() && map.GenerateStage(1))
             {
                 map.ClearStage1();
-                map.SetGenerationMessage("DEFINITION OF BIOMES...");
-                DefineBiomes(map);
+                StageRecorder stage {map, Name(), 1};
+                if (!stage.Restore()) stage.Record([&]()
+                {
+                    map.SetGenerationMessage("DEFINITION OF BIOMES...");
+                    DefineBiomes(map);
+                });
             }
 
-            if (!map.ShouldForceStop() && GenerateStage2)
+            if (!map.ShouldForceStop() && map.GenerateStage(2))
             {
                 map.ClearStage2();
-                auto define_structures_future = std::async(std::launch::async, DefineHillsHolesIslands, std::ref(map));
-                auto define_cabins_future = std::async(std::launch::async, DefineCabins, std::ref(map));
-                auto define_castles_future = std::async(std::launch::async, DefineCastles, std::ref(map));
-
-                map.SetGenerationMessage("DEFINITION OF HILLS, HOLES, ISLANDS...");
-                if (define_structures_future.wait_for(5s) == std::future_status::timeout)
+                StageRecorder stage {map, Name(), 2};
+                if (!stage.Restore()) stage.Record([&]()
                 {
-                    map.SetForceStop(true);
-                    map.Error("DEFINITION OF HILLS, HOLES, ISLANDS INFEASIBLE");
-                }
+                    // STRUCTURES RUN AT ONCE, SO ALL OF THEM SHARE DEADLINE OF THEIR BUDGET
+                    auto deadline = std::chrono::steady_clock::now() + STRUCTURES_BUDGET + BUDGET_GRACE;
+                    auto define_structures_future = std::async(std::launch::async, stage.Journaled(WithBudget(STRUCTURES_BUDGET, DefineHillsHolesIslands)), std::ref(map));
+                    auto define_cabins_future = std::async(std::launch::async, stage.Journaled(WithBudget(STRUCTURES_BUDGET, DefineCabins)), std::ref(map));
+                    auto define_castles_future = std::async(std::launch::async, stage.Journaled(WithBudget(STRUCTURES_BUDGET, DefineCastles)), std::ref(map));
+
+                    map.SetGenerationMessage("DEFINITION OF HILLS, HOLES, ISLANDS...");
+                    if (define_structures_future.wait_until(deadline) == std::future_status::timeout)
+                    {
+                        map.SetForceStop(true);
+                        map.Error("DEFINITION OF HILLS, HOLES, ISLANDS INFEASIBLE");
+                    }
+
+                    map.SetGenerationMessage("DEFINITION OF UNDERGROUND CABINS...");
+                    if (define_cabins_future.wait_until(deadline) == std::future_status::timeout)
+                    {
+                        map.SetForceStop(true);
+                        map.Error("DEFINITION OF UNDERGROUND CABINS INFEASIBLE");
+                    }
+
+                    map.SetGenerationMessage("DEFINITION OF UNDERGROUND CASTLES...");
+                    if (define_castles_future.wait_until(deadline) == std::future_status::timeout)
+                    {
+                        map.SetForceStop(true);
+                        map.Error("DEFINITION OF UNDERGROUND CASTLES INFEASIBLE");
+                    }
+                });
             }
 
-            if (!map.ShouldForceStop() && GenerateStage3)
+            if (!map.ShouldForceStop() && map.GenerateStage(3))
             {
                 map.ClearStage3();
-                map.SetGenerationMessage("DEFINITION OF SURFACE...");
-                DefineSurface(map);
-                map.SetGenerationMessage("GENERATION OF HILLS...");
-                GenerateHills(map);
-                map.SetGenerationMessage("GENERATION OF HOLES...");
-                GenerateHoles(map);
-                map.SetGenerationMessage("GENERATION OF CLIFFS AND TRANSITIONS...");
-                GenerateCliffsTransitions(map);
-                map.SetGenerationMessage("GENERATION OF LEFT OCEAN...");
-                GenerateOceanLeft(map);
-                map.SetGenerationMessage("GENERATION OF RIGHT OCEAN...");
-                GenerateOceanRight(map);
-                map.SetGenerationMessage("GENERATION OF CHASMS...");
-                GenerateChasms(map);
+                StageRecorder stage {map, Name(), 3};
+                if (!stage.Restore()) stage.Record([&]()
+                {
+                    map.SetGenerationMessage("DEFINITION OF SURFACE...");
+                    DefineSurface(map);
+                    map.SetGenerationMessage("GENERATION OF HILLS...");
+                    GenerateHills(map);
+                    map.SetGenerationMessage("GENERATION OF HOLES...");
+                    GenerateHoles(map);
+                    map.SetGenerationMessage("GENERATION OF CLIFFS AND TRANSITIONS...");
+                    GenerateCliffsTransitions(map);
+                    map.SetGenerationMessage("GENERATION OF LEFT OCEAN...");
+                    GenerateOceanLeft(map);
+                    map.SetGenerationMessage("GENERATION OF RIGHT OCEAN...");
+                    GenerateOceanRight(map);
+                    map.SetGenerationMessage("GENERATION OF CHASMS...");
+                    GenerateChasms(map);
+                });
             }
         };
 
+#ifndef HEADLESS
         virtual void Render(Map& map) override
         {
             DrawHorizontal(map);
@@ -533,6 +783,7 @@ class Scene4: public Scene
             DrawSurfaceDebug(map);
 #endif
         };
+#endif
 
 };
 
@@ -540,63 +791,98 @@ class Scene4: public Scene
 class Scene5: public Scene
 {
     public:
+        virtual const char* Name() const override { return "Scene5"; };
+
         virtual void Run(Map& map) override
         {
             map.ClearStage4();
 
-            if (!map.ShouldForceStop() && GenerateStage0)
+            if (!map.ShouldForceStop() && map.GenerateStage(0))
             {
                 map.ClearStage0();
-                map.SetGenerationMessage("DEFINITION OF HORIZONTAL AREAS...");
-                DefineHorizontal(map);
+                StageRecorder stage {map, Name(), 0};
+                if (!stage.Restore()) stage.Record([&]()
+                {
+                    map.SetGenerationMessage("DEFINITION OF HORIZONTAL AREAS...");
+                    DefineHorizontal(map);
+                });
             }
 
-            if (!map.ShouldForceStop() && GenerateStage1)
+            if (!map.ShouldForceStop() && map.GenerateStage(1))
             {
                 map.ClearStage1();
-                map.SetGenerationMessage("DEFINITION OF BIOMES...");
-                DefineBiomes(map);
+                StageRecorder stage {map, Name(), 1};
+                if (!stage.Restore()) stage.Record([&]()
+                {
+                    map.SetGenerationMessage("DEFINITION OF BIOMES...");
+                    DefineBiomes(map);
+                });
             }
 
-            if (!map.ShouldForceStop() && GenerateStage2)
+            if (!map.ShouldForceStop() && map.GenerateStage(2))
             {
                 map.ClearStage2();
-                auto define_structures_future = std::async(std::launch::async, DefineHillsHolesIslands, std::ref(map));
-                auto define_cabins_future = std::async(std::launch::async, DefineCabins, std::ref(map));
-                auto define_castles_future = std::async(std::launch::async, DefineCastles, std::ref(map));
-
-                map.SetGenerationMessage("DEFINITION OF HILLS, HOLES, ISLANDS...");
-                if (define_structures_future.wait_for(5s) == std::future_status::timeout)
+                StageRecorder stage {map, Name(), 2};
+                if (!stage.Restore()) stage.Record([&]()
                 {
-                    map.SetForceStop(true);
-                    map.Error("DEFINITION OF HILLS, HOLES, ISLANDS INFEASIBLE");
-                }
+                    // STRUCTURES RUN AT ONCE, SO ALL OF THEM SHARE DEADLINE OF THEIR BUDGET
+                    auto deadline = std::chrono::steady_clock::now() + STRUCTURES_BUDGET + BUDGET_GRACE;
+                    auto define_structures_future = std::async(std::launch::async, stage.Journaled(WithBudget(STRUCTURES_BUDGET, DefineHillsHolesIslands)), std::ref(map));
+                    auto define_cabins_future = std::async(std::launch::async, stage.Journaled(WithBudget(STRUCTURES_BUDGET, DefineCabins)), std::ref(map));
+                    auto define_castles_future = std::async(std::launch::async, stage.Journaled(WithBudget(STRUCTURES_BUDGET, DefineCastles)), std::ref(map));
+
+                    map.SetGenerationMessage("DEFINITION OF HILLS, HOLES, ISLANDS...");
+                    if (define_structures_future.wait_until(deadline) == std::future_status::timeout)
+                    {
+                        map.SetForceStop(true);
+                        map.Error("DEFINITION OF HILLS, HOLES, ISLANDS INFEASIBLE");
+                    }
+
+                    map.SetGenerationMessage("DEFINITION OF UNDERGROUND CABINS...");
+                    if (define_cabins_future.wait_until(deadline) == std::future_status::timeout)
+                    {
+                        map.SetForceStop(true);
+                        map.Error("DEFINITION OF UNDERGROUND CABINS INFEASIBLE");
+                    }
+
+                    map.SetGenerationMessage("DEFINITION OF UNDERGROUND CASTLES...");
+                    if (define_castles_future.wait_until(deadline) == std::future_status::timeout)
+                    {
+                        map.SetForceStop(true);
+                        map.Error("DEFINITION OF UNDERGROUND CASTLES INFEASIBLE");
+                    }
+                });
             }
 
-            if (!map.ShouldForceStop() && GenerateStage3)
+            if (!map.ShouldForceStop() && map.GenerateStage(3))
             {
                 map.ClearStage3();
-                map.SetGenerationMessage("DEFINITION OF SURFACE...");
-                DefineSurface(map);
-                map.SetGenerationMessage("GENERATION OF HILLS...");
-                GenerateHills(map);
-                map.SetGenerationMessage("GENERATION OF HOLES...");
-                GenerateHoles(map);
-                map.SetGenerationMessage("GENERATION OF CLIFFS AND TRANSITIONS...");
-                GenerateCliffsTransitions(map);
-                map.SetGenerationMessage("GENERATION OF LEFT OCEAN...");
-                GenerateOceanLeft(map);
-                map.SetGenerationMessage("GENERATION OF RIGHT OCEAN...");
-                GenerateOceanRight(map);
-                map.SetGenerationMessage("GENERATION OF CHASMS...");
-                GenerateChasms(map);
-                map.SetGenerationMessage("GENERATION OF LAKES...");
-                GenerateLakes(map);
-                map.SetGenerationMessage("GENERATION OF JUNGLE SWAMP...");
-                GenerateJungleSwamp(map);
+                StageRecorder stage {map, Name(), 3};
+                if (!stage.Restore()) stage.Record([&]()
+                {
+                    map.SetGenerationMessage("DEFINITION OF SURFACE...");
+                    DefineSurface(map);
+                    map.SetGenerationMessage("GENERATION OF HILLS...");
+                    GenerateHills(map);
+                    map.SetGenerationMessage("GENERATION OF HOLES...");
+                    GenerateHoles(map);
+                    map.SetGenerationMessage("GENERATION OF CLIFFS AND TRANSITIONS...");
+                    GenerateCliffsTransitions(map);
+                    map.SetGenerationMessage("GENERATION OF LEFT OCEAN...");
+                    GenerateOceanLeft(map);
+                    map.SetGenerationMessage("GENERATION OF RIGHT OCEAN...");
+                    GenerateOceanRight(map);
+                    map.SetGenerationMessage("GENERATION OF CHASMS...");
+                    GenerateChasms(map);
+                    map.SetGenerationMessage("GENERATION OF LAKES...");
+                    GenerateLakes(map);
+                    map.SetGenerationMessage("GENERATION OF JUNGLE SWAMP...");
+                    GenerateJungleSwamp(map);
+                });
             }
         };
 
+#ifndef HEADLESS
         virtual void Render(Map& map) override
         {
             DrawHorizontal(map);
@@ -606,6 +892,7 @@ class Scene5: public Scene
             DrawSurfaceDebug(map);
 #endif
         };
+#endif
 
 };
 
@@ -613,65 +900,100 @@ class Scene5: public Scene
 class Scene6: public Scene
 {
     public:
+        virtual const char* Name() const override { return "Scene6"; };
+
         virtual void Run(Map& map) override
         {
             map.ClearStage4();
 
-            if (!map.ShouldForceStop() && GenerateStage0)
+            if (!map.ShouldForceStop() && map.GenerateStage(0))
             {
                 map.ClearStage0();
-                map.SetGenerationMessage("DEFINITION OF HORIZONTAL AREAS...");
-                DefineHorizontal(map);
+                StageRecorder stage {map, Name(), 0};
+                if (!stage.Restore()) stage.Record([&]()
+                {
+                    map.SetGenerationMessage("DEFINITION OF HORIZONTAL AREAS...");
+                    DefineHorizontal(map);
+                });
             }
 
-            if (!map.ShouldForceStop() && GenerateStage1)
+            if (!map.ShouldForceStop() && map.GenerateStage(1))
             {
                 map.ClearStage1();
-                map.SetGenerationMessage("DEFINITION OF BIOMES...");
-                DefineBiomes(map);
+                StageRecorder stage {map, Name(), 1};
+                if (!stage.Restore()) stage.Record([&]()
+                {
+                    map.SetGenerationMessage("DEFINITION OF BIOMES...");
+                    DefineBiomes(map);
+                });
             }
 
-            if (!map.ShouldForceStop() && GenerateStage2)
+            if (!map.ShouldForceStop() && map.GenerateStage(2))
             {
                 map.ClearStage2();
-                auto define_structures_future = std::async(std::launch::async, DefineHillsHolesIslands, std::ref(map));
-                auto define_cabins_future = std::async(std::launch::async, DefineCabins, std::ref(map));
-                auto define_castles_future = std::async(std::launch::async, DefineCastles, std::ref(map));
-
-                map.SetGenerationMessage("DEFINITION OF HILLS, HOLES, ISLANDS...");
-                if (define_structures_future.wait_for(5s) == std::future_status::timeout)
+                StageRecorder stage {map, Name(), 2};
+                if (!stage.Restore()) stage.Record([&]()
                 {
-                    map.SetForceStop(true);
-                    map.Error("DEFINITION OF HILLS, HOLES, ISLANDS INFEASIBLE");
-                }
+                    // STRUCTURES RUN AT ONCE, SO ALL OF THEM SHARE DEADLINE OF THEIR BUDGET
+                    auto deadline = std::chrono::steady_clock::now() + STRUCTURES_BUDGET + BUDGET_GRACE;
+                    auto define_structures_future = std::async(std::launch::async, stage.Journaled(WithBudget(STRUCTURES_BUDGET, DefineHillsHolesIslands)), std::ref(map));
+                    auto define_cabins_future = std::async(std::launch::async, stage.Journaled(WithBudget(STRUCTURES_BUDGET, DefineCabins)), std::ref(map));
+                    auto define_castles_future = std::async(std::launch::async, stage.Journaled(WithBudget(STRUCTURES_BUDGET, DefineCastles)), std::ref(map));
+
+                    map.SetGenerationMessage("DEFINITION OF HILLS, HOLES, ISLANDS...");
+                    if (define_structures_future.wait_until(deadline) == std::future_status::timeout)
+                    {
+                        map.SetForceStop(true);
+                        map.Error("DEFINITION OF HILLS, HOLES, ISLANDS INFEASIBLE");
+                    }
+
+                    map.SetGenerationMessage("DEFINITION OF UNDERGROUND CABINS...");
+                    if (define_cabins_future.wait_until(deadline) == std::future_status::timeout)
+                    {
+                        map.SetForceStop(true);
+                        map.Error("DEFINITION OF UNDERGROUND CABINS INFEASIBLE");
+                    }
+
+                    map.SetGenerationMessage("DEFINITION OF UNDERGROUND CASTLES...");
+                    if (define_castles_future.wait_until(deadline) == std::future_status::timeout)
+                    {
+                        map.SetForceStop(true);
+                        map.Error("DEFINITION OF UNDERGROUND CASTLES INFEASIBLE");
+                    }
+                });
             }
 
-            if (!map.ShouldForceStop() && GenerateStage3)
+            if (!map.ShouldForceStop() && map.GenerateStage(3))
             {
                 map.ClearStage3();
-                map.SetGenerationMessage("DEFINITION OF SURFACE...");
-                DefineSurface(map);
-                map.SetGenerationMessage("GENERATION OF HILLS...");
-                GenerateHills(map);
-                map.SetGenerationMessage("GENERATION OF HOLES...");
-                GenerateHoles(map);
-                map.SetGenerationMessage("GENERATION OF CLIFFS AND TRANSITIONS...");
-                GenerateCliffsTransitions(map);
-                map.SetGenerationMessage("GENERATION OF LEFT OCEAN...");
-                GenerateOceanLeft(map);
-                map.SetGenerationMessage("GENERATION OF RIGHT OCEAN...");
-                GenerateOceanRight(map);
-                map.SetGenerationMessage("GENERATION OF CHASMS...");
-                GenerateChasms(map);
-                map.SetGenerationMessage("GENERATION OF LAKES...");
-                GenerateLakes(map);
-                map.SetGenerationMessage("GENERATION OF JUNGLE SWAMP...");
-                GenerateJungleSwamp(map);
-                map.SetGenerationMessage("GENERATION OF ISLANDS...");
-                GenerateIslands(map);
+                StageRecorder stage {map, Name(), 3};
+                if (!stage.Restore()) stage.Record([&]()
+                {
+                    map.SetGenerationMessage("DEFINITION OF SURFACE...");
+                    DefineSurface(map);
+                    map.SetGenerationMessage("GENERATION OF HILLS...");
+                    GenerateHills(map);
+                    map.SetGenerationMessage("GENERATION OF HOLES...");
+                    GenerateHoles(map);
+                    map.SetGenerationMessage("GENERATION OF CLIFFS AND TRANSITIONS...");
+                    GenerateCliffsTransitions(map);
+                    map.SetGenerationMessage("GENERATION OF LEFT OCEAN...");
+                    GenerateOceanLeft(map);
+                    map.SetGenerationMessage("GENERATION OF RIGHT OCEAN...");
+                    GenerateOceanRight(map);
+                    map.SetGenerationMessage("GENERATION OF CHASMS...");
+                    GenerateChasms(map);
+                    map.SetGenerationMessage("GENERATION OF LAKES...");
+                    GenerateLakes(map);
+                    map.SetGenerationMessage("GENERATION OF JUNGLE SWAMP...");
+                    GenerateJungleSwamp(map);
+                    map.SetGenerationMessage("GENERATION OF ISLANDS...");
+                    GenerateIslands(map);
+                });
             }
         };
 
+#ifndef HEADLESS
         virtual void Render(Map& map) override
         {
             DrawHorizontal(map);
@@ -681,6 +1003,7 @@ class Scene6: public Scene
             DrawSurfaceDebug(map);
 #endif
         };
+#endif
 
 };
 
@@ -688,74 +1011,109 @@ class Scene6: public Scene
 class Scene7: public Scene
 {
     public:
+        virtual const char* Name() const override { return "Scene7"; };
+
         virtual void Run(Map& map) override
         {
+            std::unique_ptr<StageRecorder> underground;
             std::vector<std::tuple<std::string, std::string, std::future<void>>> futures_to_wait;
 
             map.ClearStage4();
 
-            if (!map.ShouldForceStop() && GenerateStage0)
+            if (!map.ShouldForceStop() && map.GenerateStage(0))
             {
                 map.ClearStage0();
-                map.SetGenerationMessage("DEFINITION OF HORIZONTAL AREAS...");
-                DefineHorizontal(map);
+                StageRecorder stage {map, Name(), 0};
+                if (!stage.Restore()) stage.Record([&]()
+                {
+                    map.SetGenerationMessage("DEFINITION OF HORIZONTAL AREAS...");
+                    DefineHorizontal(map);
+                });
             }
 
-            if (!map.ShouldForceStop() && GenerateStage1)
+            if (!map.ShouldForceStop() && map.GenerateStage(1))
             {
                 map.ClearStage1();
-                map.SetGenerationMessage("DEFINITION OF BIOMES...");
-                DefineBiomes(map);
+                StageRecorder stage {map, Name(), 1};
+                if (!stage.Restore()) stage.Record([&]()
+                {
+                    map.SetGenerationMessage("DEFINITION OF BIOMES...");
+                    DefineBiomes(map);
+                });
             }
 
-            if (!map.ShouldForceStop() && GenerateStage2)
+            if (!map.ShouldForceStop() && map.GenerateStage(2))
             {
                 map.ClearStage2();
-                auto define_structures_future = std::async(std::launch::async, DefineHillsHolesIslands, std::ref(map));
-                auto define_cabins_future = std::async(std::launch::async, DefineCabins, std::ref(map));
-                auto define_castles_future = std::async(std::launch::async, DefineCastles, std::ref(map));
-
-                map.SetGenerationMessage("DEFINITION OF HILLS, HOLES, ISLANDS...");
-                if (define_structures_future.wait_for(5s) == std::future_status::timeout)
+                StageRecorder stage {map, Name(), 2};
+                if (!stage.Restore()) stage.Record([&]()
                 {
-                    map.SetForceStop(true);
-                    map.Error("DEFINITION OF HILLS, HOLES, ISLANDS INFEASIBLE");
-                }
+                    // STRUCTURES RUN AT ONCE, SO ALL OF THEM SHARE DEADLINE OF THEIR BUDGET
+                    auto deadline = std::chrono::steady_clock::now() + STRUCTURES_BUDGET + BUDGET_GRACE;
+                    auto define_structures_future = std::async(std::launch::async, stage.Journaled(WithBudget(STRUCTURES_BUDGET, DefineHillsHolesIslands)), std::ref(map));
+                    auto define_cabins_future = std::async(std::launch::async, stage.Journaled(WithBudget(STRUCTURES_BUDGET, DefineCabins)), std::ref(map));
+                    auto define_castles_future = std::async(std::launch::async, stage.Journaled(WithBudget(STRUCTURES_BUDGET, DefineCastles)), std::ref(map));
+
+                    map.SetGenerationMessage("DEFINITION OF HILLS, HOLES, ISLANDS...");
+                    if (define_structures_future.wait_until(deadline) == std::future_status::timeout)
+                    {
+                        map.SetForceStop(true);
+                        map.Error("DEFINITION OF HILLS, HOLES, ISLANDS INFEASIBLE");
+                    }
+
+                    map.SetGenerationMessage("DEFINITION OF UNDERGROUND CABINS...");
+                    if (define_cabins_future.wait_until(deadline) == std::future_status::timeout)
+                    {
+                        map.SetForceStop(true);
+                        map.Error("DEFINITION OF UNDERGROUND CABINS INFEASIBLE");
+                    }
+
+                    map.SetGenerationMessage("DEFINITION OF UNDERGROUND CASTLES...");
+                    if (define_castles_future.wait_until(deadline) == std::future_status::timeout)
+                    {
+                        map.SetForceStop(true);
+                        map.Error("DEFINITION OF UNDERGROUND CASTLES INFEASIBLE");
+                    }
+                });
             }
 
-            if (!map.ShouldForceStop() && GenerateStage3)
+            if (!map.ShouldForceStop() && map.GenerateStage(3))
             {
                 map.ClearStage3();
-                map.SetGenerationMessage("DEFINITION OF SURFACE...");
-                DefineSurface(map);
-                map.SetGenerationMessage("GENERATION OF HILLS...");
-                GenerateHills(map);
-                map.SetGenerationMessage("GENERATION OF HOLES...");
-                GenerateHoles(map);
-                map.SetGenerationMessage("GENERATION OF CLIFFS AND TRANSITIONS...");
-                GenerateCliffsTransitions(map);
-                map.SetGenerationMessage("GENERATION OF LEFT OCEAN...");
-                GenerateOceanLeft(map);
-                map.SetGenerationMessage("GENERATION OF RIGHT OCEAN...");
-                GenerateOceanRight(map);
-                map.SetGenerationMessage("GENERATION OF CHASMS...");
-                GenerateChasms(map);
-                map.SetGenerationMessage("GENERATION OF LAKES...");
-                GenerateLakes(map);
-                map.SetGenerationMessage("GENERATION OF JUNGLE SWAMP...");
-                GenerateJungleSwamp(map);
-                map.SetGenerationMessage("GENERATION OF GRASS...");
-                GenerateGrass(map);
-
-                auto generate_trees_future = std::async(std::launch::async, GenerateTrees, std::ref(map));
-                map.SetGenerationMessage("GENERATION OF TREES...");
-                if (generate_trees_future.wait_for(2s) == std::future_status::timeout)
+                StageRecorder stage {map, Name(), 3};
+                if (!stage.Restore()) stage.Record([&]()
                 {
-                    map.SetForceStop(true);
-                    map.Error("DEFINITION OF TREES INFEASIBLE"); 
-                }
-                map.SetGenerationMessage("GENERATION OF ISLANDS...");
-                GenerateIslands(map);
+                    map.SetGenerationMessage("DEFINITION OF SURFACE...");
+                    DefineSurface(map);
+                    map.SetGenerationMessage("GENERATION OF HILLS...");
+                    GenerateHills(map);
+                    map.SetGenerationMessage("GENERATION OF HOLES...");
+                    GenerateHoles(map);
+                    map.SetGenerationMessage("GENERATION OF CLIFFS AND TRANSITIONS...");
+                    GenerateCliffsTransitions(map);
+                    map.SetGenerationMessage("GENERATION OF LEFT OCEAN...");
+                    GenerateOceanLeft(map);
+                    map.SetGenerationMessage("GENERATION OF RIGHT OCEAN...");
+                    GenerateOceanRight(map);
+                    map.SetGenerationMessage("GENERATION OF CHASMS...");
+                    GenerateChasms(map);
+                    map.SetGenerationMessage("GENERATION OF LAKES...");
+                    GenerateLakes(map);
+                    map.SetGenerationMessage("GENERATION OF JUNGLE SWAMP...");
+                    GenerateJungleSwamp(map);
+                    map.SetGenerationMessage("GENERATION OF GRASS...");
+                    GenerateGrass(map);
+
+                    auto generate_trees_future = std::async(std::launch::async, stage.Journaled(WithBudget(TREES_BUDGET, GenerateTrees)), std::ref(map));
+                    map.SetGenerationMessage("GENERATION OF TREES...");
+                    if (generate_trees_future.wait_for(TREES_BUDGET + BUDGET_GRACE) == std::future_status::timeout)
+                    {
+                        map.SetForceStop(true);
+                        map.Error("DEFINITION OF TREES INFEASIBLE"); 
+                    }
+                    map.SetGenerationMessage("GENERATION OF ISLANDS...");
+                    GenerateIslands(map);
+                });
             }
             
             for (auto& pair: futures_to_wait)
@@ -764,7 +1122,7 @@ class Scene7: public Scene
                 auto error_message = std::get<1>(pair);
                 auto& future = std::get<2>(pair);
                 map.SetGenerationMessage(message);
-                if (future.wait_for(5s) == std::future_status::timeout)
+                if (future.wait_for(UNDERGROUND_BUDGET) == std::future_status::timeout)
                 {
                     map.SetForceStop(true);
                     map.Error(error_message);
@@ -772,6 +1130,7 @@ class Scene7: public Scene
             }
         };
 
+#ifndef HEADLESS
         virtual void Render(Map& map) override
         {
             DrawHorizontal(map);
@@ -781,85 +1140,121 @@ class Scene7: public Scene
             DrawSurfaceDebug(map);
 #endif
         };
+#endif
 
 };
 
 class Scene8: public Scene
 {
     public:
+        virtual const char* Name() const override { return "Scene8"; };
+
         virtual void Run(Map& map) override
         {
+            std::unique_ptr<StageRecorder> underground;
             std::vector<std::tuple<std::string, std::string, std::future<void>>> futures_to_wait;
 
             map.ClearStage4();
 
-            if (!map.ShouldForceStop() && GenerateStage0)
+            if (!map.ShouldForceStop() && map.GenerateStage(0))
             {
                 map.ClearStage0();
-                map.SetGenerationMessage("DEFINITION OF HORIZONTAL AREAS...");
-                DefineHorizontal(map);
+                StageRecorder stage {map, Name(), 0};
+                if (!stage.Restore()) stage.Record([&]()
+                {
+                    map.SetGenerationMessage("DEFINITION OF HORIZONTAL AREAS...");
+                    DefineHorizontal(map);
+                });
             }
 
-            if (!map.ShouldForceStop() && GenerateStage1)
+            if (!map.ShouldForceStop() && map.GenerateStage(1))
             {
                 map.ClearStage1();
-                map.SetGenerationMessage("DEFINITION OF BIOMES...");
-                DefineBiomes(map);
+                StageRecorder stage {map, Name(), 1};
+                if (!stage.Restore()) stage.Record([&]()
+                {
+                    map.SetGenerationMessage("DEFINITION OF BIOMES...");
+                    DefineBiomes(map);
+                });
             }
 
-            if (!map.ShouldForceStop() && GenerateStage2)
+            if (!map.ShouldForceStop() && map.GenerateStage(2))
             {
                 map.ClearStage2();
-                auto define_structures_future = std::async(std::launch::async, DefineHillsHolesIslands, std::ref(map));
-                auto define_cabins_future = std::async(std::launch::async, DefineCabins, std::ref(map));
-                auto define_castles_future = std::async(std::launch::async, DefineCastles, std::ref(map));
-
-                map.SetGenerationMessage("DEFINITION OF HILLS, HOLES, ISLANDS...");
-                if (define_structures_future.wait_for(5s) == std::future_status::timeout)
+                StageRecorder stage {map, Name(), 2};
+                if (!stage.Restore()) stage.Record([&]()
                 {
-                    map.SetForceStop(true);
-                    map.Error("DEFINITION OF HILLS, HOLES, ISLANDS INFEASIBLE");
-                }
+                    // STRUCTURES RUN AT ONCE, SO ALL OF THEM SHARE DEADLINE OF THEIR BUDGET
+                    auto deadline = std::chrono::steady_clock::now() + STRUCTURES_BUDGET + BUDGET_GRACE;
+                    auto define_structures_future = std::async(std::launch::async, stage.Journaled(WithBudget(STRUCTURES_BUDGET, DefineHillsHolesIslands)), std::ref(map));
+                    auto define_cabins_future = std::async(std::launch::async, stage.Journaled(WithBudget(STRUCTURES_BUDGET, DefineCabins)), std::ref(map));
+                    auto define_castles_future = std::async(std::launch::async, stage.Journaled(WithBudget(STRUCTURES_BUDGET, DefineCastles)), std::ref(map));
+
+                    map.SetGenerationMessage("DEFINITION OF HILLS, HOLES, ISLANDS...");
+                    if (define_structures_future.wait_until(deadline) == std::future_status::timeout)
+                    {
+                        map.SetForceStop(true);
+                        map.Error("DEFINITION OF HILLS, HOLES, ISLANDS INFEASIBLE");
+                    }
+
+                    map.SetGenerationMessage("DEFINITION OF UNDERGROUND CABINS...");
+                    if (define_cabins_future.wait_until(deadline) == std::future_status::timeout)
+                    {
+                        map.SetForceStop(true);
+                        map.Error("DEFINITION OF UNDERGROUND CABINS INFEASIBLE");
+                    }
+
+                    map.SetGenerationMessage("DEFINITION OF UNDERGROUND CASTLES...");
+                    if (define_castles_future.wait_until(deadline) == std::future_status::timeout)
+                    {
+                        map.SetForceStop(true);
+                        map.Error("DEFINITION OF UNDERGROUND CASTLES INFEASIBLE");
+                    }
+                });
             }
 
-            if (!map.ShouldForceStop() && GenerateStage3)
+            if (!map.ShouldForceStop() && map.GenerateStage(3))
             {
                 map.ClearStage3();
-                map.SetGenerationMessage("DEFINITION OF SURFACE...");
-                DefineSurface(map);
-                map.SetGenerationMessage("GENERATION OF HILLS...");
-                GenerateHills(map);
-                map.SetGenerationMessage("GENERATION OF HOLES...");
-                GenerateHoles(map);
-                map.SetGenerationMessage("GENERATION OF CLIFFS AND TRANSITIONS...");
-                GenerateCliffsTransitions(map);
-                map.SetGenerationMessage("GENERATION OF LEFT OCEAN...");
-                GenerateOceanLeft(map);
-                map.SetGenerationMessage("GENERATION OF RIGHT OCEAN...");
-                GenerateOceanRight(map);
-                map.SetGenerationMessage("GENERATION OF CHASMS...");
-                GenerateChasms(map);
-                map.SetGenerationMessage("GENERATION OF LAKES...");
-                GenerateLakes(map);
-                map.SetGenerationMessage("GENERATION OF JUNGLE SWAMP...");
-                GenerateJungleSwamp(map);
-                map.SetGenerationMessage("GENERATION OF GRASS...");
-                GenerateGrass(map);
-
-                auto generate_trees_future = std::async(std::launch::async, GenerateTrees, std::ref(map));
-                map.SetGenerationMessage("GENERATION OF TREES...");
-                if (generate_trees_future.wait_for(2s) == std::future_status::timeout)
+                StageRecorder stage {map, Name(), 3};
+                if (!stage.Restore()) stage.Record([&]()
                 {
-                    map.SetForceStop(true);
-                    map.Error("DEFINITION OF TREES INFEASIBLE"); 
-                }
-                map.SetGenerationMessage("GENERATION OF ISLANDS...");
-                GenerateIslands(map);
-
-                map.SetGenerationMessage("GENERATION OF SURFACE MATERIALS...");
-                GenerateSurfaceMaterials(map);
-                map.SetGenerationMessage("GENERATION OF SURFACE ORES...");
-                GenerateSurfaceOres(map);
+                    map.SetGenerationMessage("DEFINITION OF SURFACE...");
+                    DefineSurface(map);
+                    map.SetGenerationMessage("GENERATION OF HILLS...");
+                    GenerateHills(map);
+                    map.SetGenerationMessage("GENERATION OF HOLES...");
+                    GenerateHoles(map);
+                    map.SetGenerationMessage("GENERATION OF CLIFFS AND TRANSITIONS...");
+                    GenerateCliffsTransitions(map);
+                    map.SetGenerationMessage("GENERATION OF LEFT OCEAN...");
+                    GenerateOceanLeft(map);
+                    map.SetGenerationMessage("GENERATION OF RIGHT OCEAN...");
+                    GenerateOceanRight(map);
+                    map.SetGenerationMessage("GENERATION OF CHASMS...");
+                    GenerateChasms(map);
+                    map.SetGenerationMessage("GENERATION OF LAKES...");
+                    GenerateLakes(map);
+                    map.SetGenerationMessage("GENERATION OF JUNGLE SWAMP...");
+                    GenerateJungleSwamp(map);
+                    map.SetGenerationMessage("GENERATION OF GRASS...");
+                    GenerateGrass(map);
+
+                    auto generate_trees_future = std::async(std::launch::async, stage.Journaled(WithBudget(TREES_BUDGET, GenerateTrees)), std::ref(map));
+                    map.SetGenerationMessage("GENERATION OF TREES...");
+                    if (generate_trees_future.wait_for(TREES_BUDGET + BUDGET_GRACE) == std::future_status::timeout)
+                    {
+                        map.SetForceStop(true);
+                        map.Error("DEFINITION OF TREES INFEASIBLE"); 
+                    }
+                    map.SetGenerationMessage("GENERATION OF ISLANDS...");
+                    GenerateIslands(map);
+
+                    map.SetGenerationMessage("GENERATION OF SURFACE MATERIALS...");
+                    GenerateSurfaceMaterials(map);
+                    map.SetGenerationMessage("GENERATION OF SURFACE ORES...");
+                    GenerateSurfaceOres(map);
+                });
             }
             
             for (auto& pair: futures_to_wait)
@@ -868,7 +1263,7 @@ class Scene8: public Scene
                 auto error_message = std::get<1>(pair);
                 auto& future = std::get<2>(pair);
                 map.SetGenerationMessage(message);
-                if (future.wait_for(5s) == std::future_status::timeout)
+                if (future.wait_for(UNDERGROUND_BUDGET) == std::future_status::timeout)
                 {
                     map.SetForceStop(true);
                     map.Error(error_message);
@@ -876,6 +1271,7 @@ class Scene8: public Scene
             }
         };
 
+#ifndef HEADLESS
         virtual void Render(Map& map) override
         {
             DrawHorizontal(map);
@@ -885,43 +1281,60 @@ class Scene8: public Scene
             DrawSurfaceDebug(map);
 #endif
         };
+#endif
 
 };
 
 class Scene9: public Scene
 {
     public:
+        virtual const char* Name() const override { return "Scene9"; };
+
         virtual void Run(Map& map) override
         {
+            std::unique_ptr<StageRecorder> underground;
             std::vector<std::tuple<std::string, std::string, std::future<void>>> futures_to_wait;
 
             map.ClearStage2();
             map.ClearStage3();
 
-            if (!map.ShouldForceStop() && GenerateStage0)
+            if (!map.ShouldForceStop() && map.GenerateStage(0))
             {
                 map.ClearStage0();
-                map.SetGenerationMessage("DEFINITION OF HORIZONTAL AREAS...");
-                DefineHorizontal(map);
+                StageRecorder stage {map, Name(), 0};
+                if (!stage.Restore()) stage.Record([&]()
+                {
+                    map.SetGenerationMessage("DEFINITION OF HORIZONTAL AREAS...");
+                    DefineHorizontal(map);
+                });
             }
 
-            if (!map.ShouldForceStop() && GenerateStage1)
+            if (!map.ShouldForceStop() && map.GenerateStage(1))
             {
                 map.ClearStage1();
-                map.SetGenerationMessage("DEFINITION OF BIOMES...");
-                DefineBiomes(map);
+                StageRecorder stage {map, Name(), 1};
+                if (!stage.Restore()) stage.Record([&]()
+                {
+                    map.SetGenerationMessage("DEFINITION OF BIOMES...");
+                    DefineBiomes(map);
+                });
             }
 
-            if (!map.ShouldForceStop() && GenerateStage4)
+            if (!map.ShouldForceStop() && map.GenerateStage(4))
             {
                 map.ClearStage4();
-                map.SetGenerationMessage("GENERATION OF CAVES...");
-                auto generate_caves_future = std::async(std::launch::async, GenerateCaves, std::ref(map));
-                futures_to_wait.emplace_back(
-                        "GENERATION OF CAVES...", 
-                        "GENERATION OF CAVES INFEASIBLE...", 
-                        std::move(generate_caves_future)
-                );
+                underground.reset(new StageRecorder(map, Name(), 4));
+                if (!underground->Restore())
+                {
+                    map.SetGenerationMessage("GENERATION OF CAVES...");
+                    auto generate_caves_future = std::async(std::launch::async, underground->Journaled(GenerateCaves), std::ref(map));
+                    futures_to_wait.emplace_back(
+                            "GENERATION OF CAVES...", 
+                            "GENERATION OF CAVES INFEASIBLE...", 
+                            std::move(generate_caves_future)
+                    );
+                }
+                else underground.reset();
             }
             
             for (auto& pair: futures_to_wait)
@@ -930,14 +1343,18 @@ class Scene9: public Scene
                 auto error_message = std::get<1>(pair);
                 auto& future = std::get<2>(pair);
                 map.SetGenerationMessage(message);
-                if (future.wait_for(5s) == std::future_status::timeout)
+                if (future.wait_for(UNDERGROUND_BUDGET) == std::future_status::timeout)
                 {
                     map.SetForceStop(true);
                     map.Error(error_message);
                 }
             }
+
+            if (underground != nullptr)
+                underground->Store();
         };
 
+#ifndef HEADLESS
         virtual void Render(Map& map) override
         {
             DrawHorizontal(map);
@@ -947,6 +1364,7 @@ class Scene9: public Scene
             DrawSurfaceDebug(map);
 #endif
         };
+#endif
 
 };
 
@@ -954,37 +1372,53 @@ class Scene9: public Scene
 class Scene10: public Scene
 {
     public:
+        virtual const char* Name() const override { return "Scene10"; };
+
         virtual void Run(Map& map) override
         {
+            std::unique_ptr<StageRecorder> underground;
             std::vector<std::tuple<std::string, std::string, std::future<void>>> futures_to_wait;
 
             map.ClearStage2();
             map.ClearStage3();
             
-            if (!map.ShouldForceStop() && GenerateStage0)
+            if (!map.ShouldForceStop() && map.GenerateStage(0))
             {
                 map.ClearStage0();
-                map.SetGenerationMessage("DEFINITION OF HORIZONTAL AREAS...");
-                DefineHorizontal(map);
+                StageRecorder stage {map, Name(), 0};
+                if (!stage.Restore()) stage.Record([&]()
+                {
+                    map.SetGenerationMessage("DEFINITION OF HORIZONTAL AREAS...");
+                    DefineHorizontal(map);
+                });
             }
 
-            if (!map.ShouldForceStop() && GenerateStage1)
+            if (!map.ShouldForceStop() && map.GenerateStage(1))
             {
                 map.ClearStage1();
-                map.SetGenerationMessage("DEFINITION OF BIOMES...");
-                DefineBiomes(map);
+                StageRecorder stage {map, Name(), 1};
+                if (!stage.Restore()) stage.Record([&]()
+                {
+                    map.SetGenerationMessage("DEFINITION OF BIOMES...");
+                    DefineBiomes(map);
+                });
             }
 
-            if (!map.ShouldForceStop() && GenerateStage4)
+            if (!map.ShouldForceStop() && map.GenerateStage(4))
             {
                 map.ClearStage4();
-                map.SetGenerationMessage("GENERATION OF CAVES...");
-                auto generate_caves_future = std::async(std::launch::async, GenerateCaves, std::ref(map));
-                futures_to_wait.emplace_back(
-                        "GENERATION OF CAVES...", 
-                        "GENERATION OF CAVES INFEASIBLE...", 
-                        std::move(generate_caves_future)
-                );
+                underground.reset(new StageRecorder(map, Name(), 4));
+                if (!underground->Restore())
+                {
+                    map.SetGenerationMessage("GENERATION OF CAVES...");
+                    auto generate_caves_future = std::async(std::launch::async, underground->Journaled(GenerateCaves), std::ref(map));
+                    futures_to_wait.emplace_back(
+                            "GENERATION OF CAVES...", 
+                            "GENERATION OF CAVES INFEASIBLE...", 
+                            std::move(generate_caves_future)
+                    );
+                }
+                else underground.reset();
             }
             
             for (auto& pair: futures_to_wait)
@@ -993,7 +1427,7 @@ class Scene10: public Scene
                 auto error_message = std::get<1>(pair);
                 auto& future = std::get<2>(pair);
                 map.SetGenerationMessage(message);
-                if (future.wait_for(5s) == std::future_status::timeout)
+                if (future.wait_for(UNDERGROUND_BUDGET) == std::future_status::timeout)
                 {
                     map.SetForceStop(true);
                     map.Error(error_message);
@@ -1001,19 +1435,17 @@ class Scene10: public Scene
             }
 
 
-            if (!map.ShouldForceStop() && GenerateStage4)
+            if (!map.ShouldForceStop() && underground != nullptr)
             {
-                map.SetGenerationMessage("GENERATION OF UNDERGROUND MATERIALS...");
-                GenerateUndergroudMaterials(map);
-                map.SetGenerationMessage("GENERATION OF UNDERGROUND ORES...");
-                GenerateUndergroundOres(map);
-                map.SetGenerationMessage("GENERATION OF CAVERN MATERIALS...");
-                GenerateCavernMaterials(map);
-                map.SetGenerationMessage("GENERATION OF CAVERN ORES...");
-                GenerateCavernOres(map);
+                underground->Record([&]()
+                {
+                    map.SetGenerationMessage("GENERATION OF UNDERGROUND AND CAVERN MATERIALS...");
+                    GenerateUndergroundCavernMaterials(map, *underground);
+                });
             }
         };
 
+#ifndef HEADLESS
         virtual void Render(Map& map) override
         {
             DrawHorizontal(map);
@@ -1023,43 +1455,60 @@ class Scene10: public Scene
             DrawSurfaceDebug(map);
 #endif
         };
+#endif
 
 };
 
 class Scene11: public Scene
 {
     public:
+        virtual const char* Name() const override { return "Scene11"; };
+
         virtual void Run(Map& map) override
         {
+            std::unique_ptr<StageRecorder> underground;
             std::vector<std::tuple<std::string, std::string, std::future<void>>> futures_to_wait;
 
             map.ClearStage2();
             map.ClearStage3();
             
-            if (!map.ShouldForceStop() && GenerateStage0)
+            if (!map.ShouldForceStop() && map.GenerateStage(0))
             {
                 map.ClearStage0();
-                map.SetGenerationMessage("DEFINITION OF HORIZONTAL AREAS...");
-                DefineHorizontal(map);
+                StageRecorder stage {map, Name(), 0};
+                if (!stage.Restore()) stage.Record([&]()
+                {
+                    map.SetGenerationMessage("DEFINITION OF HORIZONTAL AREAS...");
+                    DefineHorizontal(map);
+                });
             }
 
-            if (!map.ShouldForceStop() && GenerateStage1)
+            if (!map.ShouldForceStop() && map.GenerateStage(1))
             {
                 map.ClearStage1();
-                map.SetGenerationMessage("DEFINITION OF BIOMES...");
-                DefineBiomes(map);
+                StageRecorder stage {map, Name(), 1};
+                if (!stage.Restore()) stage.Record([&]()
+                {
+                    map.SetGenerationMessage("DEFINITION OF BIOMES...");
+                    DefineBiomes(map);
+                });
             }
 
-            if (!map.ShouldForceStop() && GenerateStage4)
+            if (!map.ShouldForceStop() && map.GenerateStage(4))
             {
                 map.ClearStage4();
-                map.SetGenerationMessage("GENERATION OF CAVES...");
-                auto generate_caves_future = std::async(std::launch::async, GenerateCaves, std::ref(map));
-                futures_to_wait.emplace_back(
-                        "GENERATION OF CAVES...", 
-                        "GENERATION OF CAVES INFEASIBLE...", 
-                        std::move(generate_caves_future)
-                );
+                underground.reset(new StageRecorder(map, Name(), 4));
+                if (!underground->Restore())
+                {
+                    map.SetGenerationMessage("GENERATION OF CAVES...");
+                    auto generate_caves_future = std::async(std::launch::async, underground->Journaled(GenerateCaves), std::ref(map));
+                    futures_to_wait.emplace_back(
+                            "GENERATION OF CAVES...", 
+                            "GENERATION OF CAVES INFEASIBLE...", 
+                            std::move(generate_caves_future)
+                    );
+                }
+                else underground.reset();
             }
             
             for (auto& pair: futures_to_wait)
@@ -1068,28 +1517,26 @@ class Scene11: public Scene
                 auto error_message = std::get<1>(pair);
                 auto& future = std::get<2>(pair);
                 map.SetGenerationMessage(message);
-                if (future.wait_for(5s) == std::future_status::timeout)
+                if (future.wait_for(UNDERGROUND_BUDGET) == std::future_status::timeout)
                 {
                     map.SetForceStop(true);
                     map.Error(error_message);
                 }
             }
 
-            if (!map.ShouldForceStop() && GenerateStage4)
+            if (!map.ShouldForceStop() && underground != nullptr)
             {
-                map.SetGenerationMessage("GENERATION OF UNDERGROUND MATERIALS...");
-                GenerateUndergroudMaterials(map);
-                map.SetGenerationMessage("GENERATION OF UNDERGROUND ORES...");
-                GenerateUndergroundOres(map);
-                map.SetGenerationMessage("GENERATION OF CAVERN MATERIALS...");
-                GenerateCavernMaterials(map);
-                map.SetGenerationMessage("GENERATION OF CAVERN ORES...");
-                GenerateCavernOres(map);
-                map.SetGenerationMessage("GENERATION OF CAVE LAKES...");
-                GenerateCaveLakes(map);
+                underground->Record([&]()
+                {
+                    map.SetGenerationMessage("GENERATION OF UNDERGROUND AND CAVERN MATERIALS...");
+                    GenerateUndergroundCavernMaterials(map, *underground);
+                    map.SetGenerationMessage("GENERATION OF CAVE LAKES...");
+                    GenerateCaveLakes(map);
+                });
             }
         };
 
+#ifndef HEADLESS
         virtual void Render(Map& map) override
         {
             DrawHorizontal(map);
@@ -1099,6 +1546,28 @@ class Scene11: public Scene
             DrawSurfaceDebug(map);
 #endif
         };
+#endif
 
 };
+/**
+ * Create new instance of scene by its name, nullptr if there is no such scene
+ */
+inline Scene* CreateScene(const std::string& name)
+{
+    if (name == "DefaultScene") return new DefaultScene();
+    if (name == "Scene0") return new Scene0();
+    if (name == "Scene1") return new Scene1();
+    if (name == "Scene2") return new Scene2();
+    if (name == "Scene3") return new Scene3();
+    if (name == "Scene4") return new Scene4();
+    if (name == "Scene5") return new Scene5();
+    if (name == "Scene6") return new Scene6();
+    if (name == "Scene7") return new Scene7();
+    if (name == "Scene8") return new Scene8();
+    if (name == "Scene9") return new Scene9();
+    if (name == "Scene10") return new Scene10();
+    if (name == "Scene11") return new Scene11();
+    return nullptr;
+};
+
 #endif // SCENE
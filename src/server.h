@@ -0,0 +1,425 @@
+#ifndef SERVER
+#define SERVER
+
+#include <stdio.h>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <queue>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#ifndef UTILS
+#include "utils.h"
+#endif
+
+#ifndef POOL
+#include "pool.h"
+#endif
+
+#ifndef WORLD
+#include "world.h"
+#endif
+
+#ifndef BATCH
+#include "batch.h"
+#endif
+
+/************************************************
+*
+* GENERATION SERVER
+*
+*************************************************/
+
+/**
+ * Loopback HTTP server generating worlds on request
+ *
+ *   GET /generate?seed=N[&scene=NAME][&scale=S][&priority=P][&inline=1][&name=value]...
+ *   GET /stats
+ *
+ * Requests wait in bounded priority queue, higher priority first and then in arrival order, and
+ * are served by workers which keep their maps warm between requests. World is written to output
+ * directory and its path returned, or sent in response body with inline=1
+ */
+class GenerationServer
+{
+    protected:
+        struct Request
+        {
+            int priority {0};
+            uint64_t sequence {0};
+            int fd {-1};
+            bool inline_world {false};
+            WorldJob job;
+            std::chrono::steady_clock::time_point arrival;
+
+            bool operator<(const Request& other) const
+            {
+                if (priority != other.priority) return priority < other.priority;
+                return sequence > other.sequence;
+            };
+        };
+
+        const size_t LATENCY_WINDOW = 4096;
+
+        /**
+         * Time for client to send whole request head, heads are read on accepting thread so slow
+         * client would hold back all later requests
+         */
+        static constexpr int HEAD_TIMEOUT_MS = 2000;
+
+        int port;
+        unsigned int workers_count;
+        size_t capacity;
+        std::string out_dir;
+
+        std::priority_queue<Request> queue;
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::vector<std::thread> workers;
+        uint64_t sequence {0};
+        bool stop {false};
+
+        // STATS
+        std::mutex stats_mutex;
+        uint64_t served {0};
+        uint64_t failed {0};
+        uint64_t rejected {0};
+        std::vector<double> latencies;
+        size_t latency_next {0};
+        std::chrono::steady_clock::time_point started;
+
+        static void Send(int fd, int status, const char* reason, const std::string& type, const void* body, size_t size)
+        {
+            auto header = "HTTP/1.1 " + std::to_string(status) + " " + reason + "\r\n"
+                "Content-Type: " + type + "\r\n"
+                "Content-Length: " + std::to_string(size) + "\r\n"
+                "Connection: close\r\n\r\n";
+
+            auto write_all = [fd](const char* data, size_t length)
+            {
+                while (length > 0)
+                {
+                    auto n = send(fd, data, length, MSG_NOSIGNAL);
+                    if (n <= 0) return;
+                    data += n;
+                    length -= n;
+                }
+            };
+            write_all(header.data(), header.size());
+            write_all(static_cast<const char*>(body), size);
+            close(fd);
+        };
+
+        static void SendText(int fd, int status, const char* reason, const std::string& text)
+        {
+            Send(fd, status, reason, "text/plain", text.data(), text.size());
+        };
+
+        /**
+         * Read request head, empty if connection closed, head is too large or it does not arrive
+         * within HEAD_TIMEOUT_MS
+         */
+        static std::string ReadHead(int fd)
+        {
+            timeval timeout;
+            timeout.tv_sec = HEAD_TIMEOUT_MS / 1000;
+            timeout.tv_usec = (HEAD_TIMEOUT_MS % 1000) * 1000;
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+            // TIMEOUT OF EACH RECEIVE DOES NOT STOP CLIENT SENDING HEAD BYTE BY BYTE, SO WHOLE HEAD HAS DEADLINE
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(HEAD_TIMEOUT_MS);
+            std::string head;
+            char buffer[1024];
+            while (head.find("\r\n\r\n") == std::string::npos && head.size() < 8192)
+            {
+                if (std::chrono::steady_clock::now() > deadline)
+                    return "";
+                auto n = recv(fd, buffer, sizeof(buffer), 0);
+                if (n <= 0) return "";
+                head.append(buffer, n);
+            }
+            return head;
+        };
+
+        /**
+         * Parse query of generate request into job, false with error message if it is invalid
+         */
+        bool ParseGenerate(const std::string& query, Request& request, std::string& error)
+        {
+            auto has_seed = false;
+            size_t position = 0;
+            while (position < query.size())
+            {
+                auto stop = query.find('&', position);
+                if (stop == std::string::npos) stop = query.size();
+                auto token = query.substr(position, stop - position);
+                position = stop + 1;
+                if (token.empty())
+                    continue;
+
+                auto eq = token.find('=');
+                auto name = token.substr(0, eq);
+                auto value = eq == std::string::npos ? std::string() : token.substr(eq + 1);
+                if (name == "seed") { request.job.seed = strtoul(value.c_str(), nullptr, 10); has_seed = true; }
+                else if (name == "scene") request.job.scene = value;
+                else if (name == "scale") request.job.scale = strtof(value.c_str(), nullptr);
+                else if (name == "priority") request.priority = atoi(value.c_str());
+                else if (name == "inline") request.inline_world = value == "1" || value == "true";
+                else if (!ParseParameter(name, value, request.job.parameters, error)) return false;
+            }
+
+            if (!has_seed)
+            {
+                error = "SEED IS REQUIRED";
+                return false;
+            }
+
+            if (request.job.scale <= 0 || request.job.scale > 4)
+            {
+                error = "SCALE HAS TO BE IN (0, 4]";
+                return false;
+            }
+
+            std::unique_ptr<Scene> scene {CreateScene(request.job.scene)};
+            if (scene == nullptr)
+            {
+                error = "UNKNOWN SCENE " + request.job.scene;
+                return false;
+            }
+            return true;
+        };
+
+        void Record(double ms, bool ok)
+        {
+            const std::lock_guard<std::mutex> lock(stats_mutex);
+            if (!ok)
+            {
+                failed += 1;
+                return;
+            }
+
+            served += 1;
+            if (latencies.size() < LATENCY_WINDOW)
+                latencies.push_back(ms);
+            else
+                latencies[latency_next] = ms;
+            latency_next = (latency_next + 1) % LATENCY_WINDOW;
+        };
+
+        std::string Stats()
+        {
+            size_t depth;
+            {
+                const std::lock_guard<std::mutex> lock(mutex);
+                depth = queue.size();
+            }
+
+            const std::lock_guard<std::mutex> lock(stats_mutex);
+            auto sorted = latencies;
+            std::sort(sorted.begin(), sorted.end());
+            auto percentile = [&](double p)
+            {
+                if (sorted.empty()) return 0.0;
+                auto index = (size_t) std::ceil(p * sorted.size()) - 1;
+                return sorted[std::min(index, sorted.size() - 1)];
+            };
+
+            auto uptime = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+            char json[512];
+            snprintf(json, sizeof(json),
+                "{\"uptime_s\": %.1f, \"served\": %llu, \"failed\": %llu, \"rejected\": %llu, \"queued\": %zu, \"capacity\": %zu, "
+                "\"workers\": %u, \"latency_ms\": {\"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"max\": %.1f}, "
+                "\"cache_hit_rate\": %.2f, \"peak_rss_mb\": %.0f}\n",
+                uptime, (unsigned long long) served, (unsigned long long) failed, (unsigned long long) rejected, depth, capacity,
+                workers_count, percentile(0.5), percentile(0.9), percentile(0.99), sorted.empty() ? 0.0 : sorted.back(),
+                SharedStageCache().HitRate(), PeakRSS());
+            return json;
+        };
+
+        /**
+         * Worker serves queued requests on its own warm map
+         */
+        void Work(unsigned int index)
+        {
+            TaskGroup() = index + 1;
+            std::unique_ptr<Map> map {new Map()};
+            auto generated = 0;
+
+            while (true)
+            {
+                Request request;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.wait(lock, [&](){ return stop || !queue.empty(); });
+                    if (stop && queue.empty())
+                        return;
+                    request = queue.top();
+                    queue.pop();
+                }
+
+                std::string error;
+                auto ok = GenerateWorld(*map, request.job, error);
+                auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - request.arrival).count();
+                if (!ok)
+                {
+                    Record(ms, false);
+                    SendText(request.fd, 500, "Internal Server Error", error + "\n");
+                    continue;
+                }
+
+                auto world = EncodeWorld(*map);
+                if (request.inline_world)
+                {
+                    Record(ms, true);
+                    Send(request.fd, 200, "OK", "application/octet-stream", world.data(), world.size());
+                    continue;
+                }
+
+                auto path = out_dir + "/world_" + std::to_string(index) + "_" + std::to_string(generated++) + ".pcgw";
+                if (!WriteWorld(path, world))
+                {
+                    Record(ms, false);
+                    SendText(request.fd, 500, "Internal Server Error", "CAN NOT WRITE " + path + "\n");
+                    continue;
+                }
+
+                Record(ms, true);
+                char json[512];
+                snprintf(json, sizeof(json), "{\"path\": \"%s\", \"seed\": %u, \"ms\": %.1f, \"degraded\": \"%s\"}\n",
+                    path.c_str(), request.job.seed, ms, map->Degradations().c_str());
+                Send(request.fd, 200, "OK", "application/json", json, strlen(json));
+            }
+        };
+
+        void Handle(int fd)
+        {
+            auto head = ReadHead(fd);
+            auto line_end = head.find("\r\n");
+            auto method_end = head.find(' ');
+            if (line_end == std::string::npos || method_end == std::string::npos || method_end > line_end)
+            {
+                SendText(fd, 400, "Bad Request", "MALFORMED REQUEST\n");
+                return;
+            }
+
+            auto target_end = head.find(' ', method_end + 1);
+            auto target = head.substr(method_end + 1, std::min(target_end, line_end) - method_end - 1);
+            auto question = target.find('?');
+            auto path = target.substr(0, question);
+            auto query = question == std::string::npos ? std::string() : target.substr(question + 1);
+
+            if (path == "/stats")
+            {
+                auto stats = Stats();
+                Send(fd, 200, "OK", "application/json", stats.data(), stats.size());
+                return;
+            }
+
+            if (path != "/generate")
+            {
+                SendText(fd, 404, "Not Found", "UNKNOWN PATH " + path + "\n");
+                return;
+            }
+
+            Request request;
+            std::string error;
+            if (!ParseGenerate(query, request, error))
+            {
+                SendText(fd, 400, "Bad Request", error + "\n");
+                return;
+            }
+
+            {
+                const std::lock_guard<std::mutex> lock(mutex);
+                if (queue.size() < capacity)
+                {
+                    request.fd = fd;
+                    request.sequence = sequence++;
+                    request.arrival = std::chrono::steady_clock::now();
+                    queue.push(std::move(request));
+                    cv.notify_one();
+                    return;
+                }
+            }
+
+            // QUEUE IS FULL, CLIENT SHOULD RETRY LATER
+            {
+                const std::lock_guard<std::mutex> lock(stats_mutex);
+                rejected += 1;
+            }
+            SendText(fd, 503, "Service Unavailable", "QUEUE IS FULL\n");
+        };
+
+    public:
+        GenerationServer(int _port, unsigned int _workers, size_t _capacity, const std::string& _out_dir):
+            port{_port}, workers_count{std::max(1u, _workers)}, capacity{std::max<size_t>(1, _capacity)}, out_dir{_out_dir} {};
+
+        ~GenerationServer()
+        {
+            {
+                const std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+            }
+            cv.notify_all();
+            for (auto& worker: workers)
+                worker.join();
+        };
+
+        /**
+         * Accept connections on loopback until listening fails, returns false if it can not start
+         */
+        bool Serve()
+        {
+            auto listener = socket(AF_INET, SOCK_STREAM, 0);
+            if (listener < 0)
+                return false;
+
+            int reuse = 1;
+            setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+            sockaddr_in address;
+            memset(&address, 0, sizeof(address));
+            address.sin_family = AF_INET;
+            address.sin_port = htons(port);
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            if (bind(listener, (sockaddr*) &address, sizeof(address)) < 0 || listen(listener, 64) < 0)
+            {
+                close(listener);
+                return false;
+            }
+
+            started = std::chrono::steady_clock::now();
+            for (auto i = 0u; i < workers_count; ++i)
+                workers.emplace_back(&GenerationServer::Work, this, i);
+
+            printf("Serving on 127.0.0.1:%d with %u workers, queue of %zu\n", port, workers_count, capacity);
+            fflush(stdout);
+
+            while (true)
+            {
+                auto fd = accept(listener, nullptr, nullptr);
+                if (fd < 0)
+                    break;
+                Handle(fd);
+            }
+
+            close(listener);
+            return true;
+        };
+};
+
+#endif // SERVER
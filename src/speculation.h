@@ -0,0 +1,165 @@
+#ifndef SPECULATION
+#define SPECULATION
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+
+#ifndef UTILS
+#include "utils.h"
+#endif
+
+#ifndef SCENE
+#include "scene.h"
+#endif
+
+/************************************************
+*
+* SPECULATIVE PRE-GENERATION
+*
+*************************************************/
+
+/**
+ * Pre-generates results of neighbouring slider values on scratch map while
+ * the pipeline is idle, results end up in StageCache so moving the slider to
+ * speculated value is restored instead of generated
+ */
+class Speculator
+{
+    public:
+        typedef std::function<void (Map&, float)> Apply;
+
+    protected:
+        struct Job
+        {
+            Map* source;
+            std::string scene;
+            Apply apply;
+            float value;
+        };
+
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<Job> jobs;
+        unsigned long generation {0}; // INCREMENTED BY EVERY PREEMPTION
+        bool stop {false};
+
+        Map scratch;
+        std::thread worker;
+
+        void Run(Job& job, unsigned long gen)
+        {
+            if (!scratch.IsInitialized())
+                scratch.Init();
+
+            std::unique_ptr<Scene> scene {CreateScene(job.scene)};
+            if (scene == nullptr)
+                return;
+
+            // SCRATCH MAP FOLLOWS STAGES OF SOURCE MAP, STALE STAGES ARE RESTORED FROM CACHE
+            scratch.CopyParameters(*job.source);
+            bool stale[5];
+            for (auto n = 0; n < 5; ++n)
+                stale[n] = scratch.StageVersion(n) == 0 || scratch.StageVersion(n) != job.source->StageVersion(n);
+            if (stale[0]) stale[1] = stale[2] = stale[3] = stale[4] = true;
+            if (stale[1]) stale[2] = stale[3] = true;
+            if (stale[2]) stale[3] = true;
+            for (auto n = 0; n < 5; ++n)
+                scratch.GenerateStage(n, stale[n]);
+
+            job.apply(scratch, job.value);
+
+            {
+                const std::lock_guard<std::mutex> lock(mutex);
+                if (gen != generation)
+                    return;
+                scratch.SetForceStop(false);
+            }
+
+#ifdef DEBUG
+            printf("Speculate %s %.2f\n", job.scene.c_str(), job.value);
+#endif
+            scene->Run(scratch);
+            if (!scratch.ShouldForceStop())
+                GenerationDone(scratch);
+        };
+
+        void Loop()
+        {
+            while (true)
+            {
+                Job job;
+                unsigned long gen;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.wait_for(lock, std::chrono::milliseconds(100), [&](){ return stop || !jobs.empty(); });
+                    if (stop)
+                        return;
+
+                    // ONLY WHEN PIPELINE IS IDLE
+                    if (jobs.empty() || jobs.front().source->IsGenerating())
+                        continue;
+
+                    job = std::move(jobs.front());
+                    jobs.pop_front();
+                    gen = generation;
+                }
+                Run(job, gen);
+            }
+        };
+
+    public:
+        Speculator(): worker{&Speculator::Loop, this} {};
+
+        ~Speculator()
+        {
+            {
+                const std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+                scratch.SetForceStop(true);
+            }
+            cv.notify_all();
+            worker.join();
+        };
+
+        /**
+         * Drop queued speculation and stop the running one, called for every real request
+         */
+        void Preempt()
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            jobs.clear();
+            generation += 1;
+            scratch.SetForceStop(true);
+        };
+
+        /**
+         * Queue neighbouring positions of last touched slider, positions in direction of
+         * last movement go first
+         */
+        void Speculate(Map& map, const std::string& scene, Apply apply, float value, float previous, float step)
+        {
+            if (step <= 0 || map.StageVersion(0) == 0)
+                return;
+
+            auto direction = value >= previous ? 1 : -1;
+            const std::lock_guard<std::mutex> lock(mutex);
+            for (auto offset: {direction, 2 * direction, -direction, -2 * direction})
+            {
+                auto v = std::round((value + offset * step) / step) * step;
+                if (v < 0 || v > 1)
+                    continue;
+                jobs.push_back({&map, scene, apply, v});
+            }
+            cv.notify_one();
+        };
+};
+
+#endif // SPECULATION
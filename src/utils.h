@@ -14,6 +14,11 @@
 #include <limits>
 #include <atomic>
 #include <bitset>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <chrono>
+#include <string>
 
 class Map;
 namespace Structures { 
@@ -53,6 +58,12 @@ inline auto RectUnion(const Rect& r0, const Rect& r1)
     return (Rect){x0, y0, x1 - x0, y1 - y0};
 };
 
+inline bool RectsOverlap(const Rect& r0, const Rect& r1)
+{
+    return r0.x <= r1.x + r1.w && r1.x <= r0.x + r0.w &&
+           r0.y <= r1.y + r1.h && r1.y <= r0.y + r0.h;
+};
+
 typedef struct Pixel 
 {
     int x;
@@ -81,6 +92,145 @@ typedef struct PixelMetadata
     Structures::GeneratedStructure* generated_structure { nullptr };
 } PixelMetadata;
 
+/**
+ * Dense per pixel layers with type of biome or structure, 0 where there is none
+ */
+namespace Layers
+{
+    enum Layer: int { BIOME, DEFINED_STRUCTURE, GENERATED_STRUCTURE, COUNT };
+};
+
+
+/**
+ * Records which metadata layers were written for every pixel while active
+ */
+class MetadataJournal
+{
+    protected:
+        int width;
+        int height;
+        std::unique_ptr<std::atomic<unsigned char>[]> layers;
+
+    public:
+        static const unsigned char BIOME        = 1 << 0;
+        static const unsigned char DEFINED      = 1 << 1;
+        static const unsigned char GENERATED    = 1 << 2;
+
+        MetadataJournal(int _width, int _height): width{_width}, height{_height}, 
+            layers{new std::atomic<unsigned char>[(_width + 1) * (_height + 1)]}
+        {
+            for (auto i = 0; i < (width + 1) * (height + 1); ++i) layers[i] = 0;
+        };
+
+        auto Width() const { return width; };
+        auto Height() const { return height; };
+        auto Size() const { return (width + 1) * (height + 1); };
+        auto Layers(int index) const { return layers[index].load(std::memory_order_relaxed); };
+
+        void Record(Pixel p, const PixelMetadata& from, const PixelMetadata& to)
+        {
+            if (p.x < 0 || p.x > width || p.y < 0 || p.y > height)
+                return;
+
+            unsigned char mask = 0;
+            if (from.biome != to.biome) mask |= BIOME;
+            if (from.defined_structure != to.defined_structure) mask |= DEFINED;
+            if (from.generated_structure != to.generated_structure) mask |= GENERATED;
+            if (mask != 0) Record(p, mask);
+        };
+
+        void Record(Pixel p, unsigned char mask)
+        {
+            if (p.x < 0 || p.x > width || p.y < 0 || p.y > height)
+                return;
+
+            layers[p.y * (width + 1) + p.x].fetch_or(mask, std::memory_order_relaxed);
+        };
+};
+
+/**
+ * Journal which records metadata writes of current thread
+ */
+inline MetadataJournal*& ActiveJournal()
+{
+    static thread_local MetadataJournal* journal = nullptr;
+    return journal;
+};
+
+class WriteArea;
+
+/**
+ * Area declared by stage running on current thread
+ */
+inline WriteArea*& ActiveWriteArea()
+{
+    static thread_local WriteArea* area = nullptr;
+    return area;
+};
+
+inline void CheckWriteArea(Pixel p);
+
+/**
+ * Wall clock deadline of stage running on current thread
+ */
+class StageBudget
+{
+    protected:
+        std::chrono::steady_clock::time_point deadline;
+
+    public:
+        explicit StageBudget(std::chrono::steady_clock::duration budget):
+            deadline{std::chrono::steady_clock::now() + budget} {};
+
+        bool Expired() const
+        {
+            return std::chrono::steady_clock::now() >= deadline;
+        };
+};
+
+inline StageBudget*& ActiveBudget()
+{
+    static thread_local StageBudget* budget = nullptr;
+    return budget;
+};
+
+/**
+ * True when stage on current thread ran out of its budget and should return partial result
+ */
+inline bool BudgetExpired()
+{
+    auto* budget = ActiveBudget();
+    return budget != nullptr && budget->Expired();
+};
+
+/**
+ * Point active budget of thread at given budget while in scope, previous one is restored even
+ * when stage throws
+ */
+struct ScopedBudget
+{
+    StageBudget* previous;
+
+    ScopedBudget(StageBudget* budget): previous{ActiveBudget()} { ActiveBudget() = budget; };
+    ~ScopedBudget() { ActiveBudget() = previous; };
+
+    ScopedBudget(const ScopedBudget&) = delete;
+    ScopedBudget& operator=(const ScopedBudget&) = delete;
+};
+
+/**
+ * Wrap stage function so it runs with given budget, clock starts when it is called
+ */
+template <typename F>
+auto WithBudget(std::chrono::steady_clock::duration budget, F f)
+{
+    return [budget, f](auto&&... args)
+    {
+        StageBudget _budget {budget};
+        ScopedBudget scope {&_budget};
+        f(std::forward<decltype(args)>(args)...);
+    };
+};
 
 class Vector2D
 {
@@ -139,6 +289,7 @@ class PixelArray
         virtual void remove(Pixel pixel) { _set_pixels.erase(pixel); _invalidated = true; };
         virtual void remove(int x, int y) { remove((Pixel){x, y}); };
         virtual void clear() { _set_pixels.clear(); };
+        void reserve(size_t count) { _set_pixels.reserve(count); };
 
         Rect bbox()
         {
@@ -315,6 +466,9 @@ class Map {
     private:
         int _WIDTH {4200};
         int _HEIGHT {1200};
+        float _SCALE {1.0};
+        bool _HAS_ROI {false};
+        Rect _ROI {0, 0, 0, 0};
 
         float _COPPER_FREQUENCY = 0.0;
         float _COPPER_SIZE = 0.0;
@@ -342,11 +496,15 @@ class Map {
         float _SURFACE_PARTS_FREQUENCY = 0.5;
         float _SURFACE_PARTS_OCTAVES = 0.25;
 
+        unsigned int _SEED = 0;
+
         std::atomic_bool _initialized { false };
         std::atomic_bool _force_stop {false };
         std::atomic_bool _generating { false };
         std::atomic_int _thread_count { 0 };
         std::string _generation_message;
+        uint64_t _stage_versions[5] {0, 0, 0, 0, 0};
+        bool _generate_stages[5] {true, true, true, true, true};
 
         HorizontalAreas::Area _space {HorizontalAreas::SPACE};
         HorizontalAreas::Area _surface {HorizontalAreas::SURFACE};
@@ -358,8 +516,20 @@ class Map {
         std::vector<std::unique_ptr<Structures::GeneratedStructure>> _generated_structures;
         std::vector<std::unique_ptr<Structures::GeneratedStructure>> _underground_structures;
         std::vector<std::string> _errors;
+        std::vector<std::string> _degradations[5];
 
         std::unordered_map<Pixel, PixelMetadata, PixelHash, PixelEqual> _pixel_map;
+        std::vector<uint32_t> _layers[Layers::COUNT];
+        int _layer_stride {0};
+
+        void SetLayer(int layer, Pixel p, uint32_t type)
+        {
+            if (p.x < 0 || p.y < 0 || p.x >= _layer_stride)
+                return;
+            size_t i = (size_t) p.y * _layer_stride + p.x;
+            if (i < _layers[layer].size())
+                _layers[layer][i] = type;
+        };
 
     public:
         std::mutex mutex;
@@ -372,6 +542,10 @@ class Map {
             for (auto x = 0; x <= this->Width(); ++x)
                 for (auto y = 0; y <= this->Height(); ++y) 
                     _pixel_map.emplace(std::make_pair((Pixel){x, y}, PixelMetadata()));
+
+            _layer_stride = this->Width() + 1;
+            for (auto& layer: _layers)
+                layer.assign((size_t) _layer_stride * (this->Height() + 1), 0);
             _initialized = true;
         };
 
@@ -392,6 +566,58 @@ class Map {
             return _HEIGHT;
         };
 
+        auto Scale()
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            return _SCALE;
+        };
+
+        /**
+         * Resolution relative to full size map, stages scale their constants accordingly
+         * It has to be set before Init
+         */
+        auto Scale(float scale)
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            if (_SCALE != scale)
+            {
+                _SCALE = scale;
+                _WIDTH = (int)(4200 * scale);
+                _HEIGHT = (int)(1200 * scale);
+                return true;
+            }
+            return false;
+        };
+
+        /**
+         * Region of interest limits placement of underground structures, whole map if not set
+         */
+        Rect RegionOfInterest()
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            if (_HAS_ROI) return _ROI;
+            return {0, 0, _WIDTH, _HEIGHT};
+        };
+
+        auto RegionOfInterest(Rect roi)
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            _HAS_ROI = true;
+            _ROI = roi;
+        };
+
+        auto HasRegionOfInterest()
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            return _HAS_ROI;
+        };
+
+        void ClearRegionOfInterest()
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            _HAS_ROI = false;
+        };
+
         auto CopperFrequency()
         {
             const std::lock_guard<std::mutex> lock(mutex);
@@ -766,6 +992,128 @@ class Map {
             return false;
         };
 
+        auto Seed()
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            return _SEED;
+        };
+
+        auto Seed(unsigned int seed)
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            if (_SEED != seed)
+            {
+                _SEED = seed;
+                return true;
+            }
+            return false;
+        };
+
+        /**
+         * Copy generation parameters and seed of other map
+         */
+        void CopyParameters(Map& other)
+        {
+            std::lock(mutex, other.mutex);
+            const std::lock_guard<std::mutex> lock(mutex, std::adopt_lock);
+            const std::lock_guard<std::mutex> other_lock(other.mutex, std::adopt_lock);
+            _COPPER_FREQUENCY = other._COPPER_FREQUENCY;
+            _COPPER_SIZE = other._COPPER_SIZE;
+            _IRON_FREQUENCY = other._IRON_FREQUENCY;
+            _IRON_SIZE = other._IRON_SIZE;
+            _SILVER_FREQUENCY = other._SILVER_FREQUENCY;
+            _SILVER_SIZE = other._SILVER_SIZE;
+            _GOLD_FREQUENCY = other._GOLD_FREQUENCY;
+            _GOLD_SIZE = other._GOLD_SIZE;
+            _HILLS_FREQUENCY = other._HILLS_FREQUENCY;
+            _HOLES_FREQUENCY = other._HOLES_FREQUENCY;
+            _CABINS_FREQUENCY = other._CABINS_FREQUENCY;
+            _ISLANDS_FREQUENCY = other._ISLANDS_FREQUENCY;
+            _CHASM_FREQUENCY = other._CHASM_FREQUENCY;
+            _TREE_FREQUENCY = other._TREE_FREQUENCY;
+            _LAKE_FREQUENCY = other._LAKE_FREQUENCY;
+            _CAVE_FREQUENCY = other._CAVE_FREQUENCY;
+            _CAVE_STROKE_SIZE = other._CAVE_STROKE_SIZE;
+            _CAVE_POINTS_SIZE = other._CAVE_POINTS_SIZE;
+            _CAVE_CURVNESS = other._CAVE_CURVNESS;
+            _SURFACE_PARTS_COUNT = other._SURFACE_PARTS_COUNT;
+            _SURFACE_PARTS_FREQUENCY = other._SURFACE_PARTS_FREQUENCY;
+            _SURFACE_PARTS_OCTAVES = other._SURFACE_PARTS_OCTAVES;
+            _SEED = other._SEED;
+        };
+
+        /**
+         * Set control parameter by its name in parameter files, false if there is no such parameter
+         */
+        bool SetParameter(const std::string& name, float value)
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            std::pair<const char*, float*> parameters[] = {
+                {"copper_frequency", &_COPPER_FREQUENCY},
+                {"copper_size", &_COPPER_SIZE},
+                {"iron_frequency", &_IRON_FREQUENCY},
+                {"iron_size", &_IRON_SIZE},
+                {"silver_frequency", &_SILVER_FREQUENCY},
+                {"silver_size", &_SILVER_SIZE},
+                {"gold_frequency", &_GOLD_FREQUENCY},
+                {"gold_size", &_GOLD_SIZE},
+                {"hills_frequency", &_HILLS_FREQUENCY},
+                {"holes_frequency", &_HOLES_FREQUENCY},
+                {"cabins_frequency", &_CABINS_FREQUENCY},
+                {"islands_frequency", &_ISLANDS_FREQUENCY},
+                {"chasm_frequency", &_CHASM_FREQUENCY},
+                {"tree_frequency", &_TREE_FREQUENCY},
+                {"lake_frequency", &_LAKE_FREQUENCY},
+                {"cave_frequency", &_CAVE_FREQUENCY},
+                {"cave_stroke_size", &_CAVE_STROKE_SIZE},
+                {"cave_points_size", &_CAVE_POINTS_SIZE},
+                {"cave_curvness", &_CAVE_CURVNESS},
+                {"surface_parts_count", &_SURFACE_PARTS_COUNT},
+                {"surface_parts_frequency", &_SURFACE_PARTS_FREQUENCY},
+                {"surface_parts_octaves", &_SURFACE_PARTS_OCTAVES},
+            };
+
+            for (auto& parameter: parameters)
+            {
+                if (name == parameter.first)
+                {
+                    *parameter.second = value;
+                    return true;
+                }
+            }
+            return false;
+        };
+
+        /**
+         * Whether stage has to be generated on next scene run
+         */
+        auto GenerateStage(int stage)
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            return _generate_stages[stage];
+        };
+
+        void GenerateStage(int stage, bool value)
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            _generate_stages[stage] = value;
+        };
+
+        /**
+         * Version of stage result currently stored in map, 0 if unknown
+         */
+        auto StageVersion(int stage)
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            return _stage_versions[stage];
+        };
+
+        void StageVersion(int stage, uint64_t version)
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            _stage_versions[stage] = version;
+        };
+
         auto IsGenerating()
         {
             return _generating.load();
@@ -914,14 +1262,15 @@ class Map {
         auto& UndergroundStructures()
         {
             const std::lock_guard<std::mutex> lock(mutex);
-            return _generated_structures;
+            return _underground_structures;
         }
 
-        auto& UndergroundStructure(unsigned long type)
+        Structures::GeneratedStructure& UndergroundStructure(unsigned long type);
+
+        void AddUndergroundStructure(std::unique_ptr<Structures::GeneratedStructure> structure)
         {
             const std::lock_guard<std::mutex> lock(mutex);
-            _underground_structures.emplace_back(new Structures::GeneratedStructure(*this, type));
-            return *_underground_structures.back();
+            _underground_structures.push_back(std::move(structure));
         }
 
         auto GetUndergroundStructures(unsigned long type)
@@ -981,6 +1330,8 @@ class Map {
         void ClearStage0()
         {
             const std::lock_guard<std::mutex> lock(mutex);
+            _stage_versions[0] = 0;
+            _degradations[0].clear();
             _space.clear();
             _surface.clear();
             _underground.clear();
@@ -990,24 +1341,32 @@ class Map {
         void ClearStage1()
         {
             const std::lock_guard<std::mutex> lock(mutex);
+            _stage_versions[1] = 0;
+            _degradations[1].clear();
             _biomes.clear();
         };
 
         void ClearStage2()
         {
             const std::lock_guard<std::mutex> lock(mutex);
+            _stage_versions[2] = 0;
+            _degradations[2].clear();
             _structures.clear();
         };
 
         void ClearStage3()
         {
             const std::lock_guard<std::mutex> lock(mutex);
+            _stage_versions[3] = 0;
+            _degradations[3].clear();
             _generated_structures.clear();
         };
 
         void ClearStage4()
         {
             const std::lock_guard<std::mutex> lock(mutex);
+            _stage_versions[4] = 0;
+            _degradations[4].clear();
             _underground_structures.clear();
         };
 
@@ -1017,9 +1376,34 @@ class Map {
             ClearStage1();
             ClearStage2();
             ClearStage3();
+            ClearStage4();
 
             _errors.clear();
             _pixel_map.clear();
+            for (auto& layer: _layers)
+                layer.clear();
+            _layer_stride = 0;
+        };
+
+        /**
+         * Clear generated world but keep pixels allocated, so warm map of same size is reused
+         */
+        void Reset()
+        {
+            ClearStage0();
+            ClearStage1();
+            ClearStage2();
+            ClearStage3();
+            ClearStage4();
+
+            const std::lock_guard<std::mutex> lock(mutex);
+            _errors.clear();
+            _HAS_ROI = false;
+            _force_stop = false;
+            for (auto& pair: _pixel_map)
+                pair.second = PixelMetadata();
+            for (auto& layer: _layers)
+                std::fill(layer.begin(), layer.end(), 0);
         };
 
         void Error(std::string msg)
@@ -1034,6 +1418,50 @@ class Map {
             return _errors.back();
         };
 
+        /**
+         * Stage returned partial result because it ran out of budget
+         */
+        void Degrade(int stage, std::string what)
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            _degradations[stage].push_back(what);
+        };
+
+        bool IsDegraded(int stage)
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            return _degradations[stage].size() > 0;
+        };
+
+        bool IsDegraded()
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            for (auto& degradations: _degradations)
+                if (degradations.size() > 0) return true;
+            return false;
+        };
+
+        /**
+         * Comma separated list of degraded parts of the world
+         */
+        std::string Degradations()
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            std::string result;
+            for (auto& degradations: _degradations)
+            {
+                for (auto& what: degradations)
+                    result += (result.empty() ? "" : ", ") + what;
+            }
+            return result;
+        };
+
+        auto ErrorCount()
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            return _errors.size();
+        };
+
         bool HasError()
         {
             const std::lock_guard<std::mutex> lock(mutex);
@@ -1055,51 +1483,98 @@ class Map {
 
         void SetMetadata(Pixel p, PixelMetadata meta)
         {
-            _pixel_map[p] = meta;
+            auto& slot = _pixel_map[p];
+            auto* journal = ActiveJournal();
+            CheckWriteArea(p);
+            if (journal != nullptr) journal->Record(p, slot, meta);
+            slot = meta;
+            SetLayer(Layers::BIOME, p, meta.biome != nullptr ? meta.biome->GetType() : 0);
+            SetLayer(Layers::DEFINED_STRUCTURE, p, meta.defined_structure != nullptr ? meta.defined_structure->GetType() : 0);
+            SetLayer(Layers::GENERATED_STRUCTURE, p, meta.generated_structure != nullptr ? meta.generated_structure->GetType() : 0);
+        };
+
+        /**
+         * Row major layer of (Width() + 1) x (Height() + 1) pixels, valid until map is cleared
+         */
+        const uint32_t* Layer(int layer) const
+        {
+            return _layers[layer].data();
+        };
+
+        /**
+         * Distance between rows of layer in pixels
+         */
+        int LayerStride() const
+        {
+            return _layer_stride;
+        };
+
+        /**
+         * Single layer writes, stages running concurrently never overwrite layers of each other
+         */
+        void SetBiome(Pixel p, Biomes::Biome* biome)
+        {
+            CheckWriteArea(p);
+            auto& slot = _pixel_map[p];
+            if (slot.biome == biome) return;
+            auto* journal = ActiveJournal();
+            if (journal != nullptr) journal->Record(p, MetadataJournal::BIOME);
+            slot.biome = biome;
+            SetLayer(Layers::BIOME, p, biome != nullptr ? biome->GetType() : 0);
+        };
+
+        void SetDefinedStructure(Pixel p, Structures::DefinedStructure* structure)
+        {
+            CheckWriteArea(p);
+            auto& slot = _pixel_map[p];
+            if (slot.defined_structure == structure) return;
+            auto* journal = ActiveJournal();
+            if (journal != nullptr) journal->Record(p, MetadataJournal::DEFINED);
+            slot.defined_structure = structure;
+            SetLayer(Layers::DEFINED_STRUCTURE, p, structure != nullptr ? structure->GetType() : 0);
+        };
+
+        void SetGeneratedStructure(Pixel p, Structures::GeneratedStructure* structure)
+        {
+            CheckWriteArea(p);
+            auto& slot = _pixel_map[p];
+            if (slot.generated_structure == structure) return;
+            auto* journal = ActiveJournal();
+            if (journal != nullptr) journal->Record(p, MetadataJournal::GENERATED);
+            slot.generated_structure = structure;
+            SetLayer(Layers::GENERATED_STRUCTURE, p, structure != nullptr ? structure->GetType() : 0);
         };
 };
 
 inline void Biomes::Biome::add(Pixel pixel)
 {
-    auto meta = map.GetMetadata(pixel);
-    meta.biome = this;
-    map.SetMetadata(pixel, meta);
+    map.SetBiome(pixel, this);
     PixelArray::add(pixel);
 };
 
 inline void Biomes::Biome::remove(Pixel pixel)
 {
-    auto meta = map.GetMetadata(pixel);
-    meta.biome = nullptr;
-    map.SetMetadata(pixel, meta);
+    map.SetBiome(pixel, nullptr);
     PixelArray::remove(pixel);
 };
 
 inline void Biomes::Biome::clear()
 {
     for (auto& p: _set_pixels)
-    {
-        auto meta = map.GetMetadata(p);
-        meta.biome = nullptr;
-        map.SetMetadata(p, meta);
-    };
+        map.SetBiome(p, nullptr);
 
     PixelArray::clear();
 };
 
 inline void Structures::DefinedStructure::add(Pixel pixel)
 {
-    auto meta = map.GetMetadata(pixel);
-    meta.defined_structure = this;
-    map.SetMetadata(pixel, meta);
+    map.SetDefinedStructure(pixel, this);
     PixelArray::add(pixel);
 };
 
 inline void Structures::DefinedStructure::remove(Pixel pixel)
 {
-    auto meta = map.GetMetadata(pixel);
-    meta.defined_structure = nullptr;
-    map.SetMetadata(pixel, meta);
+    map.SetDefinedStructure(pixel, nullptr);
     PixelArray::remove(pixel);
 };
 
@@ -1107,28 +1582,20 @@ inline void Structures::DefinedStructure::remove(Pixel pixel)
 inline void Structures::DefinedStructure::clear()
 {
     for (auto& p: _set_pixels)
-    {
-        auto meta = map.GetMetadata(p);
-        meta.defined_structure = nullptr;
-        map.SetMetadata(p, meta);
-    };
+        map.SetDefinedStructure(p, nullptr);
 
     PixelArray::clear();
 };
 
 inline void Structures::GeneratedStructure::add(Pixel pixel)
 {
-    auto meta = map.GetMetadata(pixel);
-    meta.generated_structure = this;
-    map.SetMetadata(pixel, meta);
+    map.SetGeneratedStructure(pixel, this);
     PixelArray::add(pixel);
 };
 
 inline void Structures::GeneratedStructure::remove(Pixel pixel)
 {
-    auto meta = map.GetMetadata(pixel);
-    meta.generated_structure = nullptr;
-    map.SetMetadata(pixel, meta);
+    map.SetGeneratedStructure(pixel, nullptr);
     PixelArray::remove(pixel);
 };
 
@@ -1136,13 +1603,113 @@ inline void Structures::GeneratedStructure::remove(Pixel pixel)
 inline void Structures::GeneratedStructure::clear()
 {
     for (auto& p: _set_pixels)
-    {
-        auto meta = map.GetMetadata(p);
-        meta.generated_structure = nullptr;
-        map.SetMetadata(p, meta);
-    };
+        map.SetGeneratedStructure(p, nullptr);
 
     PixelArray::clear();
 };
 
+/**
+ * Pixel can be taken when it is empty or belongs to one of A_STRUCTURES
+ */
+inline bool Accepts(const PixelMetadata& meta, unsigned long A_STRUCTURES, bool can_be_empty)
+{
+    return (can_be_empty && meta.generated_structure == nullptr) || 
+           (meta.generated_structure != nullptr && meta.generated_structure->GetType() & A_STRUCTURES);
+};
+
+/**
+ * Write area declared by stage, stages with disjoint areas can run concurrently. Underground
+ * structures created inside are registered and writes crossing the border are applied on Flush,
+ * so calling Flush in fixed order keeps results independent of thread timing
+ */
+class WriteArea
+{
+    protected:
+        struct Deferred
+        {
+            PixelArray* arr;
+            Pixel p;
+            unsigned long A_STRUCTURES;
+            bool can_be_empty;
+        };
+
+        Map& map;
+        Rect rect;
+        std::vector<std::unique_ptr<Structures::GeneratedStructure>> structures;
+        std::vector<Deferred> deferred;
+
+    public:
+        WriteArea(Map& _map, Rect _rect): map{_map}, rect{_rect} {};
+
+        bool Contains(Pixel p) const
+        {
+            return p.x >= rect.x && p.x <= rect.x + rect.w && p.y >= rect.y && p.y <= rect.y + rect.h;
+        };
+
+        /**
+         * Wrap stage function so area is declared on any thread
+         */
+        template <typename F>
+        auto Declared(F f)
+        {
+            return [this, f](auto&&... args)
+            {
+                auto* previous = ActiveWriteArea();
+                ActiveWriteArea() = this;
+                f(std::forward<decltype(args)>(args)...);
+                ActiveWriteArea() = previous;
+            };
+        };
+
+        Structures::GeneratedStructure& UndergroundStructure(unsigned long type)
+        {
+            structures.emplace_back(new Structures::GeneratedStructure(map, type));
+            return *structures.back();
+        };
+
+        void Defer(PixelArray& arr, Pixel p, unsigned long A_STRUCTURES, bool can_be_empty)
+        {
+            deferred.push_back({&arr, p, A_STRUCTURES, can_be_empty});
+        };
+
+        void Flush()
+        {
+            for (auto& structure: structures)
+                map.AddUndergroundStructure(std::move(structure));
+            structures.clear();
+
+            for (auto& d: deferred)
+            {
+                if (Accepts(map.GetMetadata(d.p), d.A_STRUCTURES, d.can_be_empty))
+                    d.arr->add(d.p);
+            }
+            deferred.clear();
+        };
+};
+
+inline void CheckWriteArea(Pixel p)
+{
+#ifdef DEBUG
+    auto* area = ActiveWriteArea();
+    if (area != nullptr && !area->Contains(p))
+    {
+        fprintf(stderr, "WRITE OUTSIDE OF DECLARED AREA [%d:%d]\n", p.x, p.y);
+        abort();
+    }
+#else
+    (void)p;
+#endif
+};
+
+inline Structures::GeneratedStructure& Map::UndergroundStructure(unsigned long type)
+{
+    auto* area = ActiveWriteArea();
+    if (area != nullptr)
+        return area->UndergroundStructure(type);
+
+    const std::lock_guard<std::mutex> lock(mutex);
+    _underground_structures.emplace_back(new Structures::GeneratedStructure(*this, type));
+    return *_underground_structures.back();
+};
+
 #endif
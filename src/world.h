@@ -0,0 +1,100 @@
+#ifndef WORLD
+#define WORLD
+
+#include <stdio.h>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifndef UTILS
+#include "utils.h"
+#endif
+
+/************************************************
+*
+* WORLD FILE
+*
+*************************************************/
+
+/**
+ * Binary dump of generated world, all values are little endian
+ *
+ *   char[4]   "PCGW"
+ *   uint32    version
+ *   uint32    width, height     (pixel count of each row and column)
+ *   uint32    seed
+ *   float     scale
+ *   uint32    layer count
+ *   uint32    layers[count][height][width]
+ *
+ * Layers are types of biome, defined structure and generated structure of each pixel, 0 if there
+ * is none
+ */
+namespace World
+{
+    const char MAGIC[4] = {'P', 'C', 'G', 'W'};
+    const uint32_t VERSION = 1;
+    const uint32_t LAYERS = Layers::COUNT;
+}
+
+inline void AppendWorld(std::vector<unsigned char>& out, const void* data, size_t size)
+{
+    auto* bytes = static_cast<const unsigned char*>(data);
+    out.insert(out.end(), bytes, bytes + size);
+};
+
+inline void AppendWorld(std::vector<unsigned char>& out, uint32_t value)
+{
+    unsigned char bytes[4] = {
+        (unsigned char)(value), (unsigned char)(value >> 8), (unsigned char)(value >> 16), (unsigned char)(value >> 24)
+    };
+    AppendWorld(out, bytes, 4);
+};
+
+/**
+ * Encode world of generated map into its file representation
+ */
+inline std::vector<unsigned char> EncodeWorld(Map& map)
+{
+    uint32_t width = map.Width() + 1;
+    uint32_t height = map.Height() + 1;
+    float scale = map.Scale();
+    uint32_t scale_bits;
+    std::memcpy(&scale_bits, &scale, sizeof(scale_bits));
+
+    std::vector<unsigned char> out;
+    out.reserve(28 + (size_t)World::LAYERS * width * height * 4);
+    AppendWorld(out, World::MAGIC, 4);
+    AppendWorld(out, World::VERSION);
+    AppendWorld(out, width);
+    AppendWorld(out, height);
+    AppendWorld(out, map.Seed());
+    AppendWorld(out, scale_bits);
+    AppendWorld(out, World::LAYERS);
+
+    // LAYERS ARE STORED DENSE WITH ROW STRIDE OF WIDTH
+    for (uint32_t layer = 0; layer < World::LAYERS; ++layer)
+    {
+        auto* data = map.Layer(layer);
+        for (size_t i = 0; i < (size_t) width * height; ++i)
+            AppendWorld(out, data[i]);
+    }
+
+    return out;
+};
+
+/**
+ * Write encoded world to file, false on failure
+ */
+inline bool WriteWorld(const std::string& path, const std::vector<unsigned char>& data)
+{
+    auto* file = fopen(path.c_str(), "wb");
+    if (file == nullptr)
+        return false;
+
+    auto written = fwrite(data.data(), 1, data.size(), file);
+    return fclose(file) == 0 && written == data.size();
+};
+
+#endif // WORLD